@@ -0,0 +1,26 @@
+#-------------------------------------------------
+#
+# Stress check of FilterContours: the grid filter is compared with the
+# all-pairs filter on random sets of candidate quads and both are timed.
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = filter_contours
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+QT_CONFIG -= no-pkg-config
+CONFIG += link_pkgconfig
+PKGCONFIG += opencv
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+        main.cpp \
+    ../../calibration/src_contours.cpp
+
+HEADERS += \
+    ../../calibration/src_contours.hpp
@@ -0,0 +1,131 @@
+#include "calibration/src_contours.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+/* Stress check of FilterContours with hundreds of candidate quads.
+ * Each scene holds nested quad pairs (an object quad and its hole, as the template quads are found)
+ * and single quads which may overlap the others without nesting. The grid filter of FilterContours
+ * is compared with the all-pairs filter it replaced, both are timed on the same scenes.
+ * The timings depend on the cv::pointPolygonTest of the linked OpenCV, so its version is printed first.
+ * The program returns 1 if the filters keep different quads. */
+
+#define SCENE_WIDTH     1280
+#define SCENE_HEIGHT    800
+#define SCENES          20      // Random scenes of each size
+#define REPEATS         10      // Filter runs of each scene
+
+static Quad randomQuad(RNG &rng, Point2f center, float radius, int contour, int parent)
+{
+    Quad quad;
+    float start = rng.uniform(0.0f, (float)CV_PI);
+    for (int i = 0; i < 4; i++) {
+        float angle = start + i * (float)CV_PI / 2 + rng.uniform(-0.3f, 0.3f);
+        quad.pt[i] = Point(cvRound(center.x + radius * cos(angle)), cvRound(center.y + radius * sin(angle)));
+    }
+    quad.hole = (parent >= 0);
+    quad.contour = contour;
+    quad.parent = parent;
+    quad.box = boundingRect(vector<Point>(quad.pt, quad.pt + 4));
+    return quad;
+}
+
+static void randomScene(RNG &rng, int num, vector<Quad> &quads)
+{
+    quads.clear();
+    while ((int)quads.size() < num) {
+        Point2f center(rng.uniform(50.0f, SCENE_WIDTH - 50.0f), rng.uniform(50.0f, SCENE_HEIGHT - 50.0f));
+        float radius = rng.uniform(8.0f, 40.0f);
+        int contour = (int)quads.size();
+        quads.push_back(randomQuad(rng, center, radius, contour, -1));
+
+        // Half of the quads have a hole, so they form nested pairs
+        if (((int)quads.size() < num) && (rng.uniform(0, 2) == 0))
+            quads.push_back(randomQuad(rng, center, radius * 0.5f, contour + 1, contour));
+    }
+}
+
+// The filter of the original implementation: every quad is tested against all quads with pointPolygonTest
+static void filterAllPairs(vector<Quad> &quads)
+{
+    int num = (int)quads.size();
+    vector<bool> keep(num, false);
+    vector<vector<Point2f> > polygons(num);
+    for (int i = 0; i < num; i++)
+        polygons[i].assign(quads[i].pt, quads[i].pt + 4);
+
+    for (int i = 0; i < num; i++) {
+        for (int j = 0; (j < num) && !keep[i]; j++) {
+            bool is_inside = true, is_outside = true;
+            for (int k = 0; k < 4; k++) {
+                is_inside &= (pointPolygonTest(polygons[i], polygons[j][k], false) > 0);
+                is_outside &= (pointPolygonTest(polygons[j], polygons[i][k], false) > 0);
+            }
+            keep[i] = is_inside || is_outside;
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < num; i++)
+        if (keep[i])
+            quads[kept++] = quads[i];
+    quads.resize(kept);
+}
+
+static bool sameQuads(const vector<Quad> &a, const vector<Quad> &b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (a[i].contour != b[i].contour)
+            return false;
+    return true;
+}
+
+int main()
+{
+    const int sizes[] = {16, 64, 256, 512, 1024};
+    RNG rng(0x5eed);
+    ContourArena arena;
+    int mismatches = 0;
+
+    printf("OpenCV %s\n", CV_VERSION);
+    printf("%8s %14s %14s %9s\n", "quads", "all-pairs, ms", "grid, ms", "speedup");
+    for (int num : sizes) {
+        int64 old_ticks = 0, new_ticks = 0;
+        for (int scene = 0; scene < SCENES; scene++) {
+            vector<Quad> quads, expected;
+            randomScene(rng, num, quads);
+
+            // The filter looks up the parent quads by the contour index
+            arena.contours.assign(quads.size(), vector<Point>());
+
+            for (int r = 0; r < REPEATS; r++) {
+                expected = quads;
+                int64 start = getTickCount();
+                filterAllPairs(expected);
+                old_ticks += getTickCount() - start;
+
+                arena.quads = quads;
+                start = getTickCount();
+                FilterContours(arena);
+                new_ticks += getTickCount() - start;
+            }
+
+            if (!sameQuads(expected, arena.quads)) {
+                printf("%d quads, scene %d: all-pairs filter keeps %d quads, grid filter keeps %d\n",
+                       num, scene, (int)expected.size(), (int)arena.quads.size());
+                mismatches++;
+            }
+        }
+
+        double runs = SCENES * REPEATS;
+        double old_ms = old_ticks * 1000.0 / getTickFrequency() / runs;
+        double new_ms = new_ticks * 1000.0 / getTickFrequency() / runs;
+        printf("%8d %14.3f %14.3f %8.1fx\n", num, old_ms, new_ms, old_ms / MAX(new_ms, 1e-9));
+    }
+
+    if (mismatches)
+        printf("%d scenes differ\n", mismatches);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,31 @@
+#-------------------------------------------------
+#
+# Comparison of the contour search with the CvSeq search it replaced:
+# both run on the sample camera frames, the found quads are diffed and
+# both searches are timed.
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = get_contours
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+QT_CONFIG -= no-pkg-config
+CONFIG += link_pkgconfig
+PKGCONFIG += opencv
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+        main.cpp \
+    legacy_contours.cpp \
+    ../../calibration/src_contours.cpp \
+    ../../calibration/defisheye.cpp
+
+HEADERS += \
+    legacy_contours.hpp \
+    ../../calibration/src_contours.hpp \
+    ../../calibration/defisheye.hpp
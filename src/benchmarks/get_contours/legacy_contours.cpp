@@ -0,0 +1,208 @@
+#include "legacy_contours.hpp"
+
+namespace legacy {
+
+int GetContours(const Mat &img, CvSeq** root, CvMemStorage *storage, int min_size)
+{
+    const int min_dilations = 0;
+    const int max_dilations = 0;
+
+	Mat temp_threshold_rgb(img.rows, img.cols, CV_8UC3, Scalar(0, 0, 0, 0));
+	
+	for (int k = 0; k < 6; k++) {
+		int block_size = cvRound(MIN(img.cols, img.rows) * (k % 2 == 0 ? 0.2 : 0.1)) | 1;
+		for (int dilations = min_dilations; dilations <= max_dilations; dilations++)
+		{
+			Mat temp_threshold;
+			Mat temp_threshold_rgb(img.rows, img.cols, CV_8UC3, Scalar(0, 0, 0, 0));
+
+			/*********************** Thresholding ***************************/
+#if 1
+			//Adaptive threshold
+			adaptiveThreshold(img, temp_threshold, 255, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY, block_size, (k/2)*5);
+#else
+			// Empiric threshold level
+			double mean = cvAvg(img).val[0];
+			int thresh_level = cvRound(mean - 10);
+			thresh_level = MAX(thresh_level, 10);
+
+			threshold(img, temp_threshold, thresh_level, 255, CV_THRESH_BINARY);
+#endif
+
+#if SHOW_ALL_CONTOURS
+//			if(debug_mode)
+//				showImg(temp_threshold);
+#endif
+			/*********************** Dilatation ***************************/
+			//cvDilate(temp_threshold, temp_threshold, 0, dilations);
+
+			/*********************** Generate Quads ***********************/
+			IplImage copy = temp_threshold;
+			IplImage* tmp = &copy;
+
+			// create temporary storage for contours and the sequence of pointers to found quadrangles
+			Ptr<CvMemStorage> temp_storage;
+			temp_storage = cvCreateChildMemStorage( storage );
+		    *root = cvCreateSeq( 0, sizeof(CvSeq), sizeof(CvSeq*), temp_storage );
+
+			 // initialize contour retrieving routine
+			CvContourScanner scanner = cvStartFindContours(tmp, temp_storage, sizeof(CvContourEx), RETR_CCOMP, CV_CHAIN_APPROX_SIMPLE );
+
+		    // get all the contours one by one
+			CvSeq *src_contour = 0;
+		    while( (src_contour = cvFindNextContour( scanner )) != 0 )
+		    {
+		        CvSeq *dst_contour = 0;
+		        CvRect rect = ((CvContour*)src_contour)->rect;
+
+		        // reject contours with too small perimeter
+		        if(rect.width*rect.height >= min_size )
+		        {
+		            int approx_level;
+		            const int min_approx_level = 1, max_approx_level = MAX_CONTOUR_APPROX;
+		            for( approx_level = min_approx_level; approx_level <= max_approx_level; approx_level++ )
+		            {
+		                dst_contour = cvApproxPoly( src_contour, sizeof(CvContour), temp_storage, CV_POLY_APPROX_DP, (float)approx_level );
+
+		                if( dst_contour->total == 4 )
+		                    break;
+
+		                // we call this again on its own output, because sometimes
+		                // cvApproxPoly() does not simplify as much as it should.
+		                dst_contour = cvApproxPoly( dst_contour, sizeof(CvContour), temp_storage, CV_POLY_APPROX_DP, (float)approx_level );
+
+		                if( dst_contour->total == 4 )
+		                    break;
+		            }
+
+		            // reject non-quadrangles
+		            if(dst_contour->total == 4 && cvCheckContourConvexity(dst_contour))
+		            {
+		                if(fabs(cvContourArea(dst_contour, CV_WHOLE_SEQ)) > min_size )
+		                {
+
+		                	CvPoint pt[4];
+          	                for(int i = 0; i < 4; i++ )
+          	                    pt[i] = *(CvPoint*)cvGetSeqElem(dst_contour, i);
+
+          	                if((pt[0].x > 10) && (pt[0].y > 10) && (pt[1].x > 10) && (pt[1].y > 10) &&
+          	                   (pt[2].x > 10) && (pt[2].y > 10) && (pt[3].x > 10) && (pt[3].y > 10)) {
+								CvContourEx* parent = (CvContourEx*)(src_contour->v_prev);
+								parent->counter++;
+								dst_contour->v_prev = (CvSeq*)parent;
+								cvSeqPush(*root, &dst_contour);
+          	                }
+		                }
+		            }
+		        }
+		    }
+		    // finish contour retrieving
+ 		    cvEndFindContours(&scanner);
+
+ 			// filter found contours
+ 			FilterContours(root);
+
+/*#if SHOW_ALL_CONTOURS == 1
+			if (debug_mode) {
+				for (int idx = 0; idx < (*root)->total; idx++)
+				{
+					CvSeq * contours = *(CvSeq**)cvGetSeqElem(*root, idx);
+					// get contour points
+					vector<Point> contour_points;
+					for (int i = 0; i < 4; i++) {
+						contour_points.push_back(*(CvPoint*)cvGetSeqElem(contours, i));
+					}
+					for (int i = 0; i < 4; i++) line(temp_threshold_rgb, contour_points[i], contour_points[(i + 1) & 3], Scalar(255, 255, 255), 1, CV_AA, 0);
+				}
+				showImg(temp_threshold_rgb);
+			}
+#endif*/
+		}
+		// if 4 contours are detected, then break
+	    if((*root)->total == CONTOURS_NUM)
+	    	break;
+	}
+	
+	return ((*root)->total);
+}
+
+
+/**************************************************************************************************************
+ *
+ * @brief  			Filter found contours.
+ *
+ * @param  	in/out	CvSeq** root - sequence of contours
+ *
+ * @return 			-
+ *
+ * @remarks 		The function checks all contours from the input sequence and removes contours
+ * 					which are not located inside another sequence contour or which do not contain
+ * 					another sequence contour.
+ *
+ **************************************************************************************************************/
+void FilterContours(CvSeq** root)
+{
+	int idx = (*root)->total - 1; // index of the last sequence contour
+	int contours_num = (*root)->total; // number of contours
+	// for each sequence contour
+	while(idx >= 0)
+	{
+		CvSeq * src_contour = *(CvSeq**)cvGetSeqElem(*root, idx); // get idx contour
+		// get contour points
+		vector<Point2f> contour_1;
+		for(int i = 0; i < src_contour->total; i++) {
+			contour_1.push_back(*(CvPoint*)cvGetSeqElem(src_contour, i));
+		}
+
+		bool test = 0;
+		for(int j = 0; j < contours_num; j++)
+		{
+			CvSeq * contour = *(CvSeq**)cvGetSeqElem(*root, j); // get j contour
+			// get contour points
+			vector<Point2f> contour_2;
+			for(int i = 0; i < contour->total; i++) {
+				contour_2.push_back(*(CvPoint*)cvGetSeqElem(contour, i));
+			}
+
+			bool is_inside = 1; // idx contour is inside another contour
+			bool is_outside = 1; // another contour is inside the idx contour
+			for(int i = 0; i < contour->total; i++) {
+				is_inside = is_inside & (pointPolygonTest(contour_1, contour_2[i], false) > 0); // check all points of contour
+				is_outside = is_outside & (pointPolygonTest(contour_2, contour_1[i], false) > 0); // check all points of contour
+			}
+			if(is_inside || is_outside) // if idx contour is inside j contour or j contour is inside idx contour
+			{
+				test = 1; // don't remove contour
+				break;
+			}
+		}
+		if(!test)
+		{
+			cvSeqRemove(*root, idx); // remove contour
+			contours_num--; // decrease contours number
+		}
+		idx--; // next contour
+	}
+}
+
+
+int SearchQuads(const Mat &img, int min_size, vector<vector<Point> > &quads)
+{
+	CvMemStorage *storage = cvCreateMemStorage(0);
+	CvSeq *root = NULL;
+	int num = GetContours(img, &root, storage, min_size);
+
+	quads.clear();
+	for (int idx = 0; idx < num; idx++)
+	{
+		CvSeq *contour = *(CvSeq**)cvGetSeqElem(root, idx);
+		vector<Point> quad;
+		for (int i = 0; i < 4; i++)
+			quad.push_back(*(CvPoint*)cvGetSeqElem(contour, i));
+		quads.push_back(quad);
+	}
+	cvReleaseMemStorage(&storage);
+	return num;
+}
+
+} // namespace legacy
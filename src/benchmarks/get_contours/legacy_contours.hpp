@@ -0,0 +1,26 @@
+#ifndef LEGACY_CONTOURS_HPP_
+#define LEGACY_CONTOURS_HPP_
+
+#include "calibration/src_contours.hpp"
+
+#include <opencv2/imgproc/imgproc_c.h>
+
+/* The CvSeq contour search which was replaced by the ContourArena search, kept unchanged apart from
+ * the namespace and the quads which are copied out of the sequence. */
+namespace legacy {
+
+struct CvContourEx
+{
+    CV_CONTOUR_FIELDS()
+    int counter;
+};
+
+int GetContours(const Mat &img, CvSeq** root, CvMemStorage *storage, int min_size);
+void FilterContours(CvSeq** root);
+
+// Runs GetContours and returns the corners of the found quads
+int SearchQuads(const Mat &img, int min_size, vector<vector<Point> > &quads);
+
+} // namespace legacy
+
+#endif /* LEGACY_CONTOURS_HPP_ */
@@ -0,0 +1,114 @@
+#include "legacy_contours.hpp"
+#include "calibration/defisheye.hpp"
+
+#include <cstdio>
+#include <algorithm>
+
+/* Comparison of the contour search with the CvSeq search it replaced on the sample camera frames.
+ * Each frame is undistorted with the model and the scale factor of its camera and the bottom roi is
+ * taken as CameraCalibrator::getImagePoints does. Both searches run on the roi, the quads are matched
+ * by their corners and the largest corner displacement of the matched quads is printed with the
+ * timings of both searches. The searches may pick different thresholds, so the matched corners can
+ * differ by a pixel. The program returns 1 if the new search finds fewer quads on any frame.
+ * Usage: get_contours [content path], the default is Content/ of the working directory. */
+
+#define REPEATS         20      // Searches of each frame
+
+// Corners of each quad sorted, so the quads are compared regardless of the start corner and direction
+static vector<Point> sortedCorners(const Point *pt)
+{
+    vector<Point> corners(pt, pt + 4);
+    sort(corners.begin(), corners.end(), [](const Point &a, const Point &b) {
+        return (a.x < b.x) || ((a.x == b.x) && (a.y < b.y));
+    });
+    return corners;
+}
+
+// Returns the number of old quads which have a new quad within max_shift pixels
+static int matchQuads(const vector<vector<Point> > &old_quads, const vector<Quad> &new_quads,
+                      int max_shift, int &shift)
+{
+    int matched = 0;
+    shift = 0;
+    for (const vector<Point> &old_quad : old_quads) {
+        vector<Point> a = sortedCorners(&old_quad[0]);
+        int best = INT_MAX;
+        for (const Quad &quad : new_quads) {
+            vector<Point> b = sortedCorners(quad.pt);
+            int dist = 0;
+            for (int i = 0; i < 4; i++)
+                dist = MAX(dist, MAX(abs(a[i].x - b[i].x), abs(a[i].y - b[i].y)));
+            best = MIN(best, dist);
+        }
+        if (best <= max_shift) {
+            matched++;
+            shift = MAX(shift, best);
+        }
+    }
+    return matched;
+}
+
+int main(int argc, char *argv[])
+{
+    string content = (argc > 1) ? argv[1] : "Content/";
+    FileStorage fs(content + "settings.xml", FileStorage::READ);
+    if (!fs.isOpened()) {
+        printf("%ssettings.xml not found\n", content.c_str());
+        return 2;
+    }
+
+    int cameras = 0;
+    fs["camera"]["number"] >> cameras;
+    ContourArena arena;
+    int lost = 0;
+
+    printf("%6s %9s %9s %8s %10s %14s %14s %9s\n", "frame", "old quads", "new quads", "matched",
+           "max shift", "old, ms", "new, ms", "speedup");
+    for (int c = 1; c <= cameras; c++) {
+        FileNode cam = fs["camera"]["camera" + to_string(c)];
+        float sf = 0, roi = 0;
+        int min_size = 0;
+        cam["sf"] >> sf;
+        cam["roi"] >> roi;
+        cam["contour_min_size"] >> min_size;
+
+        Defisheye model;
+        Mat img = imread(content + "camera_inputs/src_" + to_string(c) + ".jpg");
+        if (img.empty() || (model.loadModel(content + "camera_models/calib_results_" + to_string(c) + ".txt") != 0)) {
+            printf("camera %d: no sample frame or model\n", c);
+            return 2;
+        }
+
+        Mat xmap, ymap, undist, gray;
+        model.createLUT(xmap, ymap, sf);
+        remap(img, undist, xmap, ymap, INTER_LINEAR);
+        cvtColor(undist, gray, CV_BGR2GRAY);
+        Mat bottom = gray(Rect(0, gray.rows * (1 - roi) - 10, gray.cols, gray.rows * roi)).clone();
+
+        vector<vector<Point> > old_quads;
+        int64 old_ticks = 0, new_ticks = 0;
+        for (int r = 0; r < REPEATS; r++) {
+            int64 start = getTickCount();
+            legacy::SearchQuads(bottom, min_size, old_quads);
+            old_ticks += getTickCount() - start;
+
+            start = getTickCount();
+            GetContours(bottom, arena, min_size);
+            new_ticks += getTickCount() - start;
+        }
+
+        int shift;
+        int matched = matchQuads(old_quads, arena.quads, 3, shift);
+        double old_ms = old_ticks * 1000.0 / getTickFrequency() / REPEATS;
+        double new_ms = new_ticks * 1000.0 / getTickFrequency() / REPEATS;
+        printf("%6d %9d %9d %8d %10d %14.3f %14.3f %8.1fx\n", c, (int)old_quads.size(), (int)arena.quads.size(),
+               matched, shift, old_ms, new_ms, old_ms / MAX(new_ms, 1e-9));
+
+        if ((int)arena.quads.size() < (int)old_quads.size() || (matched < (int)old_quads.size()))
+            lost++;
+    }
+
+    if (lost)
+        printf("%d frames lose quads\n", lost);
+    return lost ? 1 : 0;
+}
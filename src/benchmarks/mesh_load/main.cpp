@@ -0,0 +1,139 @@
+#include "common/mesh_file.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+/* Startup load time of the grids.
+ * A bowl grid of angles x rings points is saved in the old text format (triangle soup, 5 values per line),
+ * in the binary float format and in the quantized format, and each file is opened REPEATS times.
+ * open() of the binary files checks the header only, "+ verify" adds the checksum and the index range
+ * check of verify() which open() did on every load before. The quantized grid is opened with and
+ * without the dequantization of getVertices(), which only the CPU users of the grids call.
+ * Mesh files given as arguments are timed too. The program returns 1 if a binary grid differs from the
+ * text grid or does not verify. */
+
+#define REPEATS         20
+#define MESH_TMP        "mesh_load.tmp"
+
+// Quarter of a bowl: flat bottom and a side of a third of the rings, texcoords follow the points.
+// Returns the radius of the bowl.
+static float bowlGrid(int angles, int rings, MeshWriter &mesh)
+{
+    const int nop_z = rings / 3;
+    for (int r = 0; r < rings; r++) {
+        float radius = 1.0f + r * 0.05f;
+        float z = (r < rings - nop_z) ? 0.0f : (r - rings + nop_z) * 0.05f;
+        for (int a = 0; a < angles; a++) {
+            float angle = (float)(a * M_PI / 2 / (angles - 1));
+            cv::Point3f p(radius * cos(angle), radius * sin(angle), z);
+            mesh.addVertex(p, cv::Point2f((float)a / angles, (float)r / rings));
+        }
+    }
+    for (int r = 0; r + 1 < rings; r++) {
+        for (int a = 0; a + 1 < angles; a++) {
+            int v = r * angles + a;
+            mesh.addTriangle(v, v + 1, v + angles);
+            mesh.addTriangle(v + 1, v + angles + 1, v + angles);
+        }
+    }
+    return 1.0f + (rings - 1) * 0.05f;
+}
+
+static int saveText(const MeshFile &grid, const std::string &path)
+{
+    std::ofstream out(path.c_str());
+    for (int t = 0; t < grid.getTriangleNum(); t++) {
+        for (int j = 0; j < 3; j++) {
+            const float *v = grid.getVertex(grid.getTriangleVertex(t, j));
+            out << v[0] << " " << v[1] << " " << v[2] << " " << v[3] << " " << v[4] << "\n";
+        }
+    }
+    return out ? 0 : -1;
+}
+
+// Average time of opening the file in ms, -1 if it can not be opened
+static double timeOpen(const std::string &path, bool verify, bool dequantize, MeshFile &mesh)
+{
+    int64 ticks = 0;
+    for (int r = 0; r < REPEATS; r++) {
+        int64 start = cv::getTickCount();
+        int ret = mesh.open(path);
+        if ((ret == 0) && verify)
+            ret = mesh.verify();
+        if ((ret == 0) && dequantize && !mesh.getVertices())
+            ret = -1;
+        ticks += cv::getTickCount() - start;
+        if (ret != 0)
+            return -1;
+    }
+    return ticks * 1000.0 / cv::getTickFrequency() / REPEATS;
+}
+
+static bool sameGrid(const MeshFile &a, const MeshFile &b, float tolerance)
+{
+    if (a.getTriangleNum() != b.getTriangleNum())
+        return false;
+    for (int t = 0; t < a.getTriangleNum(); t++) {
+        for (int j = 0; j < 3; j++) {
+            const float *va = a.getVertex(a.getTriangleVertex(t, j));
+            const float *vb = b.getVertex(b.getTriangleVertex(t, j));
+            for (int k = 0; k < MESH_COMPONENTS; k++)
+                if (std::fabs(va[k] - vb[k]) > tolerance)
+                    return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const int sizes[][2] = {{60, 80}, {240, 160}, {480, 320}};
+    const std::string text_path = MESH_TMP ".txt", float_path = MESH_TMP ".bin", half_path = MESH_TMP ".half";
+    int mismatches = 0;
+
+    printf("%9s %10s %10s %10s %10s %10s %10s %10s\n", "grid", "triangles", "text, ms", "float, ms",
+           "+ verify", "half, ms", "+ verify", "+ dequant");
+    for (const int *size : sizes) {
+        MeshWriter writer;
+        float radius = bowlGrid(size[0], size[1], writer);
+        writer.optimize();
+        MeshFile text, binary, half;
+        if (writer.save(float_path) || writer.save(half_path, true) || binary.open(float_path) ||
+                saveText(binary, text_path)) {
+            printf("%dx%d: grid files can not be written\n", size[0], size[1]);
+            return 2;
+        }
+
+        double text_ms = timeOpen(text_path, false, false, text);
+        double float_ms = timeOpen(float_path, false, false, binary);
+        double float_verify_ms = timeOpen(float_path, true, false, binary);
+        double half_ms = timeOpen(half_path, false, false, half);
+        double half_verify_ms = timeOpen(half_path, true, false, half);
+        double half_vertices_ms = timeOpen(half_path, false, true, half);
+        printf("%5dx%-3d %10d %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n", size[0], size[1],
+               binary.getTriangleNum(), text_ms, float_ms, float_verify_ms, half_ms, half_verify_ms,
+               half_vertices_ms);
+
+        // Text values are printed with 6 digits, the quantized positions keep MESH_QUANTIZE_ERROR of the extent
+        if ((float_verify_ms < 0) || (half_verify_ms < 0) || (half_vertices_ms < 0) ||
+                !sameGrid(text, binary, 1e-4f) || !sameGrid(text, half, MESH_QUANTIZE_ERROR * radius + 1e-4f)) {
+            printf("%dx%d: binary grid differs from the text grid\n", size[0], size[1]);
+            mismatches++;
+        }
+    }
+    remove(text_path.c_str());
+    remove(float_path.c_str());
+    remove(half_path.c_str());
+
+    for (int i = 1; i < argc; i++) {
+        MeshFile mesh;
+        printf("%s: %d triangles, open %.3f ms, open + verify %.3f ms\n", argv[i],
+               (mesh.open(argv[i]) == 0) ? mesh.getTriangleNum() : 0,
+               timeOpen(argv[i], false, false, mesh), timeOpen(argv[i], true, false, mesh));
+    }
+
+    if (mismatches)
+        printf("%d grids differ\n", mismatches);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,28 @@
+#-------------------------------------------------
+#
+# Startup load time of the grids: MeshFile::open of the text format is
+# compared with the binary formats, with and without the full data check.
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = mesh_load
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+QT_CONFIG -= no-pkg-config
+CONFIG += link_pkgconfig
+PKGCONFIG += opencv
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+        main.cpp \
+    ../../common/mesh_file.cpp \
+    ../../common/mesh_optimizer.cpp
+
+HEADERS += \
+    ../../common/mesh_file.h \
+    ../../common/mesh_optimizer.h
@@ -0,0 +1,172 @@
+#include "calibration/planar_pose.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+/* Accuracy and timing check of SolvePlanarPose.
+ * Each scene views the 16 corners of a template (the layout of Content/template/template_1.txt) from a
+ * random camera pose over the ground plane. The corners get Gaussian noise and k of them are moved away
+ * by a few tens of pixels, as a wrong corner of a detected quad would be. The iterative solvePnP, which
+ * was used before, and SolvePlanarPose solve the same corners and both are timed.
+ * A pose is wrong if it is off by more than MAX_ANGLE or MAX_SHIFT of the camera distance. solvePnP
+ * always returns a pose, SolvePlanarPose may reject the corners instead.
+ * The program returns 1 if SolvePlanarPose accepts more wrong poses than solvePnP returns, rejects
+ * corners with no more outliers than PLANAR_MIN_INLIERS allows, or is less accurate without outliers. */
+
+#define IMAGE_WIDTH     1280
+#define IMAGE_HEIGHT    800
+#define FOCAL           400.0   // Focal length of the undistorted image (pixels)
+#define NOISE           0.3     // Standard deviation of the corner noise (pixels)
+#define MIN_OUTLIER     8.0     // Shift of the outlier corners (pixels)
+#define MAX_OUTLIER     40.0
+#define MAX_ANGLE       2.0     // Max rotation error of a right pose (degrees)
+#define MAX_SHIFT       0.05    // Max translation error of a right pose relative to the camera distance
+#define MAX_OUTLIERS    6
+#define SCENES          1000    // Random scenes for each number of outliers
+
+static const float template_points[16][2] = {
+    {0, 0}, {54, 0}, {54, 54}, {0, 54}, {18, 18}, {36, 18}, {36, 36}, {18, 36},
+    {294, 0}, {348, 0}, {348, 54}, {294, 54}, {312, 18}, {330, 18}, {330, 36}, {312, 36}
+};
+
+struct Result
+{
+    int64 ticks = 0;
+    int accepted = 0;
+    int wrong = 0;              // Accepted poses with the error over MAX_ANGLE or MAX_SHIFT
+    vector<double> angles;      // Rotation errors of the accepted poses (degrees)
+    vector<double> shifts;      // Translation errors of the accepted poses relative to the camera distance
+};
+
+// Camera at a random position behind and above the template, looking at its center
+static void randomPose(RNG &rng, Mat &rvec, Mat &tvec)
+{
+    Vec3d center(174, 27, 0);
+    double distance = rng.uniform(500.0, 1200.0);
+    double tilt = rng.uniform(35.0, 70.0) * CV_PI / 180;
+    double side = rng.uniform(-30.0, 30.0) * CV_PI / 180;
+    Vec3d position = center + distance * Vec3d(sin(side) * cos(tilt), -cos(side) * cos(tilt), sin(tilt));
+
+    // Camera axes: z to the template center, y down in the image (the ground plane normal is +z)
+    Vec3d z = normalize(center - position);
+    Vec3d x = normalize(z.cross(Vec3d(0, 0, 1)));
+    Vec3d y = z.cross(x);
+    double roll = rng.uniform(-5.0, 5.0) * CV_PI / 180;
+    Vec3d xr = cos(roll) * x + sin(roll) * y;
+    Vec3d yr = z.cross(xr);
+
+    Matx33d R(xr[0], xr[1], xr[2], yr[0], yr[1], yr[2], z[0], z[1], z[2]);
+    Rodrigues(Mat(R), rvec);
+    tvec = Mat(-(R * position));
+}
+
+static void poseError(const Mat &rvec, const Mat &tvec, const Mat &rvec_true, const Mat &tvec_true,
+                      double &angle, double &shift)
+{
+    Mat R, R_true;
+    Rodrigues(rvec, R);
+    Rodrigues(rvec_true, R_true);
+    Mat rdiff;
+    Rodrigues(R * R_true.t(), rdiff);
+    angle = norm(rdiff) * 180 / CV_PI;
+    shift = norm(tvec, tvec_true) / norm(tvec_true);
+}
+
+static void addPose(Result &result, const Mat &rvec, const Mat &tvec, const Mat &rvec_true, const Mat &tvec_true)
+{
+    double angle, shift;
+    poseError(rvec, tvec, rvec_true, tvec_true, angle, shift);
+    result.accepted++;
+    result.wrong += (angle > MAX_ANGLE) || (shift > MAX_SHIFT);
+    result.angles.push_back(angle);
+    result.shifts.push_back(shift);
+}
+
+static bool inImage(const vector<Point2f> &points)
+{
+    for (size_t i = 0; i < points.size(); i++)
+        if (!Rect2f(0, 0, IMAGE_WIDTH, IMAGE_HEIGHT).contains(points[i]))
+            return false;
+    return true;
+}
+
+static double median(vector<double> &values)
+{
+    if (values.empty())
+        return 0;
+    nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+int main()
+{
+    RNG rng(0x5eed);
+    Mat K = (Mat_<double>(3, 3) << FOCAL, 0, IMAGE_WIDTH / 2, 0, FOCAL, IMAGE_HEIGHT / 2, 0, 0, 1);
+    Mat dist;
+    vector<Point3f> obj_points;
+    for (int i = 0; i < 16; i++)
+        obj_points.push_back(Point3f(template_points[i][0], template_points[i][1], 0));
+    int regressions = 0;
+
+    printf("OpenCV %s, %d scenes for each number of outliers\n", CV_VERSION, SCENES);
+    printf("%8s %22s %22s %22s %22s\n", "", "us per solve", "right poses", "wrong poses",
+           "median error, deg / %");
+    printf("%8s %11s %10s %11s %10s %11s %10s %11s %10s\n", "outliers",
+           "solvePnP", "planar", "solvePnP", "planar", "solvePnP", "planar", "solvePnP", "planar");
+    for (int k = 0; k <= MAX_OUTLIERS; k++) {
+        Result old_result, new_result;
+        for (int scene = 0; scene < SCENES; scene++) {
+            Mat rvec_true, tvec_true;
+            vector<Point2f> img_points;
+            do {
+                randomPose(rng, rvec_true, tvec_true);
+                projectPoints(obj_points, rvec_true, tvec_true, K, dist, img_points);
+            } while (!inImage(img_points));
+
+            for (size_t i = 0; i < img_points.size(); i++)
+                img_points[i] += Point2f((float)rng.gaussian(NOISE), (float)rng.gaussian(NOISE));
+            vector<int> order(img_points.size());
+            for (size_t i = 0; i < order.size(); i++)
+                order[i] = (int)i;
+            randShuffle(order, 1, &rng);
+            for (int i = 0; i < k; i++) {
+                double angle = rng.uniform(0.0, 2 * CV_PI);
+                double shift = rng.uniform(MIN_OUTLIER, MAX_OUTLIER);
+                img_points[order[i]] += Point2f((float)(shift * cos(angle)), (float)(shift * sin(angle)));
+            }
+
+            Mat rvec, tvec;
+            int64 start = getTickCount();
+            bool solved = solvePnP(obj_points, img_points, K, dist, rvec, tvec);
+            old_result.ticks += getTickCount() - start;
+            if (solved)
+                addPose(old_result, rvec, tvec, rvec_true, tvec_true);
+
+            PlanarPoseReport report;
+            start = getTickCount();
+            int status = SolvePlanarPose(obj_points, img_points, K, dist, rvec, tvec, report);
+            new_result.ticks += getTickCount() - start;
+            if (status == 0)
+                addPose(new_result, rvec, tvec, rvec_true, tvec_true);
+        }
+
+        double us = 1e6 / getTickFrequency() / SCENES;
+        printf("%8d %11.1f %10.1f %11d %10d %11d %10d %5.2f/%4.2f %5.2f/%4.2f\n", k,
+               old_result.ticks * us, new_result.ticks * us,
+               old_result.accepted - old_result.wrong, new_result.accepted - new_result.wrong,
+               old_result.wrong, new_result.wrong,
+               median(old_result.angles), 100 * median(old_result.shifts),
+               median(new_result.angles), 100 * median(new_result.shifts));
+
+        bool regression = (new_result.wrong > old_result.wrong);
+        if (k <= (1 - PLANAR_MIN_INLIERS) * obj_points.size())
+            regression |= (new_result.accepted < 0.99 * SCENES);
+        if (k == 0)
+            regression |= (median(new_result.angles) > 1.5 * median(old_result.angles) + 0.01);
+        if (regression) {
+            printf("%d outliers: regression of SolvePlanarPose\n", k);
+            regressions++;
+        }
+    }
+    return regressions ? 1 : 0;
+}
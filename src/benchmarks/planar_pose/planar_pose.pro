@@ -0,0 +1,26 @@
+#-------------------------------------------------
+#
+# Accuracy and timing check of SolvePlanarPose: the IPPE and RANSAC pose is
+# compared with the iterative solvePnP on synthetic template corners with outliers.
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = planar_pose
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+QT_CONFIG -= no-pkg-config
+CONFIG += link_pkgconfig
+PKGCONFIG += opencv
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+        main.cpp \
+    ../../calibration/planar_pose.cpp
+
+HEADERS += \
+    ../../calibration/planar_pose.hpp
@@ -0,0 +1,160 @@
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+using namespace cv;
+using namespace std;
+
+/* Re-projection of the masked grid points of CurvilinearGrid::reorgGrid.
+ * The grid points are generated as createGrid does for the default settings (angles 60, start_angle 4,
+ * nop_z 30, step_x 0.2) and a camera over the ground. The points over the mask border are moved to it
+ * and re-projected, once by the per-point loop which reorgGrid used (a projectPoints call and deep copies
+ * of the four camera matrices for each point) and once by the batched projectPoints call.
+ * The border is set so that about 10, 25 and 50 % of the points are moved.
+ * The program returns 1 if the projections differ or the batched call is slower. */
+
+#define ANGLES          60
+#define START_ANGLE     4
+#define NOP_Z           30
+#define STEP_X          0.2
+#define RADIUS          3.0     // Radius of the bowl bottom (template widths)
+#define FIRST_ROW       2       // First row of the bowl bottom, as getFirstRow returns for the samples
+#define REPEATS         50
+
+// Camera 1.5 template widths over the ground (the bowl side rises to -z), looking at the grid
+struct Camera
+{
+    Mat rvec, tvec, K, dist;
+
+    Camera()
+    {
+        Vec3d position(0, 1, -1.5);
+        Vec3d z = normalize(Vec3d(0, -2, 0) - position);
+        Vec3d x = normalize(Vec3d(0, 0, 1).cross(z));
+        Vec3d y = z.cross(x);
+        Matx33d R(x[0], x[1], x[2], y[0], y[1], y[2], z[0], z[1], z[2]);
+        Rodrigues(Mat(R), rvec);
+        tvec = Mat(-(R * position));
+        K = (Mat_<double>(3, 3) << 300, 0, 640, 0, 300, 400, 0, 0, 1);
+        dist = Mat(4, 1, CV_32F, Scalar(0));
+    }
+    // Deep copies, as the CameraCalibrator getters return
+    Mat getRvec() const { return rvec.clone(); }
+    Mat getTvec() const { return tvec.clone(); }
+    Mat getK() const { return K.clone(); }
+    Mat getDistCoeffs() const { return dist.clone(); }
+};
+
+static void createGrid(const Camera &camera, vector<Point3f> &p3d, vector<Point2f> &p2d)
+{
+    int pnum = (int)(RADIUS / STEP_X);
+    p3d.clear();
+    for (int angle = START_ANGLE + 1; angle <= ANGLES - START_ANGLE; angle++) {
+        double angle_start = (angle - 1) * (M_PI / ANGLES);
+        double angle_end = angle * (M_PI / ANGLES);
+        for (int i = FIRST_ROW; i < pnum; i++) {
+            double hptn = i * STEP_X;
+            p3d.push_back(Point3f(hptn * cos(angle_end), - hptn * sin(angle_end), 0));
+            p3d.push_back(Point3f(hptn * cos(angle_start), - hptn * sin(angle_start), 0));
+        }
+        for (int i = 1; i <= NOP_Z; i++) {
+            double hptn = RADIUS + i * STEP_X;
+            p3d.push_back(Point3f(hptn * cos(angle_end), - hptn * sin(angle_end), - pow(i * STEP_X, 2)));
+            p3d.push_back(Point3f(hptn * cos(angle_start), - hptn * sin(angle_start), - pow(i * STEP_X, 2)));
+        }
+    }
+    projectPoints(p3d, camera.rvec, camera.tvec, camera.K, camera.dist, p2d);
+}
+
+// The loop of reorgGrid before the batching
+static void reorgPerPoint(const Camera &camera, float border, vector<Point3f> &p3d, vector<Point2f> &p2d)
+{
+    for (uint i = 0; i < p3d.size(); i++) {
+        if (p3d[i].y > border) {
+            vector<Point2f> p2tmp;
+            vector<Point3f> p3tmp;
+            p3d[i].y = border;
+            p3tmp.push_back(p3d[i]);
+            projectPoints(p3tmp, camera.getRvec(), camera.getTvec(), camera.getK(), camera.getDistCoeffs(), p2tmp);
+            p2d[i] = p2tmp[0];
+        }
+    }
+}
+
+// The loop of reorgGrid
+static void reorgBatched(const Camera &camera, float border, vector<Point3f> &p3d, vector<Point2f> &p2d)
+{
+    Mat rvec = camera.getRvec(), tvec = camera.getTvec(), K = camera.getK(), dist = camera.getDistCoeffs();
+    vector<int> moved;
+    vector<Point3f> p3moved;
+    for (uint i = 0; i < p3d.size(); i++) {
+        if (p3d[i].y > border) {
+            p3d[i].y = border;
+            moved.push_back(i);
+            p3moved.push_back(p3d[i]);
+        }
+    }
+    if (moved.empty())
+        return;
+
+    vector<Point2f> p2moved;
+    projectPoints(p3moved, rvec, tvec, K, dist, p2moved);
+    for (uint i = 0; i < moved.size(); i++)
+        p2d[moved[i]] = p2moved[i];
+}
+
+int main()
+{
+    const double shares[] = {0.1, 0.25, 0.5};
+    Camera camera;
+    vector<Point3f> p3d;
+    vector<Point2f> p2d;
+    createGrid(camera, p3d, p2d);
+
+    // Border of each share of the moved points, the points with the largest y are moved
+    vector<float> ys;
+    for (const Point3f &p : p3d)
+        ys.push_back(p.y);
+    sort(ys.begin(), ys.end());
+    int regressions = 0;
+
+    printf("OpenCV %s, %d grid points\n", CV_VERSION, (int)p3d.size());
+    printf("%8s %16s %14s %9s\n", "moved", "per point, ms", "batched, ms", "speedup");
+    for (double share : shares) {
+        float border = ys[(size_t)((1 - share) * (ys.size() - 1))];
+        int64 old_ticks = 0, new_ticks = 0;
+        vector<Point3f> p3old, p3new;
+        vector<Point2f> p2old, p2new;
+        for (int r = 0; r < REPEATS; r++) {
+            p3old = p3d;
+            p2old = p2d;
+            int64 start = getTickCount();
+            reorgPerPoint(camera, border, p3old, p2old);
+            old_ticks += getTickCount() - start;
+
+            p3new = p3d;
+            p2new = p2d;
+            start = getTickCount();
+            reorgBatched(camera, border, p3new, p2new);
+            new_ticks += getTickCount() - start;
+        }
+
+        int moved = 0;
+        double max_diff = 0;
+        for (uint i = 0; i < p3d.size(); i++) {
+            moved += (p3d[i].y > border);
+            max_diff = max(max_diff, norm(p2old[i] - p2new[i]));
+        }
+        double old_ms = old_ticks * 1000.0 / getTickFrequency() / REPEATS;
+        double new_ms = new_ticks * 1000.0 / getTickFrequency() / REPEATS;
+        printf("%8d %16.3f %14.3f %8.1fx\n", moved, old_ms, new_ms, old_ms / MAX(new_ms, 1e-9));
+
+        if ((max_diff > 1e-3) || (new_ms > old_ms)) {
+            printf("%d moved points: max difference %.5f pixels\n", moved, max_diff);
+            regressions++;
+        }
+    }
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Re-projection of the masked grid points of CurvilinearGrid::reorgGrid:
+# the per-point projectPoints calls are compared with one batched call.
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = reorg_grid
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+QT_CONFIG -= no-pkg-config
+CONFIG += link_pkgconfig
+PKGCONFIG += opencv
+
+SOURCES += \
+        main.cpp
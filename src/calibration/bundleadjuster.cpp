@@ -0,0 +1,361 @@
+#include "bundleadjuster.h"
+#include "grid.hpp"
+#include "masks.hpp"
+
+#include <cfloat>
+
+#define BA_MIN_MATCHES 8        // Min number of matches in one overlap
+#define BA_LK_WIN 21            // Window of feature tracking on the top view (pixels)
+#define BA_FB_ERROR 0.5         // Max forward-backward tracking error (pixels)
+
+int BundleAdjuster::adjust(std::vector<CameraCalibrator *> &cameras, const std::vector<cv::Mat> &images)
+{
+    using namespace std;
+    using namespace cv;
+
+    int64 start = getTickCount();
+    matches.clear();
+    initialRms = finalRms = 0;
+
+    if ((cameras.size() < 2) || (images.size() != cameras.size()))
+        return(-1);
+
+    State state;
+    for (uint c = 0; c < cameras.size(); c++) {
+        Mat rvec = cameras[c]->getRvec();
+        Mat tvec = cameras[c]->getTvec();
+        if (rvec.empty() || tvec.empty() ||
+            cameras[c]->getCorners().empty() ||
+            (cameras[c]->getCorners().size() != cameras[c]->getCornerRefs().size())) {
+            cout << "Bundle adjustment: camera " << c << " has no pose" << endl;
+            return(-1);
+        }
+        rvec.convertTo(rvec, CV_64F);
+        tvec.convertTo(tvec, CV_64F);
+        state.rvec.push_back(Vec3d(rvec.ptr<double>()));
+        state.tvec.push_back(Vec3d(tvec.ptr<double>()));
+    }
+
+    /**************************** 1. Match ground features of neighbouring cameras ****************************/
+    if (findMatches(cameras, images, state) != 0) {
+        cout << "Bundle adjustment: not enough matches in the overlaps" << endl;
+        return(-1);
+    }
+    for (const Match &m : matches)
+        state.ground.push_back(m.ground);
+
+    /************************************** 2. Levenberg-Marquardt ********************************************/
+    System system;
+    double cost = evaluate(cameras, state, &system, &initialRms);
+    double initialCost = cost;
+    double lambda = 1e-3;
+    int it = 0;
+
+    for (; it < param.iterations; it++) {
+        if ((getTickCount() - start) * 1000. / getTickFrequency() > param.timeBudget)
+            break;
+
+        State next;
+        double nextCost = DBL_MAX;
+        if (solve(system, lambda, state, next) == 0)
+            nextCost = evaluate(cameras, next, NULL, NULL);
+
+        if (nextCost < cost) {
+            bool converged = (cost - nextCost < 1e-6 * cost);
+            state = next;
+            cost = evaluate(cameras, state, &system, &finalRms);
+            lambda = MAX(lambda / 10, 1e-7);
+            if (converged)
+                break;
+        } else {
+            lambda *= 10;
+            if (lambda > 1e7)
+                break;
+        }
+    }
+
+    /****************************************** 3. Update poses ***********************************************/
+    if (cost < initialCost) {
+        for (uint c = 0; c < cameras.size(); c++)
+            cameras[c]->setPose(Mat(state.rvec[c]), Mat(state.tvec[c]));
+    } else {
+        finalRms = initialRms;
+    }
+
+    cout << "Bundle adjustment: " << matches.size() << " matches, overlap rms " << initialRms
+         << " -> " << finalRms << " px, " << it << " iterations, "
+         << (getTickCount() - start) * 1000. / getTickFrequency() << " ms" << endl;
+    return(0);
+}
+
+cv::Point2d BundleAdjuster::topToGround(const cv::Point2f &p) const
+{
+    double px = 2.0 * param.extent / param.topSize;
+    return cv::Point2d((p.x + 0.5) * px - param.extent, param.extent - (p.y + 0.5) * px);
+}
+
+int BundleAdjuster::topView(CameraCalibrator *cam, const cv::Vec3d &rvec, const cv::Vec3d &tvec,
+                            const cv::Mat &img, cv::Mat &top, cv::Mat &valid)
+{
+    using namespace std;
+    using namespace cv;
+
+    int n = param.topSize;
+    vector<Point3f> p3d(n * n);
+    for (int v = 0; v < n; v++) {
+        for (int u = 0; u < n; u++) {
+            Point2d g = topToGround(Point2f(u, v));
+            p3d[v * n + u] = rotatePoint(cam->index, Point3f(g.x, g.y, 0)); // rotatePoint is its own inverse
+        }
+    }
+
+    vector<Point2f> p2d;
+    projectPoints(p3d, rvec, tvec, cam->getK(), cam->getDistCoeffs(), p2d);
+
+    // Ground behind the camera is projected too, move it out of the image
+    Matx33d R;
+    Rodrigues(rvec, R);
+    for (uint i = 0; i < p3d.size(); i++) {
+        if (R(2, 0) * p3d[i].x + R(2, 1) * p3d[i].y + R(2, 2) * p3d[i].z + tvec[2] <= 0)
+            p2d[i] = Point2f(-1, -1);
+    }
+
+    Mat map = Mat(p2d).reshape(2, n);
+    Mat gray;
+    cvtColor(img, gray, CV_RGB2GRAY);
+    remap(gray, top, map, noArray(), INTER_LINEAR, BORDER_CONSTANT, Scalar(0));
+    remap(cam->validMask, valid, map, noArray(), INTER_NEAREST, BORDER_CONSTANT, Scalar(0));
+    compare(valid, 255, valid, CMP_EQ);
+    return(0);
+}
+
+int BundleAdjuster::findMatches(std::vector<CameraCalibrator *> &cameras, const std::vector<cv::Mat> &images,
+                                const State &state)
+{
+    using namespace std;
+    using namespace cv;
+
+    int num = cameras.size();
+    vector<Mat> tops(num), valids(num);
+    for (int c = 0; c < num; c++)
+        topView(cameras[c], state.rvec[c], state.tvec[c], images[c], tops[c], valids[c]);
+
+    Mat kernel = getStructuringElement(MORPH_RECT, Size(BA_LK_WIN, BA_LK_WIN));
+    for (int i = 0; i < num; i++) {
+        int j = NEXT(i, num - 1);
+
+        // Features are searched where both cameras see the ground
+        Mat overlap;
+        bitwise_and(valids[i], valids[j], overlap);
+        erode(overlap, overlap, kernel);
+
+        vector<Point2f> pts;
+        goodFeaturesToTrack(tops[i], pts, param.features, 0.01, 5, overlap, 7);
+        if ((int)pts.size() < BA_MIN_MATCHES) {
+            cout << "Bundle adjustment: no features in overlap " << i << "-" << j << endl;
+            continue;
+        }
+
+        // Forward-backward tracking from the top view of the camera to the top view of the next camera
+        vector<Point2f> fwd, bwd;
+        vector<uchar> st_fwd, st_bwd;
+        vector<float> err;
+        calcOpticalFlowPyrLK(tops[i], tops[j], pts, fwd, st_fwd, err, Size(BA_LK_WIN, BA_LK_WIN), 3);
+        calcOpticalFlowPyrLK(tops[j], tops[i], fwd, bwd, st_bwd, err, Size(BA_LK_WIN, BA_LK_WIN), 3);
+
+        vector<Point2f> src, dst;
+        for (uint k = 0; k < pts.size(); k++) {
+            if (!st_fwd[k] || !st_bwd[k] ||
+                (norm(bwd[k] - pts[k]) > BA_FB_ERROR) || (norm(fwd[k] - pts[k]) > param.maxShift))
+                continue;
+            Point p = fwd[k];
+            if (!Rect(0, 0, overlap.cols, overlap.rows).contains(p) || !overlap.at<uchar>(p))
+                continue;
+            src.push_back(pts[k]);
+            dst.push_back(fwd[k]);
+        }
+        if ((int)src.size() < BA_MIN_MATCHES)
+            continue;
+
+        // Misaligned top views of a plane are related by a homography
+        vector<uchar> inliers;
+        findHomography(src, dst, RANSAC, 1.0, inliers);
+
+        vector<Point3f> obj_i, obj_j;
+        vector<Point2d> ground;
+        for (uint k = 0; k < src.size(); k++) {
+            if (!inliers[k])
+                continue;
+            Point2d gi = topToGround(src[k]);
+            Point2d gj = topToGround(dst[k]);
+            obj_i.push_back(rotatePoint(cameras[i]->index, Point3f(gi.x, gi.y, 0)));
+            obj_j.push_back(rotatePoint(cameras[j]->index, Point3f(gj.x, gj.y, 0)));
+            ground.push_back(0.5 * (gi + gj));
+        }
+        if ((int)ground.size() < BA_MIN_MATCHES)
+            continue;
+
+        vector<Point2f> img_i, img_j;
+        projectPoints(obj_i, state.rvec[i], state.tvec[i], cameras[i]->getK(), cameras[i]->getDistCoeffs(), img_i);
+        projectPoints(obj_j, state.rvec[j], state.tvec[j], cameras[j]->getK(), cameras[j]->getDistCoeffs(), img_j);
+        for (uint k = 0; k < ground.size(); k++) {
+            Match m;
+            m.cam[0] = i;
+            m.cam[1] = j;
+            m.img[0] = img_i[k];
+            m.img[1] = img_j[k];
+            m.ground = ground[k];
+            matches.push_back(m);
+        }
+    }
+
+    return(matches.empty() ? -1 : 0);
+}
+
+double BundleAdjuster::evaluate(std::vector<CameraCalibrator *> &cameras, const State &state,
+                                System *system, double *rms)
+{
+    using namespace std;
+    using namespace cv;
+
+    int num = cameras.size();
+    if (system) {
+        system->U.assign(num, Matx66d::zeros());
+        system->gc.assign(num, Vec6d::all(0));
+        system->V.assign(matches.size(), Matx22d::zeros());
+        system->gp.assign(matches.size(), Vec2d::all(0));
+        system->W.assign(2 * matches.size(), Matx<double, 6, 2>::zeros());
+    }
+
+    double cost = 0;
+    double overlap_err = 0;
+    int overlap_num = 0;
+
+    for (int c = 0; c < num; c++) {
+        CameraCalibrator *cam = cameras[c];
+
+        // Template corners first, then the ground points seen by the camera
+        vector<Point3f> obj = cam->getCornerRefs();
+        vector<Point2f> img = cam->getCorners();
+        vector<int> point(img.size(), -1); // Match index * 2 + side, or -1 for template corner
+        for (uint k = 0; k < matches.size(); k++) {
+            for (int s = 0; s < 2; s++) {
+                if (matches[k].cam[s] != c)
+                    continue;
+                obj.push_back(rotatePoint(cam->index, Point3f(state.ground[k].x, state.ground[k].y, 0)));
+                img.push_back(matches[k].img[s]);
+                point.push_back(2 * k + s);
+            }
+        }
+
+        vector<Point2f> proj;
+        Mat jac;
+        if (system)
+            projectPoints(obj, state.rvec[c], state.tvec[c], cam->getK(), cam->getDistCoeffs(), proj, jac);
+        else
+            projectPoints(obj, state.rvec[c], state.tvec[c], cam->getK(), cam->getDistCoeffs(), proj);
+
+        // Derivatives of the local point by the ground point
+        Matx33d R;
+        Rodrigues(state.rvec[c], R);
+        Point3f ax = rotatePoint(cam->index, Point3f(1, 0, 0));
+        Point3f ay = rotatePoint(cam->index, Point3f(0, 1, 0));
+        Matx32d dlocal = R * Matx32d(ax.x, ay.x, ax.y, ay.y, ax.z, ay.z);
+
+        for (uint p = 0; p < obj.size(); p++) {
+            Vec2d r(proj[p].x - img[p].x, proj[p].y - img[p].y);
+            double e = norm(r);
+            double w = (e <= param.huber) ? 1.0 : param.huber / e;
+            cost += (e <= param.huber) ? 0.5 * e * e : param.huber * (e - 0.5 * param.huber);
+            if (point[p] >= 0) {
+                overlap_err += e * e;
+                overlap_num++;
+            }
+
+            if (!system)
+                continue;
+
+            const double *j0 = jac.ptr<double>(2 * p);
+            const double *j1 = jac.ptr<double>(2 * p + 1);
+            Matx<double, 2, 6> Jc(j0[0], j0[1], j0[2], j0[3], j0[4], j0[5],
+                                  j1[0], j1[1], j1[2], j1[3], j1[4], j1[5]);
+            system->U[c] += w * Jc.t() * Jc;
+            system->gc[c] += w * Jc.t() * r;
+
+            if (point[p] >= 0) {
+                int k = point[p] / 2;
+                Matx23d dpdt(j0[3], j0[4], j0[5], j1[3], j1[4], j1[5]);
+                Matx22d Jp = dpdt * dlocal;
+                system->V[k] += w * Jp.t() * Jp;
+                system->gp[k] += w * Jp.t() * r;
+                system->W[point[p]] += w * Jc.t() * Jp;
+            }
+        }
+    }
+
+    if (rms)
+        *rms = overlap_num ? sqrt(overlap_err / overlap_num) : 0;
+    return(cost);
+}
+
+int BundleAdjuster::solve(const System &system, double lambda, const State &state, State &next)
+{
+    using namespace cv;
+
+    int num = system.U.size();
+
+    // Reduced camera system S * dc = b after elimination of the ground points
+    Mat S = Mat::zeros(6 * num, 6 * num, CV_64F);
+    Mat b = Mat::zeros(6 * num, 1, CV_64F);
+    for (int c = 0; c < num; c++) {
+        Matx66d U = system.U[c];
+        for (int d = 0; d < 6; d++)
+            U(d, d) *= 1 + lambda;
+        Mat(U).copyTo(S(Rect(6 * c, 6 * c, 6, 6)));
+        Mat(-system.gc[c]).copyTo(b.rowRange(6 * c, 6 * c + 6));
+    }
+
+    std::vector<Matx22d> Vinv(matches.size());
+    for (uint k = 0; k < matches.size(); k++) {
+        Matx22d V = system.V[k];
+        V(0, 0) *= 1 + lambda;
+        V(1, 1) *= 1 + lambda;
+        if (fabs(determinant(V)) < DBL_EPSILON)
+            return(-1);
+        Vinv[k] = V.inv();
+
+        for (int s = 0; s < 2; s++) {
+            int ci = matches[k].cam[s];
+            Matx<double, 6, 2> WV = system.W[2 * k + s] * Vinv[k];
+            Mat bi = b.rowRange(6 * ci, 6 * ci + 6);
+            bi += Mat(WV * system.gp[k]);
+            for (int t = 0; t < 2; t++) {
+                int cj = matches[k].cam[t];
+                Mat Sij = S(Rect(6 * cj, 6 * ci, 6, 6));
+                Sij -= Mat(WV * system.W[2 * k + t].t());
+            }
+        }
+    }
+
+    Mat dc;
+    if (!cv::solve(S, b, dc, DECOMP_CHOLESKY))
+        return(-1);
+
+    /********************** Back substitution of the ground points and the new state ************************/
+    next = state;
+    for (int c = 0; c < num; c++) {
+        const double *d = dc.ptr<double>(6 * c);
+        next.rvec[c] += Vec3d(d[0], d[1], d[2]);
+        next.tvec[c] += Vec3d(d[3], d[4], d[5]);
+    }
+    for (uint k = 0; k < matches.size(); k++) {
+        Vec2d rhs = -system.gp[k];
+        for (int s = 0; s < 2; s++) {
+            int ci = matches[k].cam[s];
+            rhs -= system.W[2 * k + s].t() * Vec6d(dc.ptr<double>(6 * ci));
+        }
+        Vec2d dp = Vinv[k] * rhs;
+        next.ground[k] += Point2d(dp[0], dp[1]);
+    }
+    return(0);
+}
@@ -0,0 +1,73 @@
+#ifndef BUNDLEADJUSTER_H
+#define BUNDLEADJUSTER_H
+
+#include "cameracalibrator.h"
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+/* Joint refinement of the poses of all cameras.
+ * Ground features seen by neighbouring cameras (NEXT/PREV) are matched on top views of the ground,
+ * which are rendered with the current poses, so the matches measure the misalignment of the seams.
+ * The poses and the matched ground points are refined by Levenberg-Marquardt together with the
+ * template corners of each camera, which keep the world frame. The ground points are eliminated by
+ * the Schur complement, so the reduced system has only 6 unknowns per camera and the ring structure
+ * (each block row couples a camera with its neighbours). */
+class BundleAdjuster
+{
+public:
+    struct Param {
+        int iterations = 20;        // Max number of LM iterations
+        int timeBudget = 500;       // Max duration of the adjustment (ms)
+        int features = 100;         // Max number of features in each overlap
+        int topSize = 400;          // Size of the top view (pixels)
+        float extent = 3;           // Half size of the top view in template units
+        float maxShift = 10;        // Max misalignment of matched features on the top view (pixels)
+        float huber = 2;            // Reprojection error with reduced weight (pixels)
+    };
+
+    BundleAdjuster(const Param &p) : param(p) {}
+
+    int adjust(std::vector<CameraCalibrator *> &cameras, const std::vector<cv::Mat> &images);
+    int getMatchesNum() const { return (int)matches.size(); }
+    double getInitialRms() const { return initialRms; }
+    double getFinalRms() const { return finalRms; }
+
+private:
+    struct Match {
+        int cam[2];                 // Camera and its next camera
+        cv::Point2f img[2];         // Observations in the undistorted images
+        cv::Point2d ground;         // Ground point in the common frame
+    };
+
+    struct State {
+        std::vector<cv::Vec3d> rvec;
+        std::vector<cv::Vec3d> tvec;
+        std::vector<cv::Point2d> ground;
+    };
+
+    // Normal equations
+    struct System {
+        std::vector<cv::Matx66d> U;             // Camera blocks
+        std::vector<cv::Vec6d> gc;
+        std::vector<cv::Matx22d> V;             // Ground point blocks
+        std::vector<cv::Vec2d> gp;
+        std::vector<cv::Matx<double, 6, 2>> W;  // Camera - ground point blocks, two per match
+    };
+
+    Param param;
+    std::vector<Match> matches;
+    double initialRms = 0;
+    double finalRms = 0;
+
+    int topView(CameraCalibrator *cam, const cv::Vec3d &rvec, const cv::Vec3d &tvec,
+                const cv::Mat &img, cv::Mat &top, cv::Mat &valid);
+    cv::Point2d topToGround(const cv::Point2f &p) const;
+    int findMatches(std::vector<CameraCalibrator *> &cameras, const std::vector<cv::Mat> &images,
+                    const State &state);
+    double evaluate(std::vector<CameraCalibrator *> &cameras, const State &state,
+                    System *system, double *rms);
+    int solve(const System &system, double lambda, const State &state, State &next);
+};
+
+#endif // BUNDLEADJUSTER_H
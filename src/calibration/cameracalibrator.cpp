@@ -2,10 +2,24 @@
 
 #include <QFile>
 #include <QTextStream>
+#include <QCryptographicHash>
+#include <QtConcurrent>
 
 #include "src_contours.hpp"
+#include "planar_pose.hpp"
 #include <sys/stat.h>
 
+#define TRACK_WIN 5             // Half size of corner search window in tracking mode (pixels)
+#define TRACK_MAX_ERROR 2.0     // Max RMS reprojection error of tracked corners (pixels)
+#define BOWL_HEIGHT_STEPS 100   // Number of bowl height steps checked by getBowlHeight
+#define INTRINSIC_CACHE "intrinsic_cache.xml" // Intrinsic parameters cache in the chessboard directory
+#define CHESSBOARD_SUBPIX_WIN 5 // Half size of chessboard corner refinement window (pixels)
+#define MIN_TEMPLATE_QUADS 2    // Min number of template quads for the pose
+#define ASSOC_MAX_ERROR 4.0     // Max RMS error of template quads association (pixels)
+#define QUALITY_WIDTH 160       // Width of the downsampled roi checked by checkFrame (pixels)
+#define QUALITY_DARK 5          // Luma of under exposed pixels
+#define QUALITY_BRIGHT 250      // Luma of over exposed pixels
+
 cv::Size CameraCalibrator::Template::posterSize(0, 0);
 
 CameraCalibrator::CameraCalibrator()
@@ -16,6 +30,7 @@ CameraCalibrator::CameraCalibrator()
 CameraCalibrator::CameraCalibrator(const string &calibFilePath, int index_, float sf_,
                float roi_, int cntrMinSize_) :
     index(index_),
+    modelPath(calibFilePath),
     sf(sf_),
     roi(roi_),
     cntrMinSize(cntrMinSize_)
@@ -25,50 +40,102 @@ CameraCalibrator::CameraCalibrator(const string &calibFilePath, int index_, floa
         exit(-1);
     }
     model.createLUT(xmap, ymap, sf);
+    updateFisheyeRoi();
+    updateValidMask();
+}
+
+int CameraCalibrator::prepareIntrinsic(const string &path, const string &name, int img_num,
+                                       cv::Size patternSize, Chessboards &boards)
+{
+    boards.patternSize = patternSize;
+    boards.cachePath = path + INTRINSIC_CACHE;
+    boards.names.clear();
+    for (int i = 0; i < img_num; i++)
+        boards.names.push_back(path + name + std::to_string(i) + ".jpg");
+    boards.status.assign(img_num, CHESSBOARD_NOT_LOADED);
+    boards.corners.assign(img_num, std::vector<cv::Point2f>());
+
+    // Chessboards are detected only if images, camera model or scale factor were changed
+    boards.hash = intrinsicHash(boards.names, patternSize);
+    if (!boards.hash.isEmpty() && (loadIntrinsic(boards.cachePath, boards.hash) == 0)) {
+        std::cout << "K (cached): \n" << param.K << std::endl;
+        return(0);
+    }
+    return(1);
 }
 
-int CameraCalibrator::setIntrinsic(const string &path, const string &name, int img_num, cv::Size patternSize)
+int CameraCalibrator::detectChessboard(Chessboards &boards, uint i)
 {
-    /***************************************** 1.Load chessboard image ****************************************/
+    /************** Load chessboard image and remove fisheye distortion using Scarramuza calibrating data **************/
+    std::vector<cv::Point2f> &corners = boards.corners[i];
+    cv::Mat gray = cv::imread(boards.names[i], CV_LOAD_IMAGE_GRAYSCALE);
+    if (gray.empty())
+        return (boards.status[i] = CHESSBOARD_NOT_LOADED);
+    cv::remap(gray, gray, xmap, ymap, cv::INTER_LINEAR);
+
+    // Coarse pass on the half resolution image, the corners are refined at full resolution
+    cv::Mat small;
+    cv::pyrDown(gray, small);
+    int ret = CHESSBOARD_COARSE;
+    if (cv::findChessboardCorners(small, boards.patternSize, corners,
+                                  CV_CALIB_CB_ADAPTIVE_THRESH | CV_CALIB_CB_NORMALIZE_IMAGE |
+                                  CV_CALIB_CB_FAST_CHECK)) {
+        for (cv::Point2f &p : corners)
+            p *= 2;
+    } else if (cv::findChessboardCorners(gray, boards.patternSize, corners,
+                                         CV_CALIB_CB_ADAPTIVE_THRESH | CV_CALIB_CB_FILTER_QUADS)) {
+        ret = CHESSBOARD_FULL;
+    } else {
+        return (boards.status[i] = CHESSBOARD_NOT_FOUND);
+    }
+
+    cv::cornerSubPix(gray, corners, cv::Size(CHESSBOARD_SUBPIX_WIN, CHESSBOARD_SUBPIX_WIN), cv::Size(-1, -1),
+                     cv::TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 30, 0.01));
+    return (boards.status[i] = ret);
+}
+
+int CameraCalibrator::setIntrinsic(const Chessboards &boards)
+{
+    /***************************************** 1.Collect chessboard corners ****************************************/
     std::vector<std::vector<cv::Point3f> > object_points;
     std::vector<std::vector<cv::Point2f> > image_points;
 
     // Define chessboard corners in 3D spase
     std::vector<cv::Point3f> obj;		// Chessboard corners in 3D spase
-    for(int i = 0; i < patternSize.height; ++i)
-        for(int j = 0; j < patternSize.width; ++j)
+    for(int i = 0; i < boards.patternSize.height; ++i)
+        for(int j = 0; j < boards.patternSize.width; ++j)
             obj.push_back(cv::Point3f(j, i, 0.0f));
 
-    for (int i = 0; i < img_num; i++)
+    bool loaded = true;
+    for (uint i = 0; i < boards.names.size(); i++)
     {
-        char img_name[path.length() + name.length() + 7];
-        sprintf(img_name, "%s%s%d.jpg", path.c_str(),
-                name.c_str(), i);
-        cv::Mat chessboard_img = cv::imread(img_name, CV_LOAD_IMAGE_COLOR);
-        if (chessboard_img.empty()) // Check if chessboard had been loaded
-        {
-            std::cout << "The " << img_name << " image not found" << std::endl;
-            return (-1);
+        int ret = boards.status[i];
+        std::cout << "Camera " << index << ". " << boards.names[i] << ": ";
+        switch (ret) {
+        case CHESSBOARD_COARSE:
+            std::cout << "chessboard found" << std::endl;
+            break;
+        case CHESSBOARD_FULL:
+            std::cout << "chessboard found at full resolution only" << std::endl;
+            break;
+        case CHESSBOARD_NOT_FOUND:
+            std::cout << "chessboard not found, retake the image" << std::endl;
+            break;
+        default:
+            std::cout << "image not found" << std::endl;
+            loaded = false;
+            break;
         }
 
-        /************** 2. Calculate maps for fisheye undistortion using Scarramuza calibrating data **************/
-        cv::remap(chessboard_img, chessboard_img, xmap, ymap, cv::INTER_LINEAR); //remove fisheye distortion
-
-        /******************************* 3. Calculate camera intrinsic parameters **********************************/
-        // Convert the image into a grayscale image
-        cv::Mat chessboard_gray;
-        cv::cvtColor(chessboard_img, chessboard_gray, CV_BGR2GRAY);
-
-        //Find chessboard corners
-        std::vector<cv::Point2f> corners;	// Chessboard corners in 2D camera frame
-        if (cv::findChessboardCorners(chessboard_img, patternSize, corners,
-                                      CV_CALIB_CB_ADAPTIVE_THRESH | CV_CALIB_CB_FILTER_QUADS))
+        if ((ret == CHESSBOARD_COARSE) || (ret == CHESSBOARD_FULL))
         {
             // Store points results into the lists
-            image_points.push_back(corners);
+            image_points.push_back(boards.corners[i]);
             object_points.push_back(obj);
         }
     }
+    if (!loaded)
+        return (-1);
 
     // Calculate intrinsic parameters
     if (object_points.size() > 0)
@@ -77,6 +144,8 @@ int CameraCalibrator::setIntrinsic(const string &path, const string &name, int i
                                            model.model.img_size, 0);
         param.distCoeffs= cv::Mat(4, 1, CV_32F, cv::Scalar(0));
         std::cout << "K: \n" << param.K << std::endl;
+        if (!boards.hash.isEmpty())
+            saveIntrinsic(boards.cachePath, boards.hash);
     }
     else
     {
@@ -86,6 +155,64 @@ int CameraCalibrator::setIntrinsic(const string &path, const string &name, int i
     return(0);
 }
 
+QByteArray CameraCalibrator::intrinsicHash(const std::vector<std::string> &files, cv::Size patternSize)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    std::vector<std::string> inputs = files;
+    inputs.push_back(modelPath);
+    for (const std::string &file : inputs) {
+        QFile data(QString::fromStdString(file));
+        if (data.open(QFile::ReadOnly) == false)
+            return QByteArray();
+        if (hash.addData(&data) == false)
+            return QByteArray();
+    }
+
+    QByteArray options;
+    QTextStream out(&options);
+    out << sf << " " << patternSize.width << " " << patternSize.height << " " << files.size();
+    out.flush();
+    hash.addData(options);
+
+    return hash.result().toHex();
+}
+
+int CameraCalibrator::loadIntrinsic(const std::string &cachePath, const QByteArray &hash)
+{
+    cv::FileStorage fs(cachePath, cv::FileStorage::READ);
+    if (!fs.isOpened())
+        return -1;
+
+    std::string cached;
+    fs["hash"] >> cached;
+    if (cached != hash.toStdString())
+        return -1;
+
+    cv::Mat K, distCoeffs;
+    fs["K"] >> K;
+    fs["distCoeffs"] >> distCoeffs;
+    if (K.empty() || distCoeffs.empty())
+        return -1;
+
+    param.K = K;
+    param.distCoeffs = distCoeffs;
+    return 0;
+}
+
+void CameraCalibrator::saveIntrinsic(const std::string &cachePath, const QByteArray &hash)
+{
+    cv::FileStorage fs(cachePath, cv::FileStorage::WRITE);
+    if (!fs.isOpened()) {
+        std::cout << "can not open " << cachePath << std::endl;
+        return;
+    }
+
+    fs << "hash" << hash.toStdString();
+    fs << "K" << param.K;
+    fs << "distCoeffs" << param.distCoeffs;
+}
+
 int CameraCalibrator::setTemplate(const string &tempPath)
 {
     QString qpath = QString::fromStdString(tempPath);
@@ -168,28 +295,170 @@ int CameraCalibrator::setExtrinsic(const Mat &img)
     using namespace std;
     using namespace cv;
 
-    /******************************************* 1. Defisheye *************************************************/
-    Mat und_img;
-    remap(img, und_img, xmap, ymap, cv::INTER_LINEAR); //Remap
+    /********************************** 0. Track corners of the previous frame *********************************/
+    if (updateTracking(img) == 0)
+        return(0);
 
-    /************************************ 3. Get points from distorted image ***********************************/
-    img_p.clear();
-    if (getImagePoints(und_img, temp.ref_points.size(), img_p) != 0)
+    Pose pose;
+    if (estimatePose(img, arena, pose) != 0)
         return(-1);
+    applyPose(pose);
+    return(0);
+}
 
-    /************************ 4. Find an object pose from 3D-2D point correspondences. *************************/
-    vector<Point2f> image_points;
-    vector<Point3f> object_points;
-    for (uint j = 0; j < img_p.size(); j++) {
-        image_points.push_back(img_p[j]);
-        object_points.push_back(Point3f(temp.ref_points[j].x, temp.ref_points[j].y, 0.0));
+int CameraCalibrator::setExtrinsic(const std::vector<cv::Mat> &frames)
+{
+    using namespace std;
+    using namespace cv;
+
+    if (frames.empty())
+        return(-1);
+    if (frames.size() == 1)
+        return(setExtrinsic(frames[0]));
+
+    /***************************** 0. Track corners of the previous frame in the last one ***********************/
+    if (updateTracking(frames.back()) == 0)
+        return(0);
+
+    /******************************** 1. Estimate the pose of each frame in parallel ****************************/
+    prepareFrames(frames.size());
+    vector<Pose> poses(frames.size());
+    vector<QFuture<int>> jobs;
+    for (uint k = 0; k < frames.size(); k++)
+        jobs.push_back(QtConcurrent::run([this, &frames, &poses, k]() {
+            return estimateFramePose(frames[k], k, poses[k]);
+        }));
+
+    vector<int> status(frames.size());
+    for (uint k = 0; k < frames.size(); k++)
+        status[k] = jobs[k].result();
+
+    /*************************************** 2. Robust fusion of the poses **************************************/
+    return(fusePoses(poses, status));
+}
+
+int CameraCalibrator::updateTracking(const cv::Mat &img)
+{
+    using namespace std;
+
+    if (tracking && tracked) {
+        if (trackExtrinsic(img) == 0)
+            return(0);
+        cout << "Camera " << index << ". Tracking is lost, search the template in the whole frame" << endl;
     }
-//    std::cout << object_points << std::endl;
+    tracked = false;
+    return(-1);
+}
+
+void CameraCalibrator::prepareFrames(uint num)
+{
+    if (frameArenas.size() < num)
+        frameArenas.resize(num);
+}
 
-    Mat matImgPoints(image_points);
-    Mat matObjPoints(object_points);
-    solvePnP(matObjPoints, matImgPoints, param.K, param.distCoeffs, param.rvec, param.tvec);
+int CameraCalibrator::fusePoses(std::vector<Pose> &poses, const std::vector<int> &status)
+{
+    using namespace std;
+    using namespace cv;
 
+    vector<Mat> rvecs, tvecs;
+    vector<int> found;
+    for (uint k = 0; k < poses.size(); k++) {
+        if ((k < status.size()) && (status[k] == 0)) {
+            rvecs.push_back(poses[k].rvec);
+            tvecs.push_back(poses[k].tvec);
+            found.push_back(k);
+        }
+    }
+    if (found.empty())
+        return(-1);
+    if (found.size() == 1) {
+        applyPose(poses[found[0]]);
+        return(0);
+    }
+
+    Mat rvec, tvec;
+    PoseFusionReport report;
+    if (FusePoses(rvecs, tvecs, rvec, tvec, report) != 0)
+        return(-1);
+    cout << "Camera " << index << ". Fused pose: " << report.inliers_num << "/" << poses.size()
+         << " frames, dispersion " << report.angle_rms * 180 / CV_PI << " deg, "
+         << report.shift_rms << " units" << endl;
+
+    // Corners are taken from the inlier frame closest to the fused pose
+    int best = -1;
+    double best_dist = DBL_MAX;
+    for (uint i = 0; i < found.size(); i++) {
+        double dist = norm(rvecs[i], rvec) + norm(tvecs[i], tvec);
+        if (report.inliers[i] && (dist < best_dist)) {
+            best_dist = dist;
+            best = found[i];
+        }
+    }
+    if (best < 0)
+        return(-1);
+
+    poses[best].rvec = rvec;
+    poses[best].tvec = tvec;
+    applyPose(poses[best]);
+    return(0);
+}
+
+int CameraCalibrator::estimateFramePose(const cv::Mat &img, uint k, Pose &pose)
+{
+    if (k >= frameArenas.size())
+        return(-1);
+    return(estimatePose(img, frameArenas[k], pose));
+}
+
+int CameraCalibrator::estimatePose(const cv::Mat &img, ContourArena &cntrArena, Pose &pose)
+{
+    using namespace std;
+    using namespace cv;
+
+    /*************************** 0. Skip blurred, badly exposed or empty frames ****************************/
+    if (quality.check && (checkFrame(img) != 0))
+        return(-1);
+
+    pose.img_points.clear();
+    if (fisheyeDetect) {
+        /************************ 1. Get points from fisheye image and undistort them only *********************/
+        if (getFisheyeImagePoints(img, cntrArena, temp.ref_points.size(), pose.img_points) != 0)
+            return(-1);
+    } else {
+        /******************************************* 1. Defisheye *********************************************/
+        Mat und_img;
+        remap(img, und_img, xmap, ymap, cv::INTER_LINEAR); //Remap
+
+        /******************************** 2. Get points from distorted image *******************************/
+        if (getImagePoints(und_img, cntrArena, temp.ref_points.size(), pose.img_points) != 0)
+            return(-1);
+    }
+
+    /********************************* 3. Associate found quads with template quads ****************************/
+    if (associateQuads(pose.img_points, pose.obj_points) != 0)
+        return(-1);
+
+    /************************ 4. Find an object pose from 3D-2D point correspondences. *************************/
+    // RANSAC over IPPE poses of 4-point samples, so a wrong corner does not bias the pose
+    PlanarPoseReport report;
+    int res = SolvePlanarPose(pose.obj_points, pose.img_points, param.K, param.distCoeffs,
+                              pose.rvec, pose.tvec, report);
+    cout << "Camera " << index << ". Pose: inliers " << report.inliers_num << "/" << pose.obj_points.size()
+         << ", rms " << report.rms << " px" << endl;
+    if (res != 0) {
+        cout << "Camera " << index << ". Pose was rejected" << endl;
+        return(-1);
+    }
+    return(0);
+}
+
+void CameraCalibrator::applyPose(const Pose &pose)
+{
+    param.rvec = pose.rvec;
+    param.tvec = pose.tvec;
+    img_p = pose.img_points;
+    obj_p = pose.obj_points;
 
 #if 0
     /********************************* 5. Calculate camera world position. *************************************
@@ -206,6 +475,71 @@ int CameraCalibrator::setExtrinsic(const Mat &img)
 #endif
 
     radius = sqrt((double)pow(temp.ref_points[0].y, 2) + (double)pow(temp.ref_points[0].x, 2));
+    tracked = true;
+}
+
+int CameraCalibrator::trackExtrinsic(const cv::Mat &img)
+{
+    using namespace std;
+    using namespace cv;
+
+    // Only the template corners found in the previous frame are tracked
+    const vector<Point3f> &object_points = obj_p;
+
+    /************************************ 1. Predict corners with previous pose ********************************/
+    vector<Point2f> predicted;
+    projectPoints(object_points, param.rvec, param.tvec, param.K, param.distCoeffs, predicted);
+
+    /************************** 2. Refine corners in small windows of fisheye image ****************************/
+    Rect img_rect(0, 0, img.cols, img.rows);
+    vector<Point2f> fisheye_points(predicted.size());
+    for (uint i = 0; i < predicted.size(); i++) {
+        int col = cvRound(predicted[i].x);
+        int row = cvRound(predicted[i].y);
+        if ((col < 0) || (row < 0) || (col >= xmap.cols) || (row >= xmap.rows))
+            return(-1);
+        Point2f guess(xmap.at<float>(row, col), ymap.at<float>(row, col)); // Predicted corner in fisheye image
+
+        Rect win(cvRound(guess.x) - 2 * TRACK_WIN, cvRound(guess.y) - 2 * TRACK_WIN,
+                 4 * TRACK_WIN + 1, 4 * TRACK_WIN + 1);
+        if ((win & img_rect) != win)
+            return(-1);
+
+        Mat patch;
+        cvtColor(img(win), patch, CV_RGB2GRAY);
+        vector<Point2f> corner(1, guess - Point2f(win.x, win.y));
+        cornerSubPix(patch, corner, Size(TRACK_WIN, TRACK_WIN), Size(-1, -1),
+                     TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 10, 0.05));
+        fisheye_points[i] = corner[0] + Point2f(win.x, win.y);
+
+        if (norm(fisheye_points[i] - guess) > TRACK_WIN) // The corner left the search window
+            return(-1);
+    }
+
+    /*************************************** 3. Undistort found corners ****************************************/
+    vector<Point2f> image_points;
+    if (model.undistortPoints(fisheye_points, image_points, sf) != 0)
+        return(-1);
+
+    /****************************** 4. Refine the pose starting from the previous one ***************************/
+    Mat rvec = param.rvec.clone();
+    Mat tvec = param.tvec.clone();
+    solvePnP(object_points, image_points, param.K, param.distCoeffs, rvec, tvec, true);
+
+    vector<Point2f> reprojected;
+    projectPoints(object_points, rvec, tvec, param.K, param.distCoeffs, reprojected);
+    double err = 0;
+    for (uint i = 0; i < reprojected.size(); i++) {
+        Point2f d = reprojected[i] - image_points[i];
+        err += d.dot(d);
+    }
+    err = sqrt(err / reprojected.size());
+    if (err > TRACK_MAX_ERROR)
+        return(-1);
+
+    param.rvec = rvec;
+    param.tvec = tvec;
+    img_p = image_points;
     return(0);
 }
 
@@ -213,44 +547,123 @@ void CameraCalibrator::updateLUT(float sf_)
 {
     sf = sf_;
     model.createLUT(xmap, ymap, sf);
+    updateFisheyeRoi();
+    updateValidMask();
 }
 
-int CameraCalibrator::getBowlHeight(double radius, double step_x)
+void CameraCalibrator::updateFisheyeRoi()
 {
-    if (param.rvec.empty() || param.tvec.empty() || param.K.empty())
-        return (0);
+    cv::Rect und_roi = cv::Rect(0, xmap.rows * (1 - roi) - 10, xmap.cols, xmap.rows * roi) &
+            cv::Rect(0, 0, xmap.cols, xmap.rows);
+    if (und_roi.area() == 0) {
+        fisheyeRoi = und_roi;
+        fisheyeMinSize = cntrMinSize;
+        return;
+    }
 
-    int num = 1;
-    bool next_point = true;
+    // The undistorted roi is looked up from this part of the fisheye image
+    double min_x, max_x, min_y, max_y;
+    cv::minMaxLoc(xmap(und_roi), &min_x, &max_x);
+    cv::minMaxLoc(ymap(und_roi), &min_y, &max_y);
+    fisheyeRoi = cv::Rect(cv::Point(floor(min_x), floor(min_y)),
+                          cv::Point(ceil(max_x) + 1, ceil(max_y) + 1)) &
+            cv::Rect(0, 0, model.model.img_size.width, model.model.img_size.height);
 
-    // Get mask for defisheye transformation
-    Mat mask(xmap.rows, xmap.cols, CV_8U, Scalar(255));
-    remap(mask, mask, xmap, ymap, cv::INTER_LINEAR);
+    // Template quads are smaller in the fisheye image
+    fisheyeMinSize = MAX(1, cvRound((double)cntrMinSize * fisheyeRoi.area() / und_roi.area()));
+}
 
-    // Get 3D points projection into 2D image for bowl side with x = 0 (z = (y - radius)^2)
-    while((next_point) && (num < 100))
-    {
-        vector<Point3f> p3d;
-        vector<Point2f> p2d;
+void CameraCalibrator::updateValidMask()
+{
+    // Pixels of the undistorted image which are fully covered by the fisheye image
+    validMask.create(xmap.rows, xmap.cols, CV_8U);
+    validMask.setTo(cv::Scalar(255));
+    remap(validMask, validMask, xmap, ymap, cv::INTER_LINEAR);
+}
 
-        double new_point = num * step_x;
-        p3d.push_back(Point3f(0, - radius - new_point, - new_point * new_point)); // Get num point for 3D template
-        projectPoints(p3d, param.rvec, param.tvec, param.K, param.distCoeffs, p2d); // Project the point into 2D image
+int CameraCalibrator::checkFrame(const cv::Mat &img)
+{
+    using namespace std;
+    using namespace cv;
 
-        if((p2d[0].y >= 0) && (p2d[0].y < mask.rows) && (p2d[0].x >= 0) && (p2d[0].x < mask.cols))
-        {
-            if((mask.data != NULL) && (mask.at<uchar>((round)(p2d[0].y), (round)(p2d[0].x)) != 255))
-            {
-                next_point = false;
-            }
-        }
-        else next_point = false;
-        num++;
+    if (fisheyeRoi.area() == 0)
+        return(0);
+
+    // Area downsampling of the template roi only, it averages the fine texture instead of aliasing it
+    // into the Laplacian, so the sharpness score does not depend on the sampling phase
+    Size size(QUALITY_WIDTH, MAX(1, QUALITY_WIDTH * fisheyeRoi.height / fisheyeRoi.width));
+    Mat small, gray;
+    resize(img(fisheyeRoi), small, size, 0, 0, INTER_AREA);
+    cvtColor(small, gray, CV_RGB2GRAY);
+
+    /****************************************** 1. Sharpness ***************************************************/
+    Mat lap;
+    Laplacian(gray, lap, CV_16S);
+    Scalar mean, stddev;
+    meanStdDev(lap, mean, stddev);
+    double sharpness = stddev[0] * stddev[0];
+    if (sharpness < quality.minSharpness) {
+        cout << "Camera " << index << ". Frame is blurred (sharpness " << sharpness << ")" << endl;
+        return(-1);
+    }
+
+    /*************************************** 2. Clipping and contrast ******************************************/
+    int hist[256] = {0};
+    for (int row = 0; row < gray.rows; row++) {
+        const uchar *p = gray.ptr<uchar>(row);
+        for (int col = 0; col < gray.cols; col++)
+            hist[p[col]]++;
+    }
+
+    int total = gray.total();
+    int clipped = 0;
+    for (int v = 0; v <= QUALITY_DARK; v++)
+        clipped += hist[v];
+    for (int v = QUALITY_BRIGHT; v < 256; v++)
+        clipped += hist[v];
+    if (clipped > quality.maxClipping * total) {
+        cout << "Camera " << index << ". Frame is badly exposed (" << 100 * clipped / total << "% clipped)" << endl;
+        return(-1);
+    }
+
+    // Dark markers on the bright poster give distant 5th and 95th percentiles
+    int dark = 0, bright = 255, sum = 0;
+    for (; (dark < 255) && ((sum += hist[dark]) < total / 20); dark++);
+    for (sum = 0; (bright > 0) && ((sum += hist[bright]) < total / 20); bright--);
+    if (bright - dark < quality.minContrast) {
+        cout << "Camera " << index << ". Frame has no contrast markers (contrast " << bright - dark << ")" << endl;
+        return(-1);
     }
-    return(MAX(0, (num - 2)));
+    return(0);
 }
 
-int CameraCalibrator::getImagePoints(cv::Mat &undist_img, uint num,
+int CameraCalibrator::getBowlHeight(double radius, double step_x)
+{
+    if (param.rvec.empty() || param.tvec.empty() || param.K.empty() || validMask.empty())
+        return (0);
+
+    // Get 3D points of bowl side with x = 0 (z = (y - radius)^2) for all heights
+    // and project them into 2D image by one call
+    vector<Point3f> p3d(BOWL_HEIGHT_STEPS - 1);
+    vector<Point2f> p2d;
+    for (int num = 1; num < BOWL_HEIGHT_STEPS; num++) {
+        double new_point = num * step_x;
+        p3d[num - 1] = Point3f(0, - radius - new_point, - new_point * new_point);
+    }
+    projectPoints(p3d, param.rvec, param.tvec, param.K, param.distCoeffs, p2d);
+
+    // The height is limited by the first point which is out of the valid area
+    for (int num = 1; num < BOWL_HEIGHT_STEPS; num++) {
+        const Point2f &p = p2d[num - 1];
+        if ((p.y < 0) || (p.y >= validMask.rows) || (p.x >= validMask.cols) || (p.x < 0) ||
+            (validMask.at<uchar>(MIN((int)round(p.y), validMask.rows - 1),
+                                 MIN((int)round(p.x), validMask.cols - 1)) != 255))
+            return(MAX(0, num - 1));
+    }
+    return(BOWL_HEIGHT_STEPS - 2);
+}
+
+int CameraCalibrator::getImagePoints(cv::Mat &undist_img, ContourArena &cntrArena, uint num,
                    std::vector<cv::Point2f> &img_points)
 {
     using namespace std;
@@ -263,41 +676,111 @@ int CameraCalibrator::getImagePoints(cv::Mat &undist_img, uint num,
     Mat temp;
     undist_img_gray(Rect(0, undist_img_gray.rows * (1 - roi) - 10, undist_img_gray.cols, undist_img_gray.rows * roi)).copyTo(temp); // Get roi
 
-    Ptr<CvMemStorage> storage;
-    storage = cvCreateMemStorage(0);
-    CvSeq * root = cvCreateSeq( 0, sizeof(CvSeq), sizeof(CvSeq*), storage );
+    Point2f shift = Point2f(0,undist_img.rows * (1 - roi) - 10);
+    if (searchQuads(temp, cntrArena, shift, cntrMinSize, MAX_CONTOUR_APPROX, num, img_points) != 0)
+        return(-1);
+
+    for(int i = 0; i < (int)img_points.size() - 1; i++) {
+        line(undist_img, img_points[i], img_points[i+1], cvScalar(255,0,0), 1, CV_AA, 0); // Draw contours
+    }
+    return(0);
+}
+
+int CameraCalibrator::getFisheyeImagePoints(const cv::Mat &img, ContourArena &cntrArena, uint num,
+                                            std::vector<cv::Point2f> &img_points)
+{
+    using namespace std;
+    using namespace cv;
+
+    if (fisheyeRoi.area() == 0)
+        return(-1);
+
+    /*********************************** 1. Contour detections in fisheye roi **********************************/
+    Mat gray;
+    cvtColor(img(fisheyeRoi), gray, CV_RGB2GRAY); // Convert only roi to grayscale
+
+    vector<Point2f> fisheye_points;
+    if (searchQuads(gray, cntrArena, Point2f(fisheyeRoi.x, fisheyeRoi.y), fisheyeMinSize,
+                    MAX_CONTOUR_APPROX_FISHEYE, num, fisheye_points) != 0)
+        return(-1);
+
+    /************************************** 2. Undistort found corners ****************************************/
+    if (model.undistortPoints(fisheye_points, img_points, sf) != 0) {
+        cout << "Camera " << index << ". Template corners can not be undistorted" << endl;
+        return(-1);
+    }
+    return(0);
+}
 
-    int contours_num =  GetContours(temp, &root, storage, cntrMinSize); // Get contours
+int CameraCalibrator::searchQuads(const cv::Mat &gray, ContourArena &cntrArena, cv::Point2f shift, int min_size,
+                                  int max_approx, uint num, std::vector<cv::Point2f> &img_points)
+{
+    using namespace std;
+    using namespace cv;
+
+    int quads_num = num / 4;
+    int contours_num =  GetContours(gray, cntrArena, min_size, max_approx, quads_num); // Get contours
 
-    // If number of contours not equal to CONTOURS_NUM, then complete the calibration process
-    if(contours_num < CONTOURS_NUM) {
-        sec2vector(&root, img_points, Point2f(0, undist_img.rows * (1 - roi) - 10));
+    // Partially visible template is associated later, too few contours complete the calibration process
+    if(contours_num < MIN_TEMPLATE_QUADS) {
+        sec2vector(cntrArena.quads, img_points, shift);
         if(contours_num == 0) {
             cout << "Camera " << index << ". No contours were found. Change the calibration image" << endl;
             return(-1);
         }
-        cout << "Camera " << index << ". The number of contours is fewer than 4. Change the calibration image" << endl;
+        cout << "Camera " << index << ". The number of contours is fewer than " << MIN_TEMPLATE_QUADS
+             << ". Change the calibration image" << endl;
         return(-1);
     }
-    else if(contours_num > CONTOURS_NUM) {
-        sec2vector(&root, img_points, Point2f(0, undist_img.rows * (1 - roi) - 10));
-        cout << "Camera " << index << ". The number of contours is bigger than 4. Change the calibration image" << endl;
-        return(-1);
+    else if(contours_num != quads_num) {
+        cout << "Camera " << index << ". " << contours_num << " contours were found, the template has "
+             << quads_num << endl;
     }
     /**************************************** 2. Contour sorting  ********************************************/
-    SortContours(&root); // Sort contours from left to right
+    SortContours(cntrArena.quads); // Sort contours from left to right
 
     /************************************** 3. Get contours points *******************************************/
-    Point2f shift = Point2f(0,undist_img.rows * (1 - roi) - 10);
-    GetFeaturePoints(&root, img_points, shift); // Sort contour points clockwise (start from the top left point)
+    GetFeaturePoints(cntrArena.quads, img_points, shift); // Sort contour points clockwise (start from the top left point)
 
-    for(int i = 0; i < (int)img_points.size() - 1; i++) {
-        line(undist_img, img_points[i], img_points[i+1], cvScalar(255,0,0), 1, CV_AA, 0); // Draw contours
+    if (img_points.size() != 4 * cntrArena.quads.size()) { // Check points count
+        cout << "Too few points were found" << endl;
+        return(-1);
     }
+    return(0);
+}
 
-    if (img_points.size() != num) { // Check points count
-        cout << "Too few points were found" << endl;
+int CameraCalibrator::associateQuads(std::vector<cv::Point2f> &img_points,
+                                     std::vector<cv::Point3f> &obj_points)
+{
+    using namespace std;
+    using namespace cv;
+
+    vector<Point2f> ref_points;
+    for (const Point3f &p : temp.ref_points)
+        ref_points.push_back(Point2f(p.x, p.y));
+
+    vector<int> ref_quads;
+    int matched = AssociateContours(img_points, ref_points, ref_quads, ASSOC_MAX_ERROR);
+    if (matched < MIN(MIN_TEMPLATE_QUADS, (int)ref_points.size() / 4)) {
+        cout << "Camera " << index << ". Contours do not match the template. Change the calibration image" << endl;
         return(-1);
     }
+    if (matched * 4 != (int)ref_points.size())
+        cout << "Camera " << index << ". " << matched << " of " << ref_points.size() / 4
+             << " template contours are used" << endl;
+
+    // Keep associated quads only, in the image order
+    vector<Point2f> found = img_points;
+    img_points.clear();
+    obj_points.clear();
+    for (uint q = 0; q < ref_quads.size(); q++) {
+        if (ref_quads[q] < 0)
+            continue;
+        for (int c = 0; c < 4; c++) {
+            const Point3f &p = temp.ref_points[4 * ref_quads[q] + c];
+            img_points.push_back(found[4 * q + c]);
+            obj_points.push_back(Point3f(p.x, p.y, 0.0));
+        }
+    }
     return(0);
 }
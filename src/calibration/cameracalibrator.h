@@ -2,9 +2,11 @@
 #define CAMERA_H
 
 #include "defisheye.hpp"
+#include "src_contours.hpp"
 
 #include <opencv2/opencv.hpp>
 
+#include <QByteArray>
 #include <QGenericMatrix>
 #include <QVector4D>
 
@@ -19,6 +21,31 @@ public:
         cv::Mat tvec;
     };
 
+    struct FrameQuality {
+        bool check = false;
+        float minSharpness = 20;    // Min variance of Laplacian of the downsampled roi
+        float maxClipping = 0.25;   // Max share of under or over exposed pixels
+        float minContrast = 60;     // Min difference of dark and bright percentiles of luma
+    };
+
+    // Pose estimated from one frame
+    struct Pose {
+        cv::Mat rvec;
+        cv::Mat tvec;
+        std::vector<cv::Point2f> img_points;
+        std::vector<cv::Point3f> obj_points;
+    };
+
+    // Chessboard images of the intrinsic calibration, detected by the caller
+    struct Chessboards {
+        cv::Size patternSize;
+        std::string cachePath;
+        QByteArray hash;        // Hash of the images and options, empty if not cached
+        std::vector<std::string> names;
+        std::vector<int> status; // ChessboardStatus of each image
+        std::vector<std::vector<cv::Point2f>> corners;
+    };
+
     struct Template {
         static cv::Size posterSize;
         float maxX;
@@ -29,38 +56,85 @@ public:
     CameraCalibrator(const std::string &calibFilePath, int index_ = -1, float sf_ = 10,
            float roi_ = 0.5, int cntrMinSize_ = 200);
 
-    int setIntrinsic(const std::string &path, const std::string &name,
-                     int img_num, cv::Size patternSize);
+    // Steps of the intrinsic calibration, the caller schedules the chessboard detections of all cameras
+    int prepareIntrinsic(const std::string &path, const std::string &name, int img_num,
+                         cv::Size patternSize, Chessboards &boards); // 0 if loaded from the cache
+    int detectChessboard(Chessboards &boards, uint i);  // Thread safe for distinct i
+    int setIntrinsic(const Chessboards &boards);
     int setTemplate(const std::string &tempPath);
     static void normTemplate(std::vector<CameraCalibrator *> &cameras);
     int setExtrinsic(const cv::Mat &img);
+    int setExtrinsic(const std::vector<cv::Mat> &frames);
+    int estimatePose(const cv::Mat &img, ContourArena &cntrArena, Pose &pose);
+    // Steps of setExtrinsic(frames) for callers that schedule the frames themselves
+    int updateTracking(const cv::Mat &img); // 0 if the previous corners are tracked in img
+    void prepareFrames(uint num);           // Reserve contour arenas before estimateFramePose
+    int estimateFramePose(const cv::Mat &img, uint k, Pose &pose); // Thread safe for distinct k
+    int fusePoses(std::vector<Pose> &poses, const std::vector<int> &status);
     void updateLUT(float sf_);
     void setCntr_min_size(int value) { cntrMinSize = value; }
+    void setFisheyeDetect(bool value) { fisheyeDetect = value; }
+    void setTracking(bool value) { tracking = value; }
+    bool isTracked() const { return tracking && tracked; }
+    void setFrameQuality(const FrameQuality &value) { quality = value; }
     void defisheye(Mat &img, Mat &out) {remap(img, out, xmap, ymap, cv::INTER_LINEAR);}
     int getContours(float** lines);
     double getBaseRadius() {return radius;}
+    float getSf() {return sf;} // Scale factor of the undistorted image
     int getBowlHeight(double radius, double step_x);
 
     Mat getK() {Mat M; param.K.copyTo(M); return M;} // Get camera matrix
     Mat getDistCoeffs() {Mat M; param.distCoeffs.copyTo(M); return M;} // Get distortion coefficients
     Mat getRvec() {Mat M; param.rvec.copyTo(M); return M;} // Get rotation vector
     Mat getTvec() {Mat M; param.tvec.copyTo(M); return M;} // Get translation vector
+    const std::vector<cv::Point2f> &getCorners() const {return img_p;} // Get template corners of the last pose
+    const std::vector<cv::Point3f> &getCornerRefs() const {return obj_p;} // Get template points of the corners
+    void setPose(const cv::Mat &rvec, const cv::Mat &tvec) {rvec.copyTo(param.rvec); tvec.copyTo(param.tvec);}
 
     Defisheye model;
     cv::Mat xmap, ymap;
+    cv::Mat validMask;      // Defisheye area covered by the fisheye image, updated with the LUT
     int index;
     Template temp;
 
 private:
+    std::string modelPath;
     float sf;
     Parameters param;
     std::vector<cv::Point2f> img_p;
+    std::vector<cv::Point3f> obj_p;  // Template points of img_p
     double radius;
     float roi;
     int cntrMinSize;
+    bool fisheyeDetect = false;
+    cv::Rect fisheyeRoi;    // Bounding box of the undistorted roi in the fisheye image
+    int fisheyeMinSize = 0; // cntrMinSize scaled to the fisheye roi
+    ContourArena arena;     // Contour search memory reused between frames
+    std::vector<ContourArena> frameArenas; // Contour search memory of multi-frame estimation
+    bool tracking = false;
+    bool tracked = false;   // Pose and corners of the previous frame are valid
+    FrameQuality quality;
+
+    enum ChessboardStatus {CHESSBOARD_NOT_LOADED = -1,
+                           CHESSBOARD_NOT_FOUND,
+                           CHESSBOARD_COARSE,   // Found on the half resolution image
+                           CHESSBOARD_FULL};    // Found on the full resolution image only
 
-    int getImagePoints(cv::Mat &undist_img, uint num,
+    QByteArray intrinsicHash(const std::vector<std::string> &files, cv::Size patternSize);
+    int loadIntrinsic(const std::string &cachePath, const QByteArray &hash);
+    void saveIntrinsic(const std::string &cachePath, const QByteArray &hash);
+    void updateFisheyeRoi();
+    int checkFrame(const cv::Mat &img);
+    void updateValidMask();
+    void applyPose(const Pose &pose);
+    int trackExtrinsic(const cv::Mat &img);
+    int getImagePoints(cv::Mat &undist_img, ContourArena &cntrArena, uint num,
                        std::vector<cv::Point2f> &img_points);
+    int getFisheyeImagePoints(const cv::Mat &img, ContourArena &cntrArena, uint num,
+                              std::vector<cv::Point2f> &img_points);
+    int associateQuads(std::vector<cv::Point2f> &img_points, std::vector<cv::Point3f> &obj_points);
+    int searchQuads(const cv::Mat &gray, ContourArena &cntrArena, cv::Point2f shift, int min_size,
+                    int max_approx, uint num, std::vector<cv::Point2f> &img_points);
 };
 
 #endif // CAMERA_H
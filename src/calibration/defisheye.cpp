@@ -169,3 +169,33 @@ void Defisheye::cam2world(Point3d* p3d, Point2d p2d)
     p3d->y = invnorm*yp;
     p3d->z = invnorm*zp;
 }
+
+
+/* Map fisheye image points to the undistorted image produced by createLUT() with the same sf.
+ * Returns -1 if some point cannot be projected (it lies behind the virtual image plane). */
+int Defisheye::undistortPoints(const vector<Point2f> &src, vector<Point2f> &dst, float sf)
+{
+    Point3d p3D;
+    int ret = 0;
+
+    double xc_norm = model.img_size.width / 2.0;
+    double yc_norm = model.img_size.height / 2.0;
+    double z = -model.img_size.width / sf;
+
+    dst.resize(src.size());
+    for (uint i = 0; i < src.size(); i++)
+    {
+        cam2world(&p3D, Point2d(src[i].y, src[i].x)); // Model coordinates are (row, col)
+        if (p3D.z >= 0)
+        {
+            dst[i] = Point2f(-1, -1);
+            ret = -1;
+            continue;
+        }
+
+        // Intersect the ray with the plane Z = -width/sf which is used by createLUT()
+        double s = z / p3D.z;
+        dst[i] = Point2f((float)(p3D.y * s + xc_norm), (float)(p3D.x * s + yc_norm));
+    }
+    return ret;
+}
@@ -67,6 +67,7 @@ public:
 	
 	
 	void cam2world(Point3d* p3d, Point2d p2d);
+	int undistortPoints(const vector<Point2f> &src, vector<Point2f> &dst, float sf);
 	
 private:
 
@@ -24,6 +24,139 @@
 
 #include "grid.hpp"
 
+/**************************************************************************************************************
+ *
+ * @brief  			Add grid point to the output grid once.
+ *
+ * @param  in		Camera* camera - pointer to the Camera object
+ * 		   in		vector<Point3f> &p3d - 3D grid points
+ * 		   in		vector<Point2f> &p2d - 2D grid points
+ * 		   in		int p - index of the grid point
+ * 		   out		MeshWriter &mesh - output grid
+ * 		   in/out	vector<int> &vertex_index - index of each grid point in the output grid (-1 if not added yet)
+ *
+ * @return 			Index of the vertex in the output grid
+ *
+ * @remarks 		The grid point is rotated according to the camera index and its texel is taken from the
+ * 					LUTs only when the point is added. The triangles which share the point reuse the vertex.
+ *
+ **************************************************************************************************************/
+static int addGridVertex(CameraCalibrator* camera, const vector<Point3f> &p3d, const vector<Point2f> &p2d, int p,
+						 MeshWriter &mesh, vector<int> &vertex_index)
+{
+	if(vertex_index[p] < 0)
+	{
+		float height = camera->xmap.rows;	// 2D grid height (texels)
+		float width = camera->xmap.cols;	// 2D grid width (texels)
+
+		// Recalculate point for fisheye image
+		Point2f texel = Point2f(camera->xmap.at<float>(p2d[p]) / width, camera->ymap.at<float>(p2d[p]) / height);
+
+		// Rotate grid point according to the template
+		vertex_index[p] = mesh.addVertex(rotatePoint(camera->index, p3d[p]), texel);
+	}
+	return(vertex_index[p]);
+}
+
+/**************************************************************************************************************
+ *
+ * @brief  			Check if grid point lays on the camera frame.
+ *
+ * @param  in		Point2f p - 2D grid point
+ * 		   in		float width, height - size of the frame
+ *
+ * @return 			true if the point lays on the frame
+ *
+ **************************************************************************************************************/
+static inline bool isOnFrame(const Point2f &p, float width, float height)
+{
+	return((round(p.x) < width) && (round(p.y) < height) && (p.x >= 0) && (p.y >= 0));
+}
+
+/**************************************************************************************************************
+ *
+ * @brief  			Get index of grid point on the edge of merged sectors.
+ *
+ * @param  in		int nop - number of grid points for one grid sector
+ * 		   in		int a - first merged sector
+ * 		   in		int k - edge number: 0 - start angle of the sector a, k - end angle of the sector (a + k - 1)
+ * 		   in		int r - grid row
+ *
+ * @return 			Index of the grid point
+ *
+ * @remarks 		Each sector has its own points on both edges: the point on the end angle (2 * r) and the point
+ * 					on the start angle (2 * r + 1). The end angle of a sector is the start angle of the next one.
+ *
+ **************************************************************************************************************/
+static inline int edgePoint(int nop, int a, int k, int r)
+{
+	return((k == 0) ? a * nop + 2 * r + 1 : (a + k - 1) * nop + 2 * r);
+}
+
+/**************************************************************************************************************
+ *
+ * @brief  			Print size of the output grid.
+ *
+ * @param  in		char* file_name - output file
+ * 		   in		MeshWriter &mesh - output grid
+ * 		   in		float acmr - average cache miss ratio of the grid before the optimization
+ *
+ * @return 			-
+ *
+ * @remarks 		The indexed grid is compared with the same triangles stored as separate vertices. The number
+ * 					of vertex shader invocations per frame is the number of vertices for the triangle list and
+ * 					the number of unique vertices for the indexed grid (with an ideal post-transform cache).
+ * 					ACMR is the number of vertex shader invocations per triangle with a FIFO post-transform cache.
+ *
+ **************************************************************************************************************/
+static void printGridStat(const char* file_name, const MeshWriter &mesh, float acmr)
+{
+	size_t soup_size = mesh.getIndexNum() * MESH_COMPONENTS * sizeof(float);
+	cout << "Grid " << file_name << ": " << mesh.getIndexNum() / 3 << " triangles, "
+		 << mesh.getVertexNum() << " vertices instead of " << mesh.getIndexNum() << ", "
+		 << mesh.getSize() / 1024 << " KB instead of " << soup_size / 1024 << " KB, "
+		 << "ACMR " << mesh.getAcmr() << " instead of " << acmr << endl;
+}
+
+/**************************************************************************************************************
+ *
+ * @brief  			Get name of the grid file.
+ *
+ * @param  out		char* file_name - file name
+ * 		   in		int index - camera index
+ * 		   in		int level - level of detail
+ *
+ * @return 			-
+ *
+ **************************************************************************************************************/
+static void gridFileName(char* file_name, int index, int level)
+{
+	if(level == 0)
+		sprintf(file_name, "./array%d", index + 1);
+	else
+		sprintf(file_name, "./array%d_lod%d", index + 1, level);
+}
+
+/**************************************************************************************************************
+ *
+ * @brief  			Keep each step-th cell bound.
+ *
+ * @param  in		vector<int> &bounds - bounds of grid cells (rows or sectors)
+ * 		   in		int step - decimation step
+ *
+ * @return 			Decimated bounds, the first and the last bounds are always kept
+ *
+ **************************************************************************************************************/
+static vector<int> decimateBounds(const vector<int> &bounds, int step)
+{
+	vector<int> out;
+	for(uint i = 0; i < bounds.size(); i += step)
+		out.push_back(bounds[i]);
+	if(!bounds.empty() && (out.back() != bounds.back()))
+		out.push_back(bounds.back());
+	return(out);
+}
+
 /**************************************************************************************************************
  *
  * @brief  			CurvilinearGrid class constructor.
@@ -47,6 +180,7 @@ CurvilinearGrid::CurvilinearGrid(uint angles, uint start_angle, uint nop_z, doub
 	parameters.start_angle = start_angle;
 	parameters.nop_z = nop_z;
 	parameters.step_x = step_x;
+	parameters.adaptive_threshold = 0;
 	cam_info.height = 0;
 	cam_info.width = 0;
 	cam_info.index = -1;
@@ -82,34 +216,50 @@ void CurvilinearGrid::createGrid(CameraCalibrator *camera, double radius)
 	}		
 		
 	int pnum = radius / parameters.step_x;	// Number of grid rows of flat bowl bottom
-    int startpnum = (float)camera->temp.ref_points[0].y / (float)camera->temp.ref_points[0].x / (float)parameters.step_x / 3.0;	// The first row of grid
+	int startpnum = getFirstRow(camera, radius, parameters.step_x);	// The first row of grid
 	NoP = 2 * ((pnum - startpnum) + parameters.nop_z); // Number of grid points for one grid sector (angle)
 
-	for(uint angle = parameters.start_angle + 1; angle <= parameters.angles - parameters.start_angle; angle++)
+	// The grid is preallocated, so the sectors are generated and projected in parallel
+	int sectors = parameters.angles - 2 * parameters.start_angle;
+	if((sectors <= 0) || (NoP <= 0))
 	{
-		double angle_start = (angle - 1) * (M_PI / parameters.angles); // Start angle of the current circular sector
-		double angle_end = angle * (M_PI / parameters.angles); // End angle of the current circular sector
+		cout << "Grid " << camera->index << " was not generated" << endl;
+		return;
+	}
+	p3d.resize(sectors * NoP);
+	p2d.resize(sectors * NoP);
+	Mat rvec = camera->getRvec(), tvec = camera->getTvec(), K = camera->getK(), dist = camera->getDistCoeffs();
 
-		// Flat bottom points
-		for(int i = startpnum; i < pnum; i++)
+	parallel_for_(Range(0, sectors), [&](const Range &range) {
+		for(int sector = range.start; sector < range.end; sector++)
 		{
-			double hptn = i * parameters.step_x;
-			p3d.push_back(Point3f(hptn * cos(angle_end), - hptn * sin(angle_end), 0));
-			p3d.push_back(Point3f(hptn * cos(angle_start), - hptn * sin(angle_start), 0));
-		}
+			uint angle = parameters.start_angle + 1 + sector;
+			double angle_start = (angle - 1) * (M_PI / parameters.angles); // Start angle of the current circular sector
+			double angle_end = angle * (M_PI / parameters.angles); // End angle of the current circular sector
+			int p = sector * NoP;
 
-		// Points on bowl side
-		for(uint i = 1; i <= parameters.nop_z; i++)
-		{
-			double hptn = radius + i * parameters.step_x;
-			p3d.push_back(Point3f(hptn * cos(angle_end), - hptn * sin(angle_end), - pow(i * parameters.step_x, 2)));
-			p3d.push_back(Point3f(hptn * cos(angle_start), - hptn * sin(angle_start), - pow(i * parameters.step_x, 2)));
-		}
-	}
+			// Flat bottom points
+			for(int i = startpnum; i < pnum; i++)
+			{
+				double hptn = i * parameters.step_x;
+				p3d[p++] = Point3f(hptn * cos(angle_end), - hptn * sin(angle_end), 0);
+				p3d[p++] = Point3f(hptn * cos(angle_start), - hptn * sin(angle_start), 0);
+			}
 
-	
-	// Projects 3D points to an image plane
-	projectPoints(p3d, camera->getRvec(), camera->getTvec(), camera->getK(), camera->getDistCoeffs(), p2d);
+			// Points on bowl side
+			for(uint i = 1; i <= parameters.nop_z; i++)
+			{
+				double hptn = radius + i * parameters.step_x;
+				p3d[p++] = Point3f(hptn * cos(angle_end), - hptn * sin(angle_end), - pow(i * parameters.step_x, 2));
+				p3d[p++] = Point3f(hptn * cos(angle_start), - hptn * sin(angle_start), - pow(i * parameters.step_x, 2));
+			}
+
+			// Projects 3D points of the sector to an image plane
+			Mat sector_3d(NoP, 1, CV_32FC3, &p3d[sector * NoP]);
+			Mat sector_2d(NoP, 1, CV_32FC2, &p2d[sector * NoP]);
+			projectPoints(sector_3d, rvec, tvec, K, dist, sector_2d);
+		}
+	});
 
 	// Reorganize grid to clean middle part of view
 	reorgGrid(radius, camera);
@@ -118,6 +268,13 @@ void CurvilinearGrid::createGrid(CameraCalibrator *camera, double radius)
 	findSeam(camera, seam);
 }
 
+int CurvilinearGrid::getFirstRow(CameraCalibrator* camera, double radius, double step_x)
+{
+	int pnum = radius / step_x;
+	int startpnum = (float)camera->temp.ref_points[0].y / (float)camera->temp.ref_points[0].x / (float)step_x / 3.0;
+	return(min(startpnum, pnum));
+}
+
 
 
 
@@ -199,6 +356,9 @@ void CurvilinearGrid::reorgGrid(double radius, CameraCalibrator* camera)
 {
 	double step = radius / 4;
 
+	// Camera parameters are copied once, the getters return deep copies
+	Mat rvec = camera->getRvec(), tvec = camera->getTvec(), K = camera->getK(), dist = camera->getDistCoeffs();
+
 	vector<Point3f> point_3d; // 3D coordinates of the closest point for the camera
 	point_3d.push_back(Point3f(0, - step, 0)); // Start value
 
@@ -206,10 +366,10 @@ void CurvilinearGrid::reorgGrid(double radius, CameraCalibrator* camera)
 	camera->defisheye(distortion_mask, distortion_mask);
 
 	// Get closest point for the camera which exists on camera frame
+	vector<Point2f> point_2d; // 2D coordinates of the closest point for the camera on defisheye image
 	for(int i = 0; i < 10; i ++) // 10 iteration is enough
 	{
-		vector<Point2f> point_2d; // 2D coordinates of the closest point for the camera on defisheye image
-		projectPoints(point_3d, camera->getRvec(), camera->getTvec(), camera->getK(), camera->getDistCoeffs(), point_2d);
+		projectPoints(point_3d, rvec, tvec, K, dist, point_2d);
 		step = step / 2; // Increase step
 		if( (point_2d[0].x < distortion_mask.cols) && (point_2d[0].y < distortion_mask.rows) &&
 			(point_2d[0].x >= 0) && (point_2d[0].y >= 0))
@@ -230,18 +390,26 @@ void CurvilinearGrid::reorgGrid(double radius, CameraCalibrator* camera)
 	}
 
 	// Recalculate 3D and 2D grid points
+	vector<int> moved;			// Indices of grid points which lay in masking region
+	vector<Point3f> p3moved;	// New values of 3D points
 	for(uint i = 0; i < p3d.size(); i ++) // Check all grid points
 	{
 		if(p3d[i].y > point_3d[0].y) // If grid point is lays in masking region
 		{
-			vector<Point2f> p2tmp;
-			vector<Point3f> p3tmp;
 			p3d[i].y = point_3d[0].y; // New value of 3D point
-			p3tmp.push_back(p3d[i]);
-			projectPoints(p3tmp, camera->getRvec(), camera->getTvec(), camera->getK(), camera->getDistCoeffs(), p2tmp);
-			p2d[i] = p2tmp[0]; // New value of 2D point
+			moved.push_back(i);
+			p3moved.push_back(p3d[i]);
 		}
 	}
+
+	if(moved.empty())
+		return;
+
+	// All moved points are projected in one batch
+	vector<Point2f> p2moved;
+	projectPoints(p3moved, rvec, tvec, K, dist, p2moved);
+	for(uint i = 0; i < moved.size(); i ++)
+		p2d[moved[i]] = p2moved[i]; // New value of 2D point
 }
 
 /**************************************************************************************************************
@@ -275,9 +443,8 @@ void CurvilinearGrid::findSeam(CameraCalibrator* camera, vector<Point3f> &seam_p
 	int middle_angle = (parameters.angles - 2 * parameters.start_angle) / 2; // index of the middle angle
 	seam_points.clear(); // Clear output vector
 
-	// Get mask for defisheye transformation
-	Mat mask(camera->xmap.rows, camera->xmap.cols, CV_8U, Scalar(255));
-	remap(mask, mask, camera->xmap, camera->ymap, cv::INTER_LINEAR);
+	// Mask for defisheye transformation is cached by the camera
+	const Mat &mask = camera->validMask;
 
 
 	/*********************************************************************************************************************
@@ -436,13 +603,20 @@ void CurvilinearGrid::findSeam(CameraCalibrator* camera, vector<Point3f> &seam_p
 
 /**************************************************************************************************************
  *
- * @brief  			Generate triangles from a 3D grid and save them to a file.
+ * @brief  			Generate triangles from a 3D grid and save them to files.
  *
  * @param  in		Camera* camera - pointer to the Camera object
+ * 		   in		int levels - number of levels of detail
  *
  * @return 			-
  *
  * @remarks 		The file with triangles description has been saved to the file arrayX, where X is camera index.
+ * 					Levels of detail L > 0 are saved to the files arrayX_lodL.
+ * 					The file is written in the binary mesh format (see common/mesh_file.h). Grid points are stored
+ * 					once and the triangles are described by indices.
+ * 					If adaptive_threshold is set, grid cells are merged where the texture mapping is linear.
+ * 					All levels are built from the same projected grid: the level L keeps each 2^L-th row and
+ * 					each 2^L-th group of sectors of the level 0.
  * 					The grid has been rotated according to the camera index value:
  * 						index = 0 - without rotation;
  * 						index = 1 - 90 degree clockwise rotation;
@@ -450,70 +624,255 @@ void CurvilinearGrid::findSeam(CameraCalibrator* camera, vector<Point3f> &seam_p
  * 						index = 3 - 270 degree clockwise rotation;
  *
  **************************************************************************************************************/
-void CurvilinearGrid::saveGrid(CameraCalibrator* camera)
+void CurvilinearGrid::saveGrid(CameraCalibrator* camera, int levels)
+{
+	// Rows and groups of sectors which bound the grid cells
+	vector<int> rows, sectors;
+	adaptGrid(camera, rows, sectors);
+
+	for(int level = 0; level < max(levels, 1); level++)
+	{
+		char file_name[50];
+		gridFileName(file_name, camera->index, level);
+		writeGrid(camera, decimateBounds(rows, 1 << level), decimateBounds(sectors, 1 << level), file_name);
+	}
+}
+
+/**************************************************************************************************************
+ *
+ * @brief  			Generate triangles of the grid cells and save them to a file.
+ *
+ * @param  in		Camera* camera - pointer to the Camera object
+ * 		   in		vector<int> &rows - rows which bound the grid cells
+ * 		   in		vector<int> &sectors - first sector of each group of merged sectors (and the end sector)
+ * 		   in		char* file_name - output file
+ *
+ * @return 			-
+ *
+ **************************************************************************************************************/
+void CurvilinearGrid::writeGrid(CameraCalibrator* camera, const vector<int> &rows, const vector<int> &sectors, const char* file_name)
 {
 	float height = camera->xmap.rows;	// 2D grid height (texels)
 	float width = camera->xmap.cols;	// 2D grid width (texels)
 
-	// Generate output array
-	char file_name[50];
-	sprintf(file_name, "./array%d", camera->index + 1);
+	int groups = max((int)sectors.size() - 1, 0);
+
+	// Groups of sectors have no common points, so each group is assembled separately in parallel
+	vector<MeshWriter> group_mesh(groups); // Grid of each group
+	vector<int> vertex_index(p2d.size(), -1); // Index of grid point in the group grid (-1 if not added yet)
+
+	parallel_for_(Range(0, groups), [&](const Range &range) {
+		for(int g = range.start; g < range.end; g++)
+		{
+			MeshWriter &mesh = group_mesh[g];
+			int a = sectors[g];					// First sector of the group
+			int n = sectors[g + 1] - a;			// Number of sectors in the group
+			for(uint i = 0; i + 1 < rows.size(); i++)
+			{
+				int p = edgePoint(NoP, a, n, rows[i]);			// End angle, first row
+				int p1 = edgePoint(NoP, a, 0, rows[i]);			// Start angle, first row
+				int p2 = edgePoint(NoP, a, n, rows[i + 1]);		// End angle, last row
+				int p3 = edgePoint(NoP, a, 0, rows[i + 1]);		// Start angle, last row
+
+			    /**************************** Get triangles for I quadrant of template **********************************
+			     *   							  p  _  p2
+			     *   Triangles orientation: 		| /|		1st triangle (p - p1 - p2)
+			     *   								|/_|		2nd triangle (p1 - p2 - p3)
+			     *   							 p1     p3
+			     *******************************************************************************************************/
+
+				if(isOnFrame(p2d[p1], width, height) && isOnFrame(p2d[p2], width, height))
+				{
+					int v2 = addGridVertex(camera, p3d, p2d, p1, mesh, vertex_index);
+					int v3 = addGridVertex(camera, p3d, p2d, p2, mesh, vertex_index);
+
+					// 1st triangle (p - p1 - p2)
+					if(isOnFrame(p2d[p], width, height))
+					{
+						int v1 = addGridVertex(camera, p3d, p2d, p, mesh, vertex_index);
+						mesh.addTriangle(v1, v2, v3);
+					}
+
+					// 2nd triangle (p1 - p2 - p3)
+					if(isOnFrame(p2d[p3], width, height))
+					{
+						int v4 = addGridVertex(camera, p3d, p2d, p3, mesh, vertex_index);
+						mesh.addTriangle(v2, v4, v3);
+					}
+				}
+			}
+		}
+	});
+
+	// Concatenate group grids in the sector order, so the output does not depend on the threads
+	MeshWriter mesh; // Output grid
+	for(int g = 0; g < groups; g++)
+		mesh.append(group_mesh[g]);
+
+	// Reorder triangles and vertices for the post-transform cache and the vertex fetch
+	float acmr = mesh.getAcmr();
+	mesh.optimize();
+
+	printGridStat(file_name, mesh, acmr);
+	mesh.save(file_name); // Save grid to the file
+}
+
+/**************************************************************************************************************
+ *
+ * @brief  			Select cells of the adaptive grid.
+ *
+ * @param  in		Camera* camera - pointer to the Camera object
+ * 		   out		vector<int> &rows - rows which bound the grid cells
+ * 		   out		vector<int> &sectors - first sector of each group of merged sectors (and the end sector)
+ *
+ * @return 			-
+ *
+ * @remarks 		Rows are merged first: a row is skipped while the merged cells of every sector are linear.
+ * 					Then sectors are merged while all merged cells of the group are linear. The same rows
+ * 					and sectors are used for the whole grid, so the merged grid has no T-junctions. If
+ * 					adaptive_threshold is 0, all rows and sectors are used.
+ *
+ **************************************************************************************************************/
+void CurvilinearGrid::adaptGrid(CameraCalibrator* camera, vector<int> &rows, vector<int> &sectors)
+{
+	int row_num = NoP / 2;								// Number of grid rows
+	int sector_num = (NoP > 0) ? p2d.size() / NoP : 0;	// Number of grid sectors
 
-    ofstream outC; // Output file
-    outC.open(file_name, std::ofstream::out | std::ofstream::trunc); // Any contents that existed in the file before it is open are discarded.
+	rows.clear();
+	sectors.clear();
 
-    for(uint angle = 0; angle < parameters.angles - 2 * parameters.start_angle; angle++)
+	if(parameters.adaptive_threshold <= 0)
 	{
-		for(int i = 0; i < NoP - 2; i+=2)
+		for(int r = 0; r < row_num; r++)
+			rows.push_back(r);
+		for(int s = 0; s <= sector_num; s++)
+			sectors.push_back(s);
+		return;
+	}
+
+	float height = camera->xmap.rows;	// 2D grid height (texels)
+	float width = camera->xmap.cols;	// 2D grid width (texels)
+
+	// Fisheye texels of grid points
+	vector<Point2f> texels(p2d.size());
+	vector<uchar> valid(p2d.size(), 0);
+	parallel_for_(Range(0, p2d.size()), [&](const Range &range) {
+		for(int p = range.start; p < range.end; p++)
 		{
-			int p = angle * NoP + i;
+			valid[p] = isOnFrame(p2d[p], width, height);
+			if(valid[p])
+				texels[p] = Point2f(camera->xmap.at<float>(p2d[p]), camera->ymap.at<float>(p2d[p]));
+		}
+	});
 
-		    /**************************** Get triangles for I quadrant of template **********************************
-		     *   							  p  _  p+2
-		     *   Triangles orientation: 		| /|		1st triangle (p - p+1 - p+2)
-		     *   								|/_|		2nd triangle (p+1 - p+2 - p+3)
-		     *   							 p+1    p+3
-		     *******************************************************************************************************/
+	// Merge rows while the cells of every sector are linear
+	rows.push_back(0);
+	for(int r0 = 0; r0 < row_num - 1;)
+	{
+		int r1 = r0 + 1;
+		while(r1 + 1 < row_num)
+		{
+			bool linear = true;
+			for(int s = 0; (s < sector_num) && linear; s++)
+				linear = isLinearCell(s, s, r0, r1 + 1, texels, valid);
+			if(!linear) break;
+			r1++;
+		}
+		rows.push_back(r1);
+		r0 = r1;
+	}
 
-			if((round(p2d[p + 1].x) < width) && (round(p2d[p + 1].y) < height) && (p2d[p + 1].x >= 0) && (p2d[p + 1].y >= 0) &&
-			   (round(p2d[p + 2].x) < width) && (round(p2d[p + 2].y) < height) && (p2d[p + 2].x >= 0) && (p2d[p + 2].y >= 0))
-			{
-				// Recalculate point for fisheye image
-				Point2f t2 = Point2f(camera->xmap.at<float>(p2d[p + 1]) / width, camera->ymap.at<float>(p2d[p + 1]) / height);
-				Point2f t3 = Point2f(camera->xmap.at<float>(p2d[p + 2]) / width, camera->ymap.at<float>(p2d[p + 2]) / height);
+	// Merge sectors while all cells of the group are linear
+	for(int a = 0; a < sector_num;)
+	{
+		int b = a;
+		while(b + 1 < sector_num)
+		{
+			bool linear = true;
+			for(uint i = 0; (i + 1 < rows.size()) && linear; i++)
+				linear = isLinearCell(a, b + 1, rows[i], rows[i + 1], texels, valid);
+			if(!linear) break;
+			b++;
+		}
+		sectors.push_back(a);
+		a = b + 1;
+	}
+	sectors.push_back(sector_num);
 
-				// Rotate grid point according to the template
-				Point3f v2 = rotatePoint(camera->index, p3d[p + 1]);
-				Point3f v3 = rotatePoint(camera->index, p3d[p + 2]);
+	cout << "Grid " << camera->index + 1 << ": " << sectors.size() - 1 << " x " << rows.size() - 1 << " cells instead of "
+		 << sector_num << " x " << max(row_num - 1, 0) << endl;
+}
 
-				// 1st triangle (p - p+1 - p+2)
-				if((round(p2d[p].x) < width) && (round(p2d[p].y) < height) && (p2d[p].x >= 0) && (p2d[p].y >= 0))
-				{
-					Point3f v1 = rotatePoint(camera->index, p3d[p]);
-					Point2f t1 = Point2f(camera->xmap.at<float>(p2d[p]) / width, camera->ymap.at<float>(p2d[p]) / height);
+/**************************************************************************************************************
+ *
+ * @brief  			Check if grid cell can be rendered as two triangles.
+ *
+ * @param  in		int a, b - first and last sector of the cell
+ * 		   in		int r0, r1 - first and last row of the cell
+ * 		   in		vector<Point2f> &texels - fisheye texels of grid points
+ * 		   in		vector<uchar> &valid - grid point validity (it lays on the camera frame)
+ *
+ * @return 			true if the cell can be merged
+ *
+ * @remarks 		The texel (fisheye image) and the image point (defisheye image) of each grid point inside the
+ * 					cell are compared with the linear interpolation of the cell corners over the triangle which
+ * 					covers the point. The cell is linear if both errors are below adaptive_threshold pixels.
+ * 					A cell which crosses the frame border is never merged, a cell out of the frame is not
+ * 					rendered and it can be merged.
+ *
+ **************************************************************************************************************/
+bool CurvilinearGrid::isLinearCell(int a, int b, int r0, int r1, const vector<Point2f> &texels, const vector<uchar> &valid)
+{
+	int n = b - a + 1; // Number of sectors in the cell
 
-					// Save triangle points to the output file
-					outC << v1.x << " " << v1.y << " " << v1.z << " " << t1.x << " " << t1.y << endl;
-					outC << v2.x << " " << v2.y << " " << v2.z << " " << t2.x << " " << t2.y << endl;
-					outC << v3.x << " " << v3.y << " " << v3.z << " " << t3.x << " " << t3.y << endl;
-				}
+	int valid_num = 0, point_num = 0;
+	for(int k = 0; k <= n; k++)
+	{
+		for(int r = r0; r <= r1; r++, point_num++)
+			valid_num += valid[edgePoint(NoP, a, k, r)];
+	}
+	if(valid_num == 0) return(true);			// The cell is out of the frame
+	if(valid_num < point_num) return(false);	// The cell crosses the frame border
 
-				// 2nd triangle (p+1 - p+2 - p+3)
-				if((round(p2d[p + 3].x) < width) && (round(p2d[p + 3].y) < height) && (p2d[p + 3].x >= 0) && (p2d[p + 3].y >= 0))
-				{
-					Point3f v4 = rotatePoint(camera->index, p3d[p + 3]);
-					Point2f t4 = Point2f(camera->xmap.at<float>(p2d[p + 3]) / width, camera->ymap.at<float>(p2d[p + 3]) / height);
+	// Cell corners, triangles of the cell are (pa - pb - pc) and (pb - pd - pc)
+	int pa = edgePoint(NoP, a, n, r0);	// End angle, first row
+	int pb = edgePoint(NoP, a, 0, r0);	// Start angle, first row
+	int pc = edgePoint(NoP, a, n, r1);	// End angle, last row
+	int pd = edgePoint(NoP, a, 0, r1);	// Start angle, last row
 
-					// Save triangle points to the output file
-					outC << v2.x << " " << v2.y << " " << v2.z << " " << t2.x << " " << t2.y << endl;
-					outC << v4.x << " " << v4.y << " " << v4.z << " " << t4.x << " " << t4.y << endl;
-					outC << v3.x << " " << v3.y << " " << v3.z << " " << t3.x << " " << t3.y << endl;
-				}
+	for(int k = 0; k <= n; k++)
+	{
+		for(int r = r0; r <= r1; r++)
+		{
+			if(((k == 0) || (k == n)) && ((r == r0) || (r == r1))) continue; // Skip corners
+
+			int p = edgePoint(NoP, a, k, r);
+
+			// Position of the point in the cell: u - along the angle, v - along the grid column
+			float u = (float)k / n;
+			Point3f q0 = p3d[edgePoint(NoP, a, k, r0)];
+			Point3f d = p3d[edgePoint(NoP, a, k, r1)] - q0;
+			float len = d.dot(d);
+			float v = (len > 0) ? (p3d[p] - q0).dot(d) / len : (float)(r - r0) / (r1 - r0);
+			v = min(max(v, 0.0f), 1.0f);
+
+			Point2f t, g; // Interpolated texel and image point
+			if(u >= v)
+			{
+				t = texels[pb] + u * (texels[pa] - texels[pb]) + v * (texels[pc] - texels[pa]);
+				g = p2d[pb] + u * (p2d[pa] - p2d[pb]) + v * (p2d[pc] - p2d[pa]);
+			}
+			else
+			{
+				t = texels[pb] + v * (texels[pd] - texels[pb]) + u * (texels[pc] - texels[pd]);
+				g = p2d[pb] + v * (p2d[pd] - p2d[pb]) + u * (p2d[pc] - p2d[pd]);
 			}
+
+			if((norm(t - texels[p]) > parameters.adaptive_threshold) || (norm(g - p2d[p]) > parameters.adaptive_threshold))
+				return(false);
 		}
 	}
-
-	outC.close(); // Close file
+	return(true);
 }
 
 
@@ -563,6 +922,7 @@ RectilinearGrid::RectilinearGrid(uint angles, uint start_angle, uint nop_z, doub
 	parameters.start_angle = start_angle;
 	parameters.nop_z = nop_z;
 	parameters.step_x = step_x;
+	parameters.adaptive_threshold = 0;
 	cam_info.height = 0;
 	cam_info.width = 0;
 	cam_info.index = -1;
@@ -590,6 +950,7 @@ void RectilinearGrid::createGrid(CameraCalibrator *camera, double radius)
 	p3d.clear();
 	p2d.clear();
 	NoP.clear();
+	this->radius = radius;
 	
 	if (((camera->getRvec()).empty()) || ((camera->getTvec()).empty()) || (radius <= 0))
 	{
@@ -908,13 +1269,49 @@ void RectilinearGrid::findSeam(CameraCalibrator* camera, vector<Point3f> &seam_p
 
 /**************************************************************************************************************
  *
- * @brief  			Generate triangles from a 3D grid and save them to a file.
+ * @brief  			Generate triangles from a 3D grid and save them to files.
  *
  * @param  in		Camera* camera - pointer to the Camera object
+ * 		   in		int levels - number of levels of detail
  *
  * @return 			-
  *
  * @remarks 		The file with triangles description has been saved to the file arrayX, where X is camera index.
+ * 					Levels of detail L > 0 are saved to the files arrayX_lodL.
+ * 					Columns of the rectilinear grid have different number of points, so the grid can not be
+ * 					decimated. The level L is generated with 2^L times less arcs and points in z axis, the step in
+ * 					z axis is scaled to keep the bowl height.
+ *
+ **************************************************************************************************************/
+void RectilinearGrid::saveGrid(CameraCalibrator* camera, int levels)
+{
+	char file_name[50];
+	gridFileName(file_name, camera->index, 0);
+	writeGrid(camera, file_name);
+
+	for(int level = 1; level < levels; level++)
+	{
+		uint nop_z = max(parameters.nop_z >> level, 1u);
+		RectilinearGrid lod(max(parameters.angles >> level, 1u), parameters.start_angle >> level,
+							nop_z, parameters.step_x * parameters.nop_z / nop_z);
+		lod.createGrid(camera, radius);
+
+		gridFileName(file_name, camera->index, level);
+		lod.writeGrid(camera, file_name);
+	}
+}
+
+/**************************************************************************************************************
+ *
+ * @brief  			Generate triangles from a 3D grid and save them to a file.
+ *
+ * @param  in		Camera* camera - pointer to the Camera object
+ * 		   in		char* file_name - output file
+ *
+ * @return 			-
+ *
+ * @remarks 		The file is written in the binary mesh format (see common/mesh_file.h). Grid points are stored
+ * 					once and the triangles are described by indices.
  * 					The grid has been rotated according to the camera index value:
  * 						index = 0 - without rotation;
  * 						index = 1 - 90 degree clockwise rotation;
@@ -922,17 +1319,13 @@ void RectilinearGrid::findSeam(CameraCalibrator* camera, vector<Point3f> &seam_p
  * 						index = 3 - 270 degree clockwise rotation;
  *
  **************************************************************************************************************/
-void RectilinearGrid::saveGrid(CameraCalibrator* camera)
+void RectilinearGrid::writeGrid(CameraCalibrator* camera, const char* file_name)
 {
 	float height = camera->xmap.rows;	// 2D grid height (texels)
 	float width = camera->xmap.cols;	// 2D grid width (texels)
 
-	// Generate output array
-	char file_name[50];
-	sprintf(file_name, "./array%d", camera->index + 1);
-
-    ofstream outC; // Output file
-    outC.open(file_name, std::ofstream::out | std::ofstream::trunc); // Any contents that existed in the file before it is open are discarded.
+    MeshWriter mesh; // Output grid
+    vector<int> vertex_index(p2d.size(), -1); // Index of grid point in the output grid (-1 if not added yet)
 
     int offset = NoP[0]; // Set offset of point in 3D grid (vertices)
 
@@ -965,20 +1358,10 @@ void RectilinearGrid::saveGrid(CameraCalibrator* camera)
 				{
 					if ((round(p2d[p1].x) < camera->xmap.cols) && (round(p2d[p1].y) < camera->ymap.rows) && (p2d[p1].x >= 0) && (p2d[p1].y >= 0))
 					{
-						// Recalculate point for fisheye image
-						Point2f p4_new = Point2f(camera->xmap.at<float>(p2d[p4]) / width, camera->ymap.at<float>(p2d[p4]) / height);
-						Point2f p1_new = Point2f(camera->xmap.at<float>(p2d[p1]) / width, camera->ymap.at<float>(p2d[p1]) / height);
-						Point2f p2_new = Point2f(camera->xmap.at<float>(p2d[p2]) / width, camera->ymap.at<float>(p2d[p2]) / height);
-
-						// Rotate grid point according to the template
-						Point3f vertex4 = rotatePoint(camera->index, p3d[p4]);
-						Point3f vertex1 = rotatePoint(camera->index, p3d[p1]);
-						Point3f vertex2 = rotatePoint(camera->index, p3d[p2]);
-
-						// Save triangle points to the output file
-						outC << vertex4.x << " " << vertex4.y << " " << vertex4.z << " " << p4_new.x << " " << p4_new.y << endl;
-						outC << vertex1.x << " " << vertex1.y << " " << vertex1.z << " " << p1_new.x << " " << p1_new.y << endl;
-						outC << vertex2.x << " " << vertex2.y << " " << vertex2.z << " " << p2_new.x << " " << p2_new.y << endl;
+						// Add triangle to the output grid
+						mesh.addTriangle(addGridVertex(camera, p3d, p2d, p4, mesh, vertex_index),
+						                 addGridVertex(camera, p3d, p2d, p1, mesh, vertex_index),
+						                 addGridVertex(camera, p3d, p2d, p2, mesh, vertex_index));
 					}
 
 					/*******************************************************************************************************
@@ -989,20 +1372,10 @@ void RectilinearGrid::saveGrid(CameraCalibrator* camera)
 				     *******************************************************************************************************/
 					if((p3 < offset) && (round(p2d[p3].x) < width) && (round(p2d[p3].y) < height) && (p2d[p3].x >= 0) && (p2d[p3].y >= 0))
 					{
-						// Recalculate point for fisheye image
-						Point2f p4_new = Point2f(camera->xmap.at<float>(p2d[p4]) / width, camera->ymap.at<float>(p2d[p4]) / height);
-						Point2f p2_new = Point2f(camera->xmap.at<float>(p2d[p2]) / width, camera->ymap.at<float>(p2d[p2]) / height);
-						Point2f p3_new = Point2f(camera->xmap.at<float>(p2d[p3]) / width, camera->ymap.at<float>(p2d[p3]) / height);
-
-						// Rotate grid point according to the template
-						Point3f vertex4 = rotatePoint(camera->index, p3d[p4]);
-						Point3f vertex2 = rotatePoint(camera->index, p3d[p2]);
-						Point3f vertex3 = rotatePoint(camera->index, p3d[p3]);
-
-						// Save triangle points to the output file
-						outC << vertex4.x << " " << vertex4.y << " " << vertex4.z << " " << p4_new.x << " " << p4_new.y << endl;
-						outC << vertex2.x << " " << vertex2.y << " " << vertex2.z << " " << p2_new.x << " " << p2_new.y << endl;
-						outC << vertex3.x << " " << vertex3.y << " " << vertex3.z << " " << p3_new.x << " " << p3_new.y << endl;
+						// Add triangle to the output grid
+						mesh.addTriangle(addGridVertex(camera, p3d, p2d, p4, mesh, vertex_index),
+						                 addGridVertex(camera, p3d, p2d, p2, mesh, vertex_index),
+						                 addGridVertex(camera, p3d, p2d, p3, mesh, vertex_index));
 					 }
 				}
 			}
@@ -1038,20 +1411,10 @@ void RectilinearGrid::saveGrid(CameraCalibrator* camera)
 				{
 					if ((round(p2d[p4].x) < width) && (round(p2d[p4].y) < height) && (p2d[p4].x >= 0) && (p2d[p4].y >= 0))
 					{
-						// Recalculate point for fisheye image
-						Point2f p4_new = Point2f(camera->xmap.at<float>(p2d[p4]) / width, camera->ymap.at<float>(p2d[p4]) / height);
-						Point2f p1_new = Point2f(camera->xmap.at<float>(p2d[p1]) / width, camera->ymap.at<float>(p2d[p1]) / height);
-						Point2f p3_new = Point2f(camera->xmap.at<float>(p2d[p3]) / width, camera->ymap.at<float>(p2d[p3]) / height);
-
-						// Rotate grid point according to the template
-						Point3f vertex4 = rotatePoint(camera->index, p3d[p4]);
-						Point3f vertex1 = rotatePoint(camera->index, p3d[p1]);
-						Point3f vertex3 = rotatePoint(camera->index, p3d[p3]);
-
-						// Save triangle points to the output file
-						outC << vertex4.x << " " << vertex4.y << " " << vertex4.z << " " << p4_new.x << " " << p4_new.y << endl;
-						outC << vertex1.x << " " << vertex1.y << " " << vertex1.z << " " << p1_new.x << " " << p1_new.y << endl;
-						outC << vertex3.x << " " << vertex3.y << " " << vertex3.z << " " << p3_new.x << " " << p3_new.y << endl;
+						// Add triangle to the output grid
+						mesh.addTriangle(addGridVertex(camera, p3d, p2d, p4, mesh, vertex_index),
+						                 addGridVertex(camera, p3d, p2d, p1, mesh, vertex_index),
+						                 addGridVertex(camera, p3d, p2d, p3, mesh, vertex_index));
 					}
 
 					/*******************************************************************************************************
@@ -1062,27 +1425,22 @@ void RectilinearGrid::saveGrid(CameraCalibrator* camera)
 				     *******************************************************************************************************/
 					if((p2 < offset + NoP[xx]) && (round(p2d[p2].x) < width) && (round(p2d[p2].y) < height) && (p2d[p2].x >= 0) && (p2d[p2].y >= 0))
 					{
-						// Recalculate point for fisheye image
-						Point2f p1_new = Point2f(camera->xmap.at<float>(p2d[p1]) / width, camera->ymap.at<float>(p2d[p1]) / height);
-						Point2f p2_new = Point2f(camera->xmap.at<float>(p2d[p2]) / width, camera->ymap.at<float>(p2d[p2]) / height);
-						Point2f p3_new = Point2f(camera->xmap.at<float>(p2d[p3]) / width, camera->ymap.at<float>(p2d[p3]) / height);
-
-						// Rotate grid point according to the template
-						Point3f vertex1 = rotatePoint(camera->index, p3d[p1]);
-						Point3f vertex2 = rotatePoint(camera->index, p3d[p2]);
-						Point3f vertex3 = rotatePoint(camera->index, p3d[p3]);
-
-						// Save triangle points to the output file
-						outC << vertex1.x << " " << vertex1.y << " " << vertex1.z << " " << p1_new.x << " " << p1_new.y << endl;
-						outC << vertex2.x << " " << vertex2.y << " " << vertex2.z << " " << p2_new.x << " " << p2_new.y << endl;
-						outC << vertex3.x << " " << vertex3.y << " " << vertex3.z << " " << p3_new.x << " " << p3_new.y << endl;
+						// Add triangle to the output grid
+						mesh.addTriangle(addGridVertex(camera, p3d, p2d, p1, mesh, vertex_index),
+						                 addGridVertex(camera, p3d, p2d, p2, mesh, vertex_index),
+						                 addGridVertex(camera, p3d, p2d, p3, mesh, vertex_index));
 					 }
 				}
 			}
 		}
 		offset += NoP[xx]; // Update offset
 	}
-	outC.close(); // Close file
+	// Reorder triangles and vertices for the post-transform cache and the vertex fetch
+	float acmr = mesh.getAcmr();
+	mesh.optimize();
+
+	printGridStat(file_name, mesh, acmr);
+	mesh.save(file_name); // Save grid to the file
 }
 
 
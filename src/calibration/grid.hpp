@@ -37,6 +37,7 @@
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include "cameracalibrator.h"
+#include "common/mesh_file.h"
 
 using namespace cv;
 using namespace std;
@@ -53,6 +54,9 @@ struct GridParam {		/* Parameters of grid */
 	uint nop_z;			/* Number of points in z axis */
 	double step_x;		/* Step in x axis which is used to define grid points in z axis.
 	 	 	 	 	 	 * Step in z axis: step_z[i] = (i * step_x)^2, i = 1, 2, ... - number of point */
+	double adaptive_threshold;	/* Max deviation (pixels) of the linear interpolation inside merged grid cells.
+								 * The deviation is measured in the fisheye and undistorted images, not on the screen.
+								 * 0 - the grid is saved with uniform cells */
 };
 
 struct CameraInfo {		
@@ -85,37 +89,17 @@ extern Point3f rotatePoint(int index, Point3f point);
 /*******************************************************************************************
  * Classes
  *******************************************************************************************/
-/* CurvilinearGrid class - the grid is denser at the middle of bowl bottom and more sparse at the bowl bottom edge. */
-class CurvilinearGrid {
+/* Grid class - common interface of the bowl grids. Each grid saves a pyramid of meshes (levels of detail),
+ * level 0 is the full grid and each next level is about two times sparser in both directions. */
+class Grid {
 	public:
-	
-	
-	
-	
-	void setAngles(uint val) {parameters.angles = val; }
-	void setStartAngle(uint val) {parameters.start_angle = val; }
-	void setNopZ(uint val) {parameters.nop_z = val; }
-	void setStepX(double val) {parameters.step_x = val; }
-	
-	
-		/**************************************************************************************************************
-		 *
-		 * @brief  			CurvilinearGrid class constructor.
-		 *
-		 * @param  in 		uint angles 	  -	every quadrant of circle will be divided into this number of arcs.
-		 * 					uint start_angle  -	It is not necessary to define grid through a whole semi-circle.
-		 * 										The start_angle sets a circular sector for which the grid will be generated.
-		 * 					uint nop_z 		  -	number of points in z axis.
-		 * 					double step_x	  -	grid step in polar coordinate system. The value is also used to define
-		 * 										grid points in z axis.
-		 * 										Step in z axis: step_z[i] = (i * step_x)^2, i = 1, 2, ... - number of point.
-		 *
-		 * @return 			The function create the CurvilinearGrid object.
-		 *
-		 * @remarks 		The function sets main property of new CurvilinearGrid object.
-		 *
-		 **************************************************************************************************************/
-		CurvilinearGrid(uint angles, uint start_angle, uint nop_z, double step_x);
+		virtual ~Grid() {}
+
+		void setAngles(uint val) {parameters.angles = val; }
+		void setStartAngle(uint val) {parameters.start_angle = val; }
+		void setNopZ(uint val) {parameters.nop_z = val; }
+		void setStepX(double val) {parameters.step_x = val; }
+		void setAdaptiveThreshold(double val) {parameters.adaptive_threshold = val; }
 
 		/**************************************************************************************************************
 		 *
@@ -142,23 +126,31 @@ class CurvilinearGrid {
 		 *
 		 * @return 			-
 		 *
-		 * @remarks 		The function defines 3D grid, generates triangles from it and saves the triangles into file.
+		 **************************************************************************************************************/
+		virtual void createGrid(CameraCalibrator *camera, double radius) = 0;
+
+		/**************************************************************************************************************
+		 *
+		 * @brief  			Get 2D grid points for preview.
+		 *
+		 * @param  out		float** points - output array of points (x, y, z), it is allocated by the function
+		 *
+		 * @return 			Number of array elements
 		 *
 		 **************************************************************************************************************/
-        void createGrid(CameraCalibrator *camera, double radius);
+		virtual int getGrid(float** points) = 0;
 
-	
-		int getGrid(float** points);
-	
-			/**************************************************************************************************************
+		/**************************************************************************************************************
 		 *
-		 * @brief  			Generate triangles from a 3D grid and save them to a file.
+		 * @brief  			Generate triangles from a 3D grid and save them to files.
 		 *
 		 * @param  in		Camera* camera - pointer to the Camera object
+		 * 		   in		int levels - number of levels of detail
 		 *
 		 * @return 			-
 		 *
 		 * @remarks 		The file with triangles description has been saved to the file arrayX, where X is camera index.
+		 * 					Levels of detail L > 0 are saved to the files arrayX_lodL.
 		 * 					The grid has been rotated according to the camera index value:
 		 * 						index = 0 - without rotation;
 		 * 						index = 1 - 90 degree clockwise rotation;
@@ -166,15 +158,122 @@ class CurvilinearGrid {
 		 * 						index = 3 - 270 degree clockwise rotation;
 		 *
 		 **************************************************************************************************************/
-    void saveGrid(CameraCalibrator* camera);
-	private:
+		virtual void saveGrid(CameraCalibrator* camera, int levels = 1) = 0;
+
+	protected:
 		CameraInfo cam_info;
-	
-		int NoP;				// Number of grid points for one grid sector (angle)
 		vector<Point3f> p3d;	// 3D grid points (template points)
 		vector<Point2f> p2d;	// 2D grid points (image points)
 		GridParam parameters;	// Parameters of grid
 		vector<Point3f> seam;	// Seam points
+};
+
+/* CurvilinearGrid class - the grid is denser at the middle of bowl bottom and more sparse at the bowl bottom edge. */
+class CurvilinearGrid : public Grid {
+	public:
+		/**************************************************************************************************************
+		 *
+		 * @brief  			CurvilinearGrid class constructor.
+		 *
+		 * @param  in 		uint angles 	  -	every quadrant of circle will be divided into this number of arcs.
+		 * 					uint start_angle  -	It is not necessary to define grid through a whole semi-circle.
+		 * 										The start_angle sets a circular sector for which the grid will be generated.
+		 * 					uint nop_z 		  -	number of points in z axis.
+		 * 					double step_x	  -	grid step in polar coordinate system. The value is also used to define
+		 * 										grid points in z axis.
+		 * 										Step in z axis: step_z[i] = (i * step_x)^2, i = 1, 2, ... - number of point.
+		 *
+		 * @return 			The function create the CurvilinearGrid object.
+		 *
+		 * @remarks 		The function sets main property of new CurvilinearGrid object.
+		 *
+		 **************************************************************************************************************/
+		CurvilinearGrid(uint angles, uint start_angle, uint nop_z, double step_x);
+
+		/**************************************************************************************************************
+		 *
+		 * @brief  			Generate 3D grid of texels/vertices for the input Camera object.
+		 *
+		 * @param  in		Camera* camera - pointer to the Camera object
+		 * 		   in		double radius - radius of base circle. The radius must be defined relative to template width.
+		 * 		   			The template width (in pixels) is considered as 1.0.
+		 *
+		 * @return 			-
+		 *
+		 * @remarks 		The function defines 3D grid, generates triangles from it and saves the triangles into file.
+		 *
+		 **************************************************************************************************************/
+        void createGrid(CameraCalibrator *camera, double radius);
+
+	
+		int getGrid(float** points);
+
+		void saveGrid(CameraCalibrator* camera, int levels = 1);
+
+		/**************************************************************************************************************
+		 *
+		 * @brief  			Get the first row of the flat bowl bottom.
+		 *
+		 * @param  in		Camera* camera - pointer to the Camera object
+		 * 		   in		double radius - radius of base circle
+		 * 		   in		double step_x - grid step in polar coordinate system
+		 *
+		 * @return 			Index of the first row, the radius of the row is (row * step_x)
+		 *
+		 * @remarks 		The middle part of the bottom is hidden by the car, so it is not a part of the grid.
+		 *
+		 **************************************************************************************************************/
+		static int getFirstRow(CameraCalibrator* camera, double radius, double step_x);
+	private:
+		int NoP;				// Number of grid points for one grid sector (angle)
+
+		/**************************************************************************************************************
+		 *
+		 * @brief  			Generate triangles of the grid cells and save them to a file.
+		 *
+		 * @param  in		Camera* camera - pointer to the Camera object
+		 * 		   in		vector<int> &rows - rows which bound the grid cells
+		 * 		   in		vector<int> &sectors - first sector of each group of merged sectors (and the end sector)
+		 * 		   in		char* file_name - output file
+		 *
+		 * @return 			-
+		 *
+		 **************************************************************************************************************/
+		void writeGrid(CameraCalibrator* camera, const vector<int> &rows, const vector<int> &sectors, const char* file_name);
+
+		/**************************************************************************************************************
+		 *
+		 * @brief  			Select cells of the adaptive grid.
+		 *
+		 * @param  in		Camera* camera - pointer to the Camera object
+		 * 		   out		vector<int> &rows - rows which bound the grid cells
+		 * 		   out		vector<int> &sectors - first sector of each group of merged sectors (and the end sector)
+		 *
+		 * @return 			-
+		 *
+		 * @remarks 		Rows and sectors are merged while the fisheye texels and the image points of the grid
+		 * 					points inside the merged cells deviate from the linear interpolation of the cell corners
+		 * 					by less than adaptive_threshold pixels. The error is measured in image space: in pixels of
+		 * 					the fisheye texture and of the undistorted image the grid is projected to. The screen error
+		 * 					of the rendered view depends on the view and is not checked. The same rows and sectors are
+		 * 					used for the whole grid, so the merged grid has no T-junctions.
+		 *
+		 **************************************************************************************************************/
+		void adaptGrid(CameraCalibrator* camera, vector<int> &rows, vector<int> &sectors);
+
+		/**************************************************************************************************************
+		 *
+		 * @brief  			Check if grid cell can be rendered as two triangles.
+		 *
+		 * @param  in		int a, b - first and last sector of the cell
+		 * 		   in		int r0, r1 - first and last row of the cell
+		 * 		   in		vector<Point2f> &texels - fisheye texels of grid points
+		 * 		   in		vector<uchar> &valid - grid point validity (it lays on the camera frame)
+		 *
+		 * @return 			true if the cell can be merged
+		 *
+		 **************************************************************************************************************/
+		bool isLinearCell(int a, int b, int r0, int r1, const vector<Point2f> &texels, const vector<uchar> &valid);
 
 		/**************************************************************************************************************
 		 *
@@ -226,15 +325,8 @@ class CurvilinearGrid {
  *  To fill circle base with vertices grid the uneven grid is used. The circle is divided into arcs of same values
  *  and the intersection points of arcs define X and Y coordinates of grid corners. In this case the grid at the
  *  edge of circle is denser than at the center. */
-class RectilinearGrid {
+class RectilinearGrid : public Grid {
 	public:
-
-		void setAngles(uint val) {parameters.angles = val; }
-		void setStartAngle(uint val) {parameters.start_angle = val; }
-		void setNopZ(uint val) {parameters.nop_z = val; }
-		void setStepX(double val) {parameters.step_x = val; }
-	
-	
 		/**************************************************************************************************************
 		 *
 		 * @brief  			RectilinearGrid class constructor.
@@ -256,21 +348,6 @@ class RectilinearGrid {
 		 **************************************************************************************************************/
 		RectilinearGrid(uint angles, uint start_angle, uint nop_z, double step_x);
 
-		/**************************************************************************************************************
-		 *
-		 * @brief  			Copy points from seam property into the S vector.
-		 *
-		 * @param  out		vector<Point3f> &S - pointer to the output vector of seam points
-		 *
-		 * @return 			-
-		 *
-		 * @remarks 		The function copies points from seam property into the input vector S. If the seam_points
-		 * 					vector size is not equal 8, then there was a problem with points searching and result of
-		 * 					function is inapplicable.
-		 *
-		 **************************************************************************************************************/
-		void getSeamPoints(vector<Point3f> &S) {S.clear(); for(uint i = 0; i < seam.size(); i ++) S.push_back(seam[i]);}
-
 		/**************************************************************************************************************
 		 *
 		 * @brief  			Generate 3D grid of texels/vertices for the input Camera object.
@@ -289,34 +366,25 @@ class RectilinearGrid {
 	
 	int getGrid(float** points);
 	
+
+		void saveGrid(CameraCalibrator* camera, int levels = 1);
+	
 	
-			/**************************************************************************************************************
+	private:
+		vector<int> NoP;	// Number of points in grid column
+		double radius = 0;	// Radius of base circle
+
+		/**************************************************************************************************************
 		 *
 		 * @brief  			Generate triangles from a 3D grid and save them to a file.
 		 *
 		 * @param  in		Camera* camera - pointer to the Camera object
+		 * 		   in		char* file_name - output file
 		 *
 		 * @return 			-
 		 *
-		 * @remarks 		The file with triangles description has been saved to the file arrayX, where X is camera index.
-		 * 					The grid has been rotated according to the camera index value:
-		 * 						index = 0 - without rotation;
-		 * 						index = 1 - 90 degree clockwise rotation;
-		 * 						index = 2 - 180 degree clockwise rotation;
-		 * 						index = 3 - 270 degree clockwise rotation;
-		 *
 		 **************************************************************************************************************/
-    void saveGrid(CameraCalibrator* camera);
-	
-	
-	private:
-		CameraInfo cam_info;
-	
-		vector<int> NoP;	// Number of points in grid column
-		vector<Point3f> p3d;	// 3D grid points (template points)
-		vector<Point2f> p2d;	// 2D grid points (image points)
-		GridParam parameters; // Parameters of grid
-		vector<Point3f> seam; // Seam points
+		void writeGrid(CameraCalibrator* camera, const char* file_name);
 
 		/**************************************************************************************************************
 		 *
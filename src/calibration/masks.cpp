@@ -42,12 +42,16 @@
  * 					- 7th point is located on flat circle base (z = 0). It is the rightmost point of grid which lies on base circle edge;
  *					- 8th point is located on flat circle base (z = 0). It is the rightmost point with minimum value of y coordinate.
  *			in		float smothing - smothing angle value
+ *			in		string &path - output directory
+ *			in		vector<bool> &update - masks which have to be recalculated (empty vector - all masks)
  *
  * @return 			-
  *
  * @remarks 		The function calculates masks for 3D BEV. The masks will be used for texture mapping.
  * 					They must be defined for original captured image from camera (with fisheye distortion)
  * 					because the same transformation will be applied on camera frames and masks.
+ * 					Seams are calculated for all cameras, but only the masks marked in update are regenerated.
+ * 					The mask of a camera depends on the grids of the camera and of its two neighbours.
  *
  * 					The procedure of mask calculation:
  *					-	Calculate seams for every two adjacent grids. The seam of two adjacent grids is a line y = a * x + b.
@@ -63,7 +67,8 @@
 void Masks::createMasks(vector<CameraCalibrator*> &cameras,
                         vector< vector<Point3f> > &seam_points,
                         float smothing,
-                        const std::string &path)
+                        const std::string &path,
+                        const vector<bool> &update)
 {
 	for(uint i = 0; i < cameras.size(); i++)
 		if(seam_points[i].size() < 8)
@@ -75,6 +80,9 @@ void Masks::createMasks(vector<CameraCalibrator*> &cameras,
 
 
 	// Get grids intersection points
+	seaml.clear();
+	seamr.clear();
+	masks.resize(cameras.size());
 	for(uint i = 0; i < cameras.size(); i++)
 	{
 		Seam seam_left, seam_right;
@@ -99,6 +107,9 @@ void Masks::createMasks(vector<CameraCalibrator*> &cameras,
 		seamr[i].p2.y = sqrt(pow(radius, 2) - pow(seamr[i].p2.x, 2));
 		double cos_r = seamr[i].p2.x / radius;
 
+		if(!update.empty() && !update[i] && !masks[i].empty()) // The mask is up to date
+			continue;
+
 		// Left horizontal seam
 		for(double xx = seaml[i].p1.x; xx >= seaml[i].p2.x; xx-=SEAM_STEP)
 			seam3d.push_back(Point3f(xx, xx * seaml[i].line.alpha + seaml[i].line.beta, 0.0));
@@ -155,7 +166,7 @@ void Masks::createMasks(vector<CameraCalibrator*> &cameras,
 
 		// Create masks which are limited to seams.
 		Mat mask(cameras[i]->xmap.rows, cameras[i]->xmap.cols, CV_8UC1, Scalar(0));
-		masks.push_back(mask);
+		masks[i] = mask;
 		fillConvexPoly(masks[i], seam, Scalar(255)); // Draws a filled convex polygon using all seam points
 
 		// Define left edge of smoothing
@@ -195,45 +206,56 @@ void Masks::createMasks(vector<CameraCalibrator*> &cameras,
  * @brief  			Split vertices/texels grid into grid which will be rendered with blending and grid which will
  * 					be rendered without blending for all cameras
  *
- * @param  			-
+ * @param  in		string &path - directory of the grid files
+ * 		   in		int levels - number of levels of detail
+ * 		   in		vector<bool> &update - cameras which grids have to be split (empty vector - all cameras)
  *
  * @return 			Functions returns 0 if all grid files "arrayX" file (X = 1,2,3,4 is camera number) are existed.
  * 					If one of the files not found the function returns -1.
  *
  * @remarks 		The function reads grid of texels/vertices from the "arrayX" file (X = 1,2,3,4 is camera number)
  * 					and pruduces two output grids: first for overlapping regions ("arrayX1") and second for
- * 					non-overlapping regions ("arrayX2").
+ * 					non-overlapping regions ("arrayX2"). All grids are in the binary mesh format (see common/mesh_file.h),
+ * 					vertices of the output grids are quantized if the quantization error is small.
+ * 					Levels of detail L > 0 are read from "arrayX_lodL" and split into "arrayX1_lodL" and "arrayX2_lodL".
  * 					Camera blending mask is used to split grid into two parts. The mask value has been checked
  * 					for each texels of a rendered triangle. If at least one of texels is masked with value less than
  * 					255 then the triangle is written to overlap grid. Otherwise the triangle is written to non-overlap
  * 					grid.
  *
  **************************************************************************************************************/
-int Masks::splitGrids(const string &path)
+int Masks::splitGrids(const string &path, int levels, const vector<bool> &update)
 {
-	float vx[3], vy[3], vz[3], tx[3], ty[3];
-
-	for(uint i = 0; i < masks.size(); i++)
+	for(uint n = 0; n < masks.size() * max(levels, 1); n++)
 	{
-		char file_name[50], file_name_b[50], file_name_wb[50];
-        sprintf(file_name, (path + "./array%d").c_str(), i + 1);		// Name of input grid
-        sprintf(file_name_b, (path + "./array%d1").c_str(), i + 1); 	// Name of overlap grid
-        sprintf(file_name_wb, (path + "./array%d2").c_str(), i + 1); // Name of non-overlap grid
+		uint i = n % masks.size();		// Camera index
+		int level = n / masks.size();	// Level of detail
+		if(!update.empty() && !update[i]) // The grid and the mask of the camera have not been changed
+			continue;
+
+		string lod = (level == 0) ? "" : "_lod" + to_string(level);
+
+		char file_name[256], file_name_b[256], file_name_wb[256];
+        sprintf(file_name, (path + "./array%d" + lod).c_str(), i + 1);		// Name of input grid
+        sprintf(file_name_b, (path + "./array%d1" + lod).c_str(), i + 1); 	// Name of overlap grid
+        sprintf(file_name_wb, (path + "./array%d2" + lod).c_str(), i + 1); // Name of non-overlap grid
 
-		ifstream ifs_ref(file_name);
-		if(ifs_ref) // // The file exists, and is open for input
+		MeshFile grid;
+		if(grid.open(file_name) == 0) // The file exists, and is open for input
 		{
-			ofstream outC_b, outC_wb; // Output file
-			outC_b.open(file_name_b, std::ofstream::out | std::ofstream::trunc); // Any contents that existed in the file before it is open are discarded.
-			outC_wb.open(file_name_wb, std::ofstream::out | std::ofstream::trunc); // Any contents that existed in the file before it is open are discarded.
+			MeshWriter grid_b, grid_wb; // Output grids
+			vector<int> remap_b, remap_wb; // Indices of input grid vertices in the output grids
 
-			while (ifs_ref >> vx[0] >> vy[0] >> vz[0] >> tx[0] >> ty[0] >> vx[1] >> vy[1] >> vz[1] >> tx[1] >> ty[1] >> vx[2] >> vy[2] >> vz[2] >> tx[2] >> ty[2] ) // Read triangle
+			for(int t = 0; t < grid.getTriangleNum(); t++) // Read triangle
 			{
 				uint pixels_sum = 0; // Sum of pixels of triangle vertexes
 				for(int j = 0; j < 3; j ++) // For each vertexes of the triangle
 				{
-					Point idx1 = Point((int)(tx[j] * masks[i].cols) - 40, (int)(ty[j] * masks[i].rows) - 40);
-					Point idx2 = Point((int)(tx[j] * masks[i].cols) + 40, (int)(ty[j] * masks[i].rows) + 40);
+					const float *v = grid.getVertex(grid.getTriangleVertex(t, j));
+					float tx = v[3];
+					float ty = v[4];
+					Point idx1 = Point((int)(tx * masks[i].cols) - 40, (int)(ty * masks[i].rows) - 40);
+					Point idx2 = Point((int)(tx * masks[i].cols) + 40, (int)(ty * masks[i].rows) + 40);
 										
 					if ((idx1.x < masks[i].cols) && (idx1.y < masks[i].rows) && (idx1.x > 0) && (idx1.y > 0))
 					{
@@ -254,19 +276,17 @@ int Masks::splitGrids(const string &path)
 
 				if(pixels_sum == 4 * 765) // If all 3 vertexes of triangles are white (3 * 255 = 765) -> non-overlap region
 				{
-					outC_wb << vx[0] << " " << vy[0] << " " << vz[0] << " " << tx[0] << " " << ty[0] << endl;
-					outC_wb << vx[1] << " " << vy[1] << " " << vz[1] << " " << tx[1] << " " << ty[1] << endl;
-					outC_wb << vx[2] << " " << vy[2] << " " << vz[2] << " " << tx[2] << " " << ty[2] << endl;
+					grid_wb.addTriangle(grid, t, remap_wb);
 				}
 				else if(pixels_sum != 0) // Otherwise -> overlap region
 				{
-					outC_b << vx[0] << " " << vy[0] << " " << vz[0] << " " << tx[0] << " " << ty[0] << endl;
-					outC_b << vx[1] << " " << vy[1] << " " << vz[1] << " " << tx[1] << " " << ty[1] << endl;
-					outC_b << vx[2] << " " << vy[2] << " " << vz[2] << " " << tx[2] << " " << ty[2] << endl;
+					grid_b.addTriangle(grid, t, remap_b);
 				}
 			}
-			outC_b.close(); // Close file
-			outC_wb.close(); // Close file
+			grid_b.optimize(); // Reorder split grids for the post-transform cache
+			grid_wb.optimize();
+			grid_b.save(file_name_b, true); // Save grids with quantized vertices, the render draws them directly
+			grid_wb.save(file_name_wb, true);
 		}
 		else
 		{
@@ -36,6 +36,7 @@
 
 #include "cameracalibrator.h"
 #include "common/lines.hpp"
+#include "common/mesh_file.h"
 
 using namespace cv;
 using namespace std;
@@ -94,12 +95,16 @@ class Masks {
 		 * 					- 7th point is located on flat circle base (z = 0). It is the rightmost point of grid which lies on base circle edge;
 		 *					- 8th point is located on flat circle base (z = 0). It is the rightmost point with minimum value of y coordinate.
 		 *			in		float smothing - smothing angle value
+		 *			in		string &path - output directory
+		 *			in		vector<bool> &update - masks which have to be recalculated (empty vector - all masks)
 		 *
 		 * @return 			-
 		 *
 		 * @remarks 		The function calculates masks for 3D BEV. The masks will be used for texture mapping.
 		 * 					They must be defined for original captured image from camera (with fisheye distortion)
 		 * 					because the same transformation will be applied on camera frames and masks.
+		 * 					Seams are calculated for all cameras, but only the masks marked in update are regenerated.
+		 * 					The mask of a camera depends on the grids of the camera and of its two neighbours.
 		 *
 		 * 					The procedure of mask calculation:
 		 *					-	Calculate seams for every two adjacent grids. The seam of two adjacent grids is a line y = a * x + b.
@@ -114,14 +119,17 @@ class Masks {
 		 **************************************************************************************************************/
         void createMasks(vector<CameraCalibrator*> &cameras,
                          vector< vector<Point3f> > &seam_points,
-                         float smothing, const string &path);
+                         float smothing, const string &path,
+                         const vector<bool> &update = vector<bool>());
 
 		/**************************************************************************************************************
 		 *
 		 * @brief  			Split vertices/texels grid into grid which will be rendered with blending and grid which will
 		 * 					be rendered without blending for all cameras
 		 *
-		 * @param  			-
+		 * @param  in		string &path - directory of the grid files
+		 * 		   in		int levels - number of levels of detail
+		 * 		   in		vector<bool> &update - cameras which grids have to be split (empty vector - all cameras)
 		 *
 		 * @return 			Functions returns 0 if all grid files "arrayX" file (X = 1,2,3,4 is camera number) are existed.
 		 * 					If one of the files not found the function returns -1.
@@ -129,13 +137,14 @@ class Masks {
 		 * @remarks 		The function reads grid of texels/vertices from the "arrayX" file (X = 1,2,3,4 is camera number)
 		 * 					and produces two output grids: first for overlapping regions ("arrayX1") and second for
 		 * 					non-overlapping regions ("arrayX2").
+		 * 					Levels of detail L > 0 are read from "arrayX_lodL" and split into "arrayX1_lodL" and "arrayX2_lodL".
 		 * 					Camera blending mask is used to split grid into two parts. The mask value has been checked
 		 * 					for each texels of a rendered triangle. If at least one of texels is masked with value less than
 		 * 					255 then the triangle is written to overlap grid. Otherwise the triangle is written to non-overlap
 		 * 					grid.
 		 *
 		 **************************************************************************************************************/
-        int splitGrids(const string &path);
+        int splitGrids(const string &path, int levels = 1, const vector<bool> &update = vector<bool>());
 
 	private:		
 		vector<Mat> masks;	// Vector of masks
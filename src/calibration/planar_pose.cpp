@@ -0,0 +1,536 @@
+/*
+*
+* Copyright © 2017 NXP
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice (including the next
+* paragraph) shall be included in all copies or substantial portions of the
+* Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include <cfloat>
+#include <limits>
+
+#include "planar_pose.hpp"
+
+/**************************************************************************************************************
+ *
+ * @brief  			Rotation which moves vector to Z axis
+ *
+ * @param  	in		Vec3d a - input vector
+ *
+ * @return 			Functions returns rotation matrix Ra such that Ra * a is parallel to Z axis.
+ *
+ * @remarks 		-
+ *
+ **************************************************************************************************************/
+static Matx33d RotateVecToZAxis(Vec3d a)
+{
+	Matx33d Ra;
+	a = normalize(a);
+
+	double c = a[2];
+	if (fabs(1.0 + c) < numeric_limits<float>::epsilon())
+	{
+		Ra = Matx33d(1, 0, 0, 0, 1, 0, 0, 0, -1);
+		return (Ra);
+	}
+
+	double d = 1.0 / (1.0 + c);
+	double ax2 = a[0] * a[0];
+	double ay2 = a[1] * a[1];
+	double axay = a[0] * a[1];
+
+	Ra = Matx33d(1.0 - ax2 * d,	-axay * d,		-a[0],
+				 -axay * d,		1.0 - ay2 * d,	-a[1],
+				 a[0],			a[1],			1.0 - (ax2 + ay2) * d);
+	return (Ra);
+}
+
+
+/**************************************************************************************************************
+ *
+ * @brief  			IPPE rotations
+ *
+ * @param  	in		Matx22d J - Jacobian of the homography at the object center
+ * 			in		Vec2d v - normalized image point of the object center
+ * 			out		Matx33d &R1 - first rotation
+ * 			out		Matx33d &R2 - second rotation
+ *
+ * @return 			Functions returns 0 if rotations are found. Otherwise -1 is returned.
+ *
+ * @remarks 		The plane pose is ambiguous at the object center: both rotations give the same Jacobian
+ * 					and differ by the sign of the plane normal component along the viewing ray.
+ *
+ **************************************************************************************************************/
+static int IppeRotations(const Matx22d &J, const Vec2d &v, Matx33d &R1, Matx33d &R2)
+{
+	// Rotation which moves the viewing ray of the object center to the Z axis
+	Matx33d Rv = RotateVecToZAxis(Vec3d(v[0], v[1], 1.0)).t();
+
+	// Jacobian in the rotated frame
+	Matx22d B(Rv(0, 0) - v[0] * Rv(2, 0), Rv(0, 1) - v[0] * Rv(2, 1),
+			  Rv(1, 0) - v[1] * Rv(2, 0), Rv(1, 1) - v[1] * Rv(2, 1));
+	double det = B(0, 0) * B(1, 1) - B(0, 1) * B(1, 0);
+	if (fabs(det) < DBL_EPSILON)
+		return (-1);
+	Matx22d A = B.inv() * J;
+
+	// The largest singular value of A
+	double ata00 = A(0, 0) * A(0, 0) + A(0, 1) * A(0, 1);
+	double ata01 = A(0, 0) * A(1, 0) + A(0, 1) * A(1, 1);
+	double ata11 = A(1, 0) * A(1, 0) + A(1, 1) * A(1, 1);
+	double gamma = sqrt(0.5 * (ata00 + ata11 + sqrt((ata00 - ata11) * (ata00 - ata11) + 4.0 * ata01 * ata01)));
+	if (gamma < numeric_limits<float>::epsilon())
+		return (-1);
+
+	// The first two columns of the rotation are known up to the sign of the third row
+	Matx22d Rt = A * (1.0 / gamma);
+	double b0 = sqrt(MAX(0.0, 1.0 - Rt(0, 0) * Rt(0, 0) - Rt(1, 0) * Rt(1, 0)));
+	double b1 = sqrt(MAX(0.0, 1.0 - Rt(0, 1) * Rt(0, 1) - Rt(1, 1) * Rt(1, 1)));
+	if (-Rt(0, 0) * Rt(0, 1) - Rt(1, 0) * Rt(1, 1) < 0)
+		b1 = -b1;
+
+	Vec3d c0(Rt(0, 0), Rt(1, 0), b0);
+	Vec3d c1(Rt(0, 1), Rt(1, 1), b1);
+	Vec3d c2 = c0.cross(c1);
+	Matx33d R1_(c0[0], c1[0], c2[0], c0[1], c1[1], c2[1], c0[2], c1[2], c2[2]);
+
+	c0[2] = -b0;
+	c1[2] = -b1;
+	c2 = c0.cross(c1);
+	Matx33d R2_(c0[0], c1[0], c2[0], c0[1], c1[1], c2[1], c0[2], c1[2], c2[2]);
+
+	R1 = Rv * R1_;
+	R2 = Rv * R2_;
+	return (0);
+}
+
+
+/**************************************************************************************************************
+ *
+ * @brief  			Squared reprojection error of point in normalized image coordinates
+ *
+ * @param  	in		const Matx33d &R - rotation matrix
+ * 			in		const Vec3d &t - translation vector
+ * 			in		const Point2d &obj - object point on the plane z = 0
+ * 			in		const Point2d &img - normalized image point
+ *
+ * @return 			Functions returns squared reprojection error. If the point is behind the camera,
+ * 					then DBL_MAX is returned.
+ *
+ * @remarks 		-
+ *
+ **************************************************************************************************************/
+static inline double PointError(const Matx33d &R, const Vec3d &t, const Point2d &obj, const Point2d &img)
+{
+	double z = R(2, 0) * obj.x + R(2, 1) * obj.y + t[2];
+	if (z <= 0)
+		return (DBL_MAX);
+
+	double dx = (R(0, 0) * obj.x + R(0, 1) * obj.y + t[0]) / z - img.x;
+	double dy = (R(1, 0) * obj.x + R(1, 1) * obj.y + t[1]) / z - img.y;
+	return (dx * dx + dy * dy);
+}
+
+
+/**************************************************************************************************************
+ *
+ * @brief  			Translation of planar pose with known rotation
+ *
+ * @param  	in		const Matx33d &R - rotation matrix
+ * 			in		const vector<Point2d> &obj - object points on the plane z = 0
+ * 			in		const vector<Point2d> &img - normalized image points
+ * 			out		Vec3d &t - translation vector
+ *
+ * @return 			Functions returns RMS error of the pose, or -1 if the translation can not be calculated.
+ *
+ * @remarks 		The projection equations are linear in t, they are solved by least squares.
+ *
+ **************************************************************************************************************/
+static double PlanarTranslation(const Matx33d &R, const vector<Point2d> &obj, const vector<Point2d> &img, Vec3d &t)
+{
+	Matx33d ata = Matx33d::zeros();
+	Vec3d atb(0, 0, 0);
+
+	for (uint i = 0; i < obj.size(); i++)
+	{
+		double rx = R(0, 0) * obj[i].x + R(0, 1) * obj[i].y;
+		double ry = R(1, 0) * obj[i].x + R(1, 1) * obj[i].y;
+		double rz = R(2, 0) * obj[i].x + R(2, 1) * obj[i].y;
+
+		// | 1 0 -x | * t = | x * rz - rx |
+		// | 0 1 -y |       | y * rz - ry |
+		double x = img[i].x, y = img[i].y;
+		double bx = x * rz - rx, by = y * rz - ry;
+		ata(0, 0) += 1;			ata(0, 2) -= x;
+		ata(1, 1) += 1;			ata(1, 2) -= y;
+		ata(2, 2) += x * x + y * y;
+		atb[0] += bx;
+		atb[1] += by;
+		atb[2] -= x * bx + y * by;
+	}
+	ata(2, 0) = ata(0, 2);
+	ata(2, 1) = ata(1, 2);
+
+	if (!solve(ata, atb, t, DECOMP_CHOLESKY))
+		return (-1);
+
+	double err = 0;
+	for (uint i = 0; i < obj.size(); i++)
+	{
+		double e = PointError(R, t, obj[i], img[i]);
+		if (e == DBL_MAX)
+			return (-1);
+		err += e;
+	}
+	return (sqrt(err / obj.size()));
+}
+
+
+double IppePose(const vector<Point2d> &obj, const vector<Point2d> &img, Matx33d &R, Vec3d &t)
+{
+	int num = (int)obj.size();
+	if ((num < 4) || (img.size() != obj.size()))
+		return (-1);
+
+	/*********************** 1. Center object points ***************************/
+	Point2d center(0, 0);
+	for (int i = 0; i < num; i++)
+		center += obj[i];
+	center *= 1.0 / num;
+
+	vector<Point2d> obj_c(num);
+	for (int i = 0; i < num; i++)
+		obj_c[i] = obj[i] - center;
+
+	/*********************** 2. Homography and its Jacobian at the center ***************************/
+	Mat H = findHomography(obj_c, img, 0);
+	if (H.empty())
+		return (-1);
+	Matx33d h = H;
+	h *= 1.0 / h(2, 2);
+
+	Matx22d J(h(0, 0) - h(2, 0) * h(0, 2), h(0, 1) - h(2, 1) * h(0, 2),
+			  h(1, 0) - h(2, 0) * h(1, 2), h(1, 1) - h(2, 1) * h(1, 2));
+
+	/*********************** 3. Two rotations and their translations ***************************/
+	Matx33d Rs[2];
+	if (IppeRotations(J, Vec2d(h(0, 2), h(1, 2)), Rs[0], Rs[1]) != 0)
+		return (-1);
+
+	double best = -1;
+	for (int s = 0; s < 2; s++)
+	{
+		Vec3d ts;
+		double err = PlanarTranslation(Rs[s], obj_c, img, ts);
+		if ((err >= 0) && ((best < 0) || (err < best)))
+		{
+			best = err;
+			R = Rs[s];
+			t = ts;
+		}
+	}
+	if (best < 0)
+		return (-1);
+
+	/*********************** 4. Move origin back from the object center ***************************/
+	t -= R * Vec3d(center.x, center.y, 0);
+	return (best);
+}
+
+
+int SolvePlanarPose(const vector<Point3f> &obj_points, const vector<Point2f> &img_points,
+					const Mat &K, const Mat &dist_coeffs, Mat &rvec, Mat &tvec,
+					PlanarPoseReport &report)
+{
+	int num = (int)obj_points.size();
+	report.inliers_num = 0;
+	report.rms = -1;
+	report.inliers.assign(num, 0);
+	if ((num < 4) || (img_points.size() != obj_points.size()) || K.empty())
+		return (-1);
+
+	/*********************** 1. Normalized image points ***************************/
+	vector<Point2f> img_norm;
+	undistortPoints(img_points, img_norm, K, dist_coeffs);
+
+	vector<Point2d> obj(num), img(num);
+	for (int i = 0; i < num; i++)
+	{
+		obj[i] = Point2d(obj_points[i].x, obj_points[i].y);
+		img[i] = Point2d(img_norm[i].x, img_norm[i].y);
+	}
+
+	Mat K64;
+	K.convertTo(K64, CV_64F);
+	double focal = 0.5 * (K64.at<double>(0, 0) + K64.at<double>(1, 1));
+	double thresh2 = pow(PLANAR_RANSAC_THRESHOLD / focal, 2); // Squared threshold in normalized coordinates
+
+	/*********************** 2. RANSAC over 4-point samples ***************************/
+	RNG rng(0x5f3759df);
+	int best_num = 0;
+	double best_err = DBL_MAX;
+	Matx33d R;
+	Vec3d t;
+	vector<Point2d> obj_s(4), img_s(4);
+
+	for (int it = 0; (it < PLANAR_RANSAC_ITERATIONS) && (best_num < num); it++)
+	{
+		int idx[4];
+		for (int k = 0; k < 4; k++)
+		{
+			bool unique;
+			do {
+				idx[k] = rng.uniform(0, num);
+				unique = true;
+				for (int j = 0; j < k; j++)
+					unique &= (idx[j] != idx[k]);
+			} while (!unique);
+			obj_s[k] = obj[idx[k]];
+			img_s[k] = img[idx[k]];
+		}
+
+		// reject samples with three collinear object points
+		bool degenerate = false;
+		for (int k = 0; k < 4; k++)
+		{
+			Point2d a = obj_s[(k + 1) & 3] - obj_s[k];
+			Point2d b = obj_s[(k + 2) & 3] - obj_s[k];
+			degenerate |= (fabs(a.cross(b)) < 1e-6 * (a.dot(a) + b.dot(b)));
+		}
+		if (degenerate)
+			continue;
+
+		Matx33d Rs;
+		Vec3d ts;
+		if (IppePose(obj_s, img_s, Rs, ts) < 0)
+			continue;
+
+		int inliers = 0;
+		double err = 0;
+		for (int i = 0; i < num; i++)
+		{
+			double e = PointError(Rs, ts, obj[i], img[i]);
+			if (e < thresh2)
+			{
+				inliers++;
+				err += e;
+			}
+		}
+		if ((inliers > best_num) || ((inliers == best_num) && (err < best_err)))
+		{
+			best_num = inliers;
+			best_err = err;
+			R = Rs;
+			t = ts;
+		}
+	}
+	if (best_num < 4)
+		return (-1);
+
+	/*********************** 3. Refine pose on inliers ***************************/
+	vector<Point2d> obj_in, img_in;
+	vector<Point3f> obj_points_in;
+	vector<Point2f> img_points_in;
+	for (int i = 0; i < num; i++)
+	{
+		if (PointError(R, t, obj[i], img[i]) < thresh2)
+		{
+			obj_in.push_back(obj[i]);
+			img_in.push_back(img[i]);
+			obj_points_in.push_back(obj_points[i]);
+			img_points_in.push_back(img_points[i]);
+		}
+	}
+	if ((obj_in.size() < 4) || (IppePose(obj_in, img_in, R, t) < 0))
+		return (-1);
+
+	Mat(Vec3d(t)).copyTo(tvec);
+	Rodrigues(Mat(R), rvec);
+	solvePnP(obj_points_in, img_points_in, K, dist_coeffs, rvec, tvec, true);
+
+	/*********************** 4. Report reprojection error ***************************/
+	vector<Point2f> reprojected;
+	projectPoints(obj_points, rvec, tvec, K, dist_coeffs, reprojected);
+
+	double err = 0;
+	for (int i = 0; i < num; i++)
+	{
+		Point2f d = reprojected[i] - img_points[i];
+		double e = d.dot(d);
+		if (e < PLANAR_RANSAC_THRESHOLD * PLANAR_RANSAC_THRESHOLD)
+		{
+			report.inliers[i] = 1;
+			report.inliers_num++;
+			err += e;
+		}
+	}
+	if (report.inliers_num == 0)
+		return (-1);
+	report.rms = sqrt(err / report.inliers_num);
+
+	if ((report.inliers_num < PLANAR_MIN_INLIERS * num) || (report.rms > PLANAR_MAX_RMS))
+		return (-1);
+	return (0);
+}
+
+
+/**************************************************************************************************************
+ *
+ * @brief  			Median of values
+ *
+ * @param  	in		vector<double> values - values
+ *
+ * @return 			Functions returns the median.
+ *
+ * @remarks 		-
+ *
+ **************************************************************************************************************/
+static double Median(vector<double> values)
+{
+	size_t mid = values.size() / 2;
+	nth_element(values.begin(), values.begin() + mid, values.end());
+	double median = values[mid];
+	if ((values.size() & 1) == 0)
+		median = 0.5 * (median + *max_element(values.begin(), values.begin() + mid));
+	return (median);
+}
+
+
+/**************************************************************************************************************
+ *
+ * @brief  			Rotation distance
+ *
+ * @param  	in		const Matx33d &R1 - first rotation
+ * 			in		const Matx33d &R2 - second rotation
+ *
+ * @return 			Functions returns the logarithm of R1^T * R2 (rotation vector).
+ *
+ * @remarks 		-
+ *
+ **************************************************************************************************************/
+static inline Vec3d RotationLog(const Matx33d &R1, const Matx33d &R2)
+{
+	Vec3d w;
+	Rodrigues(R1.t() * R2, w);
+	return (w);
+}
+
+
+int FusePoses(const vector<Mat> &rvecs, const vector<Mat> &tvecs, Mat &rvec, Mat &tvec,
+			  PoseFusionReport &report)
+{
+	int num = (int)rvecs.size();
+	report.inliers_num = 0;
+	report.angle_rms = report.shift_rms = 0;
+	report.inliers.assign(num, 0);
+	if ((num == 0) || (tvecs.size() != rvecs.size()))
+		return (-1);
+
+	vector<Matx33d> R(num);
+	vector<Vec3d> t(num);
+	for (int k = 0; k < num; k++)
+	{
+		Mat r64, t64;
+		rvecs[k].convertTo(r64, CV_64F);
+		tvecs[k].convertTo(t64, CV_64F);
+		Rodrigues(r64, R[k]);
+		t[k] = Vec3d(t64.ptr<double>());
+	}
+
+	/*********************** 1. Medoid rotation is the origin of the tangent space ***************************/
+	int medoid = 0;
+	double medoid_dist = DBL_MAX;
+	for (int a = 0; a < num; a++)
+	{
+		double dist = 0;
+		for (int b = 0; b < num; b++)
+			dist += norm(RotationLog(R[a], R[b]));
+		if (dist < medoid_dist)
+		{
+			medoid_dist = dist;
+			medoid = a;
+		}
+	}
+
+	/*********************** 2. Component-wise median in the Lie algebra ***************************/
+	vector<Vec3d> w(num);
+	for (int k = 0; k < num; k++)
+		w[k] = RotationLog(R[medoid], R[k]);
+
+	Vec3d w_med, t_med;
+	vector<double> values(num);
+	for (int c = 0; c < 3; c++)
+	{
+		for (int k = 0; k < num; k++)
+			values[k] = w[k][c];
+		w_med[c] = Median(values);
+		for (int k = 0; k < num; k++)
+			values[k] = t[k][c];
+		t_med[c] = Median(values);
+	}
+	Matx33d dR;
+	Rodrigues(w_med, dR);
+	Matx33d R_med = R[medoid] * dR;
+
+	/*********************** 3. Outliers rejection by median absolute deviation ***************************/
+	vector<double> angle(num), shift(num);
+	for (int k = 0; k < num; k++)
+	{
+		angle[k] = norm(RotationLog(R_med, R[k]));
+		shift[k] = norm(t[k] - t_med);
+	}
+	double angle_thr = MAX(FUSION_MIN_ANGLE, FUSION_MAD_SCALE * 1.4826 * Median(angle));
+	double shift_thr = MAX(FUSION_MIN_SHIFT * norm(t_med), FUSION_MAD_SCALE * 1.4826 * Median(shift));
+
+	/*********************** 4. Mean of inliers around the median ***************************/
+	Vec3d w_mean(0, 0, 0), t_mean(0, 0, 0);
+	for (int k = 0; k < num; k++)
+	{
+		if ((angle[k] <= angle_thr) && (shift[k] <= shift_thr))
+		{
+			report.inliers[k] = 1;
+			report.inliers_num++;
+			w_mean += RotationLog(R_med, R[k]);
+			t_mean += t[k];
+		}
+	}
+	if (report.inliers_num == 0)
+		return (-1);
+	w_mean *= 1.0 / report.inliers_num;
+	t_mean *= 1.0 / report.inliers_num;
+
+	Rodrigues(w_mean, dR);
+	Matx33d R_fused = R_med * dR;
+
+	for (int k = 0; k < num; k++)
+	{
+		if (report.inliers[k])
+		{
+			report.angle_rms += pow(norm(RotationLog(R_fused, R[k])), 2);
+			report.shift_rms += pow(norm(t[k] - t_mean), 2);
+		}
+	}
+	report.angle_rms = sqrt(report.angle_rms / report.inliers_num);
+	report.shift_rms = sqrt(report.shift_rms / report.inliers_num);
+
+	Rodrigues(Mat(R_fused), rvec);
+	Mat(t_mean).copyTo(tvec);
+	return (0);
+}
@@ -0,0 +1,137 @@
+/*
+*
+* Copyright © 2017 NXP
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice (including the next
+* paragraph) shall be included in all copies or substantial portions of the
+* Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef SRC_PLANAR_POSE_HPP_
+#define SRC_PLANAR_POSE_HPP_
+
+/*******************************************************************************************
+ * Includes
+ *******************************************************************************************/
+#include <iostream>
+#include <opencv2/calib3d/calib3d.hpp>
+
+using namespace cv;
+using namespace std;
+
+/*******************************************************************************************
+ * Macros
+ *******************************************************************************************/
+#define PLANAR_RANSAC_ITERATIONS	64		// Max number of RANSAC samples
+#define PLANAR_RANSAC_THRESHOLD		3.0		// Max reprojection error of inlier (pixels)
+#define PLANAR_MAX_RMS				1.5		// Max RMS reprojection error of accepted pose (pixels)
+#define PLANAR_MIN_INLIERS			0.75	// Min share of inliers in accepted pose
+#define FUSION_MAD_SCALE			3.0		// Outlier distance in scaled median absolute deviations
+#define FUSION_MIN_ANGLE			0.002	// Min outlier rotation distance (radians)
+#define FUSION_MIN_SHIFT			0.005	// Min outlier translation distance relative to the camera distance
+
+/*******************************************************************************************
+ * Types
+ *******************************************************************************************/
+struct PlanarPoseReport
+{
+	int inliers_num;		/* Number of inliers */
+	double rms;				/* RMS reprojection error of inliers (pixels) */
+	vector<uchar> inliers;	/* Inliers mask */
+};
+
+struct PoseFusionReport
+{
+	int inliers_num;		/* Number of inlier poses */
+	double angle_rms;		/* RMS rotation distance of inliers from the fused pose (radians) */
+	double shift_rms;		/* RMS translation distance of inliers from the fused pose */
+	vector<uchar> inliers;	/* Inliers mask */
+};
+
+/*******************************************************************************************
+ * Global functions
+ *******************************************************************************************/
+/**************************************************************************************************************
+ *
+ * @brief  			Planar pose by IPPE (Infinitesimal Plane-based Pose Estimation)
+ *
+ * @param  	in		const vector<Point2d> &obj - object points on the plane z = 0
+ * 			in		const vector<Point2d> &img - normalized image points (K^-1 * p)
+ * 			out		Matx33d &R - rotation matrix
+ * 			out		Vec3d &t - translation vector
+ *
+ * @return 			Functions returns the RMS error of the pose in normalized image coordinates,
+ * 					or -1 if the pose can not be calculated.
+ *
+ * @remarks 		The function uses closed-form solution of T. Collins and A. Bartoli, "Infinitesimal Plane-based
+ * 					Pose Estimation". The homography of the centered object is decomposed at the object center
+ * 					into two rotations. The translation of each rotation is found by linear least squares and
+ * 					the solution with smaller reprojection error is returned. At least 4 points are required.
+ *
+ **************************************************************************************************************/
+extern double IppePose(const vector<Point2d> &obj, const vector<Point2d> &img, Matx33d &R, Vec3d &t);
+
+/**************************************************************************************************************
+ *
+ * @brief  			Robust planar pose
+ *
+ * @param  	in		const vector<Point3f> &obj_points - object points on the plane z = 0
+ * 			in		const vector<Point2f> &img_points - image points
+ * 			in		const Mat &K - camera matrix
+ * 			in		const Mat &dist_coeffs - distortion coefficients
+ * 			out		Mat &rvec - rotation vector
+ * 			out		Mat &tvec - translation vector
+ * 			out		PlanarPoseReport &report - inliers and reprojection error
+ *
+ * @return 			Functions returns 0 if the pose is accepted. Otherwise -1 is returned.
+ *
+ * @remarks 		The function runs RANSAC over 4-point samples with IPPE pose of each sample. The random
+ * 					generator has a fixed seed, so the result is repeatable. The pose of the best sample is
+ * 					recalculated with IPPE on all inliers and refined by iterative solvePnP on inliers.
+ * 					The pose is accepted if the share of inliers is not less than PLANAR_MIN_INLIERS and
+ * 					RMS reprojection error of inliers is not bigger than PLANAR_MAX_RMS.
+ *
+ **************************************************************************************************************/
+extern int SolvePlanarPose(const vector<Point3f> &obj_points, const vector<Point2f> &img_points,
+						   const Mat &K, const Mat &dist_coeffs, Mat &rvec, Mat &tvec,
+						   PlanarPoseReport &report);
+
+/**************************************************************************************************************
+ *
+ * @brief  			Robust fusion of poses of one camera
+ *
+ * @param  	in		const vector<Mat> &rvecs - rotation vectors
+ * 			in		const vector<Mat> &tvecs - translation vectors
+ * 			out		Mat &rvec - fused rotation vector
+ * 			out		Mat &tvec - fused translation vector
+ * 			out		PoseFusionReport &report - inliers and dispersion of the poses
+ *
+ * @return 			Functions returns 0 if the poses are fused. Otherwise -1 is returned.
+ *
+ * @remarks 		The rotations are moved to the tangent space (Lie algebra) of the medoid rotation, and
+ * 					the fused rotation is the component-wise median there. The fused translation is the
+ * 					component-wise median of translations. Poses which are farther from the median than
+ * 					FUSION_MAD_SCALE scaled median absolute deviations are rejected, and the fused pose is
+ * 					recalculated as the mean of inliers.
+ *
+ **************************************************************************************************************/
+extern int FusePoses(const vector<Mat> &rvecs, const vector<Mat> &tvecs, Mat &rvec, Mat &tvec,
+					 PoseFusionReport &report);
+
+#endif /* SRC_PLANAR_POSE_HPP_ */
@@ -58,144 +58,320 @@
 
 #include "src_contours.hpp"
 
+/**************************************************************************************************************
+ *
+ * @brief  			Get block size of adaptive threshold
+ *
+ * @param  	in		const Mat &img - input image
+ * 			in		int k - threshold pass
+ *
+ * @return 			Functions returns the odd block size.
+ *
+ * @remarks 		Even passes use the block size of 0.2 and odd passes use the block size of 0.1 of the image side.
+ *
+ **************************************************************************************************************/
+static int GetBlockSize(const Mat &img, int k)
+{
+	return (cvRound(MIN(img.cols, img.rows) * (k % 2 == 0 ? 0.2 : 0.1)) | 1);
+}
+
+
+/**************************************************************************************************************
+ *
+ * @brief  			Calculate integral image of the padded input image
+ *
+ * @param  	in		const Mat &img - input image
+ * 			in		int pad - border width
+ * 			out		Mat &padded - input image with replicated border
+ * 			out		Mat &sum - integral image (CV_32S)
+ *
+ * @return 			-
+ *
+ * @remarks 		The border is replicated as in adaptiveThreshold, so one integral image gives local means
+ * 					for all block sizes up to 2 * pad + 1.
+ *
+ **************************************************************************************************************/
+static void GetPaddedIntegral(const Mat &img, int pad, Mat &padded, Mat &sum)
+{
+	copyMakeBorder(img, padded, pad, pad, pad, pad, BORDER_REPLICATE);
+	integral(padded, sum, CV_32S);
+}
+
+
+/**************************************************************************************************************
+ *
+ * @brief  			Adaptive threshold using integral image
+ *
+ * @param  	in		const Mat &img - input image
+ * 			in		const Mat &sum - integral image of the padded input image
+ * 			in		int pad - border width of the padded image
+ * 			in		int block_size - size of a pixel neighborhood (odd, not bigger than 2 * pad + 1)
+ * 			in		int delta - constant subtracted from the mean
+ * 			out		Mat &dst - thresholded image
+ *
+ * @return 			-
+ *
+ * @remarks 		The result is the same as adaptiveThreshold with ADAPTIVE_THRESH_MEAN_C and THRESH_BINARY:
+ * 					the pixel is set to 255 if it is bigger than the rounded mean of its neighborhood minus delta.
+ *
+ **************************************************************************************************************/
+static void IntegralThreshold(const Mat &img, const Mat &sum, int pad, int block_size, int delta, Mat &dst)
+{
+	int r = block_size / 2;
+	int area = block_size * block_size;
+
+	dst.create(img.size(), CV_8UC1);
+	for (int y = 0; y < img.rows; y++)
+	{
+		const uchar *src = img.ptr<uchar>(y);
+		const int *top = sum.ptr<int>(y + pad - r);
+		const int *bottom = sum.ptr<int>(y + pad - r + block_size);
+		uchar *out = dst.ptr<uchar>(y);
+
+		for (int x = 0, x0 = pad - r; x < img.cols; x++, x0++)
+		{
+			int s = bottom[x0 + block_size] - bottom[x0] - top[x0 + block_size] + top[x0];
+			int mean = (2 * s + area) / (2 * area);
+			out[x] = (src[x] - mean > -delta) ? 255 : 0;
+		}
+	}
+}
+
+
+/**************************************************************************************************************
+ *
+ * @brief  			Check if one quad is inside another quad
+ *
+ * @param  	in		const Quad &inner - inner quad
+ * 			in		const Quad &outer - outer quad
+ *
+ * @return 			Functions returns true if all corners of the inner quad are strictly inside the outer quad.
+ *
+ * @remarks 		The quads are convex, so the point is inside the outer quad if it lies on the same side of
+ * 					all outer quad edges. The bounding boxes are compared first.
+ *
+ **************************************************************************************************************/
+static inline bool IsNested(const Quad &inner, const Quad &outer)
+{
+	if ((inner.box.x < outer.box.x) || (inner.box.y < outer.box.y) ||
+		(inner.box.x + inner.box.width > outer.box.x + outer.box.width) ||
+		(inner.box.y + inner.box.height > outer.box.y + outer.box.height))
+		return false;
+
+	for (int i = 0; i < 4; i++)
+	{
+		int sign = 0;
+		for (int e = 0; e < 4; e++)
+		{
+			const Point &a = outer.pt[e];
+			const Point &b = outer.pt[(e + 1) & 3];
+			int64 cross = (int64)(b.x - a.x) * (inner.pt[i].y - a.y) - (int64)(b.y - a.y) * (inner.pt[i].x - a.x);
+			if (cross == 0)
+				return false; // the point is on the edge
+			int s = (cross > 0) ? 1 : -1;
+			if (sign == 0)
+				sign = s;
+			else if (s != sign)
+				return false;
+		}
+	}
+	return true;
+}
+
+
+/**************************************************************************************************************
+ *
+ * @brief  			Search quads in thresholded image
+ *
+ * @param  	in/out	ContourArena &arena - scratch memory of the search. The thresholded image is taken from
+ * 					arena.threshold, found quads are returned in arena.quads
+ *			in		int min_size - empiric bound for minimal allowed perimeter for contour squares
+ *			in		int max_approx - maximal accuracy of polygon approximation
+ *			in		int min_dist - minimal distance of quad corners from the top and left image borders
+ *
+ * @return 			Functions returns the number of quads which were found.
+ *
+ * @remarks 		The function searches contours, approximates them with convex quadrangles and filters them.
+ *
+ **************************************************************************************************************/
+static int FindQuads(ContourArena &arena, int min_size, int max_approx, int min_dist)
+{
+	arena.quads.clear();
+	findContours(arena.threshold, arena.contours, arena.hierarchy, RETR_CCOMP, CHAIN_APPROX_SIMPLE);
+
+	// check all the contours one by one
+	for (int idx = 0; idx < (int)arena.contours.size(); idx++)
+	{
+		const vector<Point> &src_contour = arena.contours[idx];
+
+		// reject contours with too small perimeter
+		Rect rect = boundingRect(src_contour);
+		if (rect.width * rect.height < min_size)
+			continue;
+
+		vector<Point> *dst_contour = NULL;
+		for (int approx_level = 1; approx_level <= max_approx; approx_level++)
+		{
+			dst_contour = &arena.approx[0];
+			approxPolyDP(src_contour, *dst_contour, (float)approx_level, true);
+
+			if (dst_contour->size() == 4)
+				break;
+
+			// we call this again on its own output, because sometimes
+			// approxPolyDP() does not simplify as much as it should.
+			dst_contour = &arena.approx[1];
+			approxPolyDP(arena.approx[0], *dst_contour, (float)approx_level, true);
+
+			if (dst_contour->size() == 4)
+				break;
+		}
+
+		// reject non-quadrangles
+		if ((dst_contour == NULL) || (dst_contour->size() != 4) || !isContourConvex(*dst_contour))
+			continue;
+		if (fabs(contourArea(*dst_contour)) <= min_size)
+			continue;
+
+		Quad quad;
+		bool border = false;
+		for (int i = 0; i < 4; i++) {
+			quad.pt[i] = (*dst_contour)[i];
+			border |= (quad.pt[i].x <= min_dist) || (quad.pt[i].y <= min_dist);
+		}
+		if (border)
+			continue;
+
+		// With RETR_CCOMP only holes have a parent contour
+		quad.parent = arena.hierarchy[idx][3];
+		quad.hole = (quad.parent >= 0);
+		quad.contour = idx;
+		quad.box = boundingRect(*dst_contour);
+		arena.quads.push_back(quad);
+	}
+
+	// filter found contours
+	FilterContours(arena);
+
+	return ((int)arena.quads.size());
+}
+
+
+/**************************************************************************************************************
+ *
+ * @brief  			Search quads on the input image with one threshold
+ *
+ * @param  	in		const Mat &img - input image
+ * 			in/out	ContourArena &arena - scratch memory of the search. Found quads are returned in arena.quads
+ *			in		int pad - padding of the integral image
+ *			in		int k - threshold pass
+ *			in		int min_size - empiric bound for minimal allowed perimeter for contour squares
+ *			in		int max_approx - maximal accuracy of polygon approximation
+ * 			in/out	bool &integral_ready - the integral image of the input image is computed
+ *
+ * @return 			Functions returns the number of quads which were found.
+ *
+ * @remarks 		The integral image is computed by the first full resolution pass only, so the frames without
+ * 					template quads on the downsampled image do not pay for it.
+ *
+ **************************************************************************************************************/
+static int FullResolutionPass(const Mat &img, ContourArena &arena, int pad, int k, int min_size, int max_approx,
+							  bool &integral_ready)
+{
+	if (!integral_ready) {
+		GetPaddedIntegral(img, pad, arena.padded, arena.integral);
+		integral_ready = true;
+	}
+	IntegralThreshold(img, arena.integral, pad, GetBlockSize(img, k), (k/2)*5, arena.threshold);
+	return (FindQuads(arena, min_size, max_approx, 10));
+}
+
+
 /**************************************************************************************************************
  *
  * @brief  			Search contours in input image
  *
  * @param  	in		const Mat &img - input image
- * 			in/out	CvSeq** root - sequence of contours
- * 			in		CvMemStorage *storage - memory storage
+ * 			in/out	ContourArena &arena - scratch memory of the search. Found quads are returned in arena.quads
  *			in		int min_size - empiric bound for minimal allowed perimeter for contour squares
+ *			in		int max_approx - maximal accuracy of polygon approximation
+ *			in		int quads_num - number of quads in the template
  *
  * @return 			Functions returns the number of contours which were found.
  *
  * @remarks 		The function applies adaptive threshold on input image and searches contours in image.
- * 					If 4 contours are found then function has been terminated. Otherwise it changes block size
- * 					for adaptive threshold and tries again.
+ * 					If quads_num contours are found then function has been terminated. Otherwise it changes
+ * 					block size for adaptive threshold and tries again. If no threshold gives quads_num contours,
+ * 					then the result of the threshold with most contours not exceeding quads_num is returned
+ * 					(the template can be partially visible).
+ * 					The local means of all block sizes are taken from one integral image. Each threshold is tried
+ * 					on the downsampled image first: as soon as it gives exactly quads_num quads there, the same
+ * 					threshold is checked on the input image, so the common case costs one coarse and one full
+ * 					resolution pass. If no threshold succeeded, the other thresholds which give some quads on
+ * 					the downsampled image are checked on the input image, and then the thresholds which give no
+ * 					quads there: thin template borders or quads near the image border can be lost by the
+ * 					downsampling, so every threshold keeps its full resolution pass when the template is not
+ * 					found at once.
+ * 					For the fisheye image use MAX_CONTOUR_APPROX_FISHEYE: the template edges are curved there
+ * 					and a coarser approximation is required to reduce them to quadrangles.
  *
  **************************************************************************************************************/
-int GetContours(const Mat &img, CvSeq** root, CvMemStorage *storage, int min_size)
+int GetContours(const Mat &img, ContourArena &arena, int min_size, int max_approx, int quads_num)
 {
-    const int min_dilations = 0;
-    const int max_dilations = 0;
-
-	Mat temp_threshold_rgb(img.rows, img.cols, CV_8UC3, Scalar(0, 0, 0, 0));
-	
-	for (int k = 0; k < 6; k++) {
-		int block_size = cvRound(MIN(img.cols, img.rows) * (k % 2 == 0 ? 0.2 : 0.1)) | 1;
-		for (int dilations = min_dilations; dilations <= max_dilations; dilations++)
-		{
-			Mat temp_threshold;
-			Mat temp_threshold_rgb(img.rows, img.cols, CV_8UC3, Scalar(0, 0, 0, 0));
-
-			/*********************** Thresholding ***************************/
-#if 1
-			//Adaptive threshold
-			adaptiveThreshold(img, temp_threshold, 255, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY, block_size, (k/2)*5);
-#else
-			// Empiric threshold level
-			double mean = cvAvg(img).val[0];
-			int thresh_level = cvRound(mean - 10);
-			thresh_level = MAX(thresh_level, 10);
-
-			threshold(img, temp_threshold, thresh_level, 255, CV_THRESH_BINARY);
-#endif
-
-#if SHOW_ALL_CONTOURS
-//			if(debug_mode)
-//				showImg(temp_threshold);
-#endif
-			/*********************** Dilatation ***************************/
-			//cvDilate(temp_threshold, temp_threshold, 0, dilations);
-
-			/*********************** Generate Quads ***********************/
-			IplImage copy = temp_threshold;
-			IplImage* tmp = &copy;
-
-			// create temporary storage for contours and the sequence of pointers to found quadrangles
-			Ptr<CvMemStorage> temp_storage;
-			temp_storage = cvCreateChildMemStorage( storage );
-		    *root = cvCreateSeq( 0, sizeof(CvSeq), sizeof(CvSeq*), temp_storage );
-
-			 // initialize contour retrieving routine
-			CvContourScanner scanner = cvStartFindContours(tmp, temp_storage, sizeof(CvContourEx), RETR_CCOMP, CV_CHAIN_APPROX_SIMPLE );
-
-		    // get all the contours one by one
-			CvSeq *src_contour = 0;
-		    while( (src_contour = cvFindNextContour( scanner )) != 0 )
-		    {
-		        CvSeq *dst_contour = 0;
-		        CvRect rect = ((CvContour*)src_contour)->rect;
-
-		        // reject contours with too small perimeter
-		        if(rect.width*rect.height >= min_size )
-		        {
-		            int approx_level;
-		            const int min_approx_level = 1, max_approx_level = MAX_CONTOUR_APPROX;
-		            for( approx_level = min_approx_level; approx_level <= max_approx_level; approx_level++ )
-		            {
-		                dst_contour = cvApproxPoly( src_contour, sizeof(CvContour), temp_storage, CV_POLY_APPROX_DP, (float)approx_level );
-
-		                if( dst_contour->total == 4 )
-		                    break;
-
-		                // we call this again on its own output, because sometimes
-		                // cvApproxPoly() does not simplify as much as it should.
-		                dst_contour = cvApproxPoly( dst_contour, sizeof(CvContour), temp_storage, CV_POLY_APPROX_DP, (float)approx_level );
-
-		                if( dst_contour->total == 4 )
-		                    break;
-		            }
-
-		            // reject non-quadrangles
-		            if(dst_contour->total == 4 && cvCheckContourConvexity(dst_contour))
-		            {
-		                if(fabs(cvContourArea(dst_contour, CV_WHOLE_SEQ)) > min_size )
-		                {
-
-		                	CvPoint pt[4];
-          	                for(int i = 0; i < 4; i++ )
-          	                    pt[i] = *(CvPoint*)cvGetSeqElem(dst_contour, i);
-
-          	                if((pt[0].x > 10) && (pt[0].y > 10) && (pt[1].x > 10) && (pt[1].y > 10) &&
-          	                   (pt[2].x > 10) && (pt[2].y > 10) && (pt[3].x > 10) && (pt[3].y > 10)) {
-								CvContourEx* parent = (CvContourEx*)(src_contour->v_prev);
-								parent->counter++;
-								dst_contour->v_prev = (CvSeq*)parent;
-								cvSeqPush(*root, &dst_contour);
-          	                }
-		                }
-		            }
-		        }
-		    }
-		    // finish contour retrieving
- 		    cvEndFindContours(&scanner);
-
- 			// filter found contours
- 			FilterContours(root);
-
-/*#if SHOW_ALL_CONTOURS == 1
-			if (debug_mode) {
-				for (int idx = 0; idx < (*root)->total; idx++)
-				{
-					CvSeq * contours = *(CvSeq**)cvGetSeqElem(*root, idx);
-					// get contour points
-					vector<Point> contour_points;
-					for (int i = 0; i < 4; i++) {
-						contour_points.push_back(*(CvPoint*)cvGetSeqElem(contours, i));
-					}
-					for (int i = 0; i < 4; i++) line(temp_threshold_rgb, contour_points[i], contour_points[(i + 1) & 3], Scalar(255, 255, 255), 1, CV_AA, 0);
-				}
-				showImg(temp_threshold_rgb);
-			}
-#endif*/
+	int coarse_num[THRESHOLD_PASSES];	// Number of quads found on the downsampled image
+	bool tried[THRESHOLD_PASSES];		// The threshold was checked on the input image
+	bool integral_ready = false;
+	int best_k = -1, best_num = 0;
+	int last_k = -1;					// Threshold of the quads in arena.quads
+
+	/*********************** Integral images ***************************/
+	pyrDown(img, arena.coarse);
+	int pad = GetBlockSize(img, 0) / 2; // The first block size is the biggest one
+	int coarse_pad = GetBlockSize(arena.coarse, 0) / 2;
+	GetPaddedIntegral(arena.coarse, coarse_pad, arena.padded, arena.coarse_integral);
+
+	/*********************** Search quads pass by pass ***************************/
+	for (int k = 0; k < 3 * THRESHOLD_PASSES; k++) {
+		int pass = k % THRESHOLD_PASSES;
+		if (k < THRESHOLD_PASSES) {
+			// Count quads on the downsampled image, only the thresholds with all template quads go on at once
+			IntegralThreshold(arena.coarse, arena.coarse_integral, coarse_pad, GetBlockSize(arena.coarse, pass),
+							  (pass/2)*5, arena.threshold);
+			coarse_num[pass] = FindQuads(arena, MAX(1, min_size / 4), max_approx, 5);
+			tried[pass] = false;
+			last_k = -1;	// arena.quads holds the quads of the downsampled image
+			if (coarse_num[pass] != quads_num)
+				continue;
+		} else if (tried[pass] || ((k < 2 * THRESHOLD_PASSES) && (coarse_num[pass] == 0))) {
+			continue;	// Already checked, the thresholds without quads on the downsampled image go last
 		}
-		// if 4 contours are detected, then break
-	    if((*root)->total == CONTOURS_NUM)
-	    	break;
+
+		// if all template contours are detected, then break
+		tried[pass] = true;
+		last_k = pass;
+		int num = FullResolutionPass(img, arena, pad, pass, min_size, max_approx, integral_ready);
+		if (num == quads_num)
+			return (num);
+
+		// Keep the threshold with most quads, extra quads are worse than missing ones
+		if ((best_k < 0) || (MIN(num, quads_num) > MIN(best_num, quads_num)) ||
+			((MIN(num, quads_num) == MIN(best_num, quads_num)) && (num < best_num))) {
+			best_k = pass;
+			best_num = num;
+		}
+	}
+
+	// There is no template in the image
+	if (best_num == 0) {
+		arena.quads.clear();
+		return (0);
 	}
-	
-	return ((*root)->total);
+
+	// Repeat the best threshold if it was not the last one
+	if (best_k != last_k)
+		FullResolutionPass(img, arena, pad, best_k, min_size, max_approx, integral_ready);
+
+	return ((int)arena.quads.size());
 }
 
 
@@ -203,58 +379,120 @@ int GetContours(const Mat &img, CvSeq** root, CvMemStorage *storage, int min_siz
  *
  * @brief  			Filter found contours.
  *
- * @param  	in/out	CvSeq** root - sequence of contours
+ * @param  	in/out	ContourArena &arena - scratch memory of the search. Found quads are filtered in arena.quads
  *
  * @return 			-
  *
- * @remarks 		The function checks all contours from the input sequence and removes contours
- * 					which are not located inside another sequence contour or which do not contain
- * 					another sequence contour.
+ * @remarks 		The function checks all contours from the input vector and removes contours
+ * 					which are not located inside another vector contour or which do not contain
+ * 					another vector contour. The order of the remaining contours is kept.
+ * 					The hole contours are tested against their parent contours first. The rest of pairs is
+ * 					taken from the uniform grid of quads bounding boxes, and only the pairs with nested
+ * 					bounding boxes are tested.
  *
  **************************************************************************************************************/
-void FilterContours(CvSeq** root)
+void FilterContours(ContourArena &arena)
 {
-	int idx = (*root)->total - 1; // index of the last sequence contour
-	int contours_num = (*root)->total; // number of contours
-	// for each sequence contour
-	while(idx >= 0)
+	vector<Quad> &quads = arena.quads;
+	int quads_num = (int)quads.size();
+	if (quads_num == 0)
+		return;
+
+	// The nesting relation is symmetric, so a contour is kept if it has at least one nested pair
+	// among all found contours
+	arena.keep.assign(quads_num, false);
+	arena.visited.assign(quads_num, -1);
+
+	/*********************** Hierarchy pairs ***************************/
+	// A hole quad is usually nested into the quad of its parent contour
+	arena.quad_index.assign(arena.contours.size(), -1);
+	for (int idx = 0; idx < quads_num; idx++)
+		arena.quad_index[quads[idx].contour] = idx;
+
+	for (int idx = 0; idx < quads_num; idx++)
 	{
-		CvSeq * src_contour = *(CvSeq**)cvGetSeqElem(*root, idx); // get idx contour
-		// get contour points
-		vector<Point2f> contour_1;
-		for(int i = 0; i < src_contour->total; i++) {
-			contour_1.push_back(*(CvPoint*)cvGetSeqElem(src_contour, i));
+		int parent = (quads[idx].parent >= 0) ? arena.quad_index[quads[idx].parent] : -1;
+		if ((parent >= 0) && IsNested(quads[idx], quads[parent]))
+		{
+			arena.keep[idx] = true;
+			arena.keep[parent] = true;
 		}
+	}
 
-		bool test = 0;
-		for(int j = 0; j < contours_num; j++)
-		{
-			CvSeq * contour = *(CvSeq**)cvGetSeqElem(*root, j); // get j contour
-			// get contour points
-			vector<Point2f> contour_2;
-			for(int i = 0; i < contour->total; i++) {
-				contour_2.push_back(*(CvPoint*)cvGetSeqElem(contour, i));
-			}
+	/*********************** Bounding boxes grid ***************************/
+	Rect bounds = quads[0].box;
+	for (int idx = 1; idx < quads_num; idx++)
+		bounds |= quads[idx].box;
 
-			bool is_inside = 1; // idx contour is inside another contour
-			bool is_outside = 1; // another contour is inside the idx contour
-			for(int i = 0; i < contour->total; i++) {
-				is_inside = is_inside & (pointPolygonTest(contour_1, contour_2[i], false) > 0); // check all points of contour
-				is_outside = is_outside & (pointPolygonTest(contour_2, contour_1[i], false) > 0); // check all points of contour
-			}
-			if(is_inside || is_outside) // if idx contour is inside j contour or j contour is inside idx contour
-			{
-				test = 1; // don't remove contour
-				break;
-			}
+	int grid_size = MAX(1, cvCeil(sqrt((double)quads_num))); // Number of cells along each axis
+	float cell_w = (float)grid_size / (bounds.width + 1);
+	float cell_h = (float)grid_size / (bounds.height + 1);
+
+	// Count quads in each cell, then fill cells from their ends, so grid_start becomes start of each cell
+	arena.grid_start.assign(grid_size * grid_size + 1, 0);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		if (pass == 1)
+		{
+			for (int i = 1; i <= grid_size * grid_size; i++)
+				arena.grid_start[i] += arena.grid_start[i - 1];
+			arena.grid_items.resize(arena.grid_start[grid_size * grid_size]);
 		}
-		if(!test)
+
+		for (int idx = quads_num - 1; idx >= 0; idx--)
 		{
-			cvSeqRemove(*root, idx); // remove contour
-			contours_num--; // decrease contours number
+			const Rect &box = quads[idx].box;
+			int x0 = (int)((box.x - bounds.x) * cell_w), x1 = (int)((box.x + box.width - 1 - bounds.x) * cell_w);
+			int y0 = (int)((box.y - bounds.y) * cell_h), y1 = (int)((box.y + box.height - 1 - bounds.y) * cell_h);
+			for (int y = y0; y <= y1; y++)
+				for (int x = x0; x <= x1; x++)
+				{
+					if (pass == 0)
+						arena.grid_start[y * grid_size + x]++;
+					else
+						arena.grid_items[--arena.grid_start[y * grid_size + x]] = idx;
+				}
 		}
-		idx--; // next contour
 	}
+
+	/*********************** Grid pairs ***************************/
+	for (int idx = 0; idx < quads_num; idx++)
+	{
+		if (arena.keep[idx])
+			continue;
+
+		const Rect &box = quads[idx].box;
+		int x0 = (int)((box.x - bounds.x) * cell_w), x1 = (int)((box.x + box.width - 1 - bounds.x) * cell_w);
+		int y0 = (int)((box.y - bounds.y) * cell_h), y1 = (int)((box.y + box.height - 1 - bounds.y) * cell_h);
+		for (int y = y0; (y <= y1) && !arena.keep[idx]; y++)
+			for (int x = x0; (x <= x1) && !arena.keep[idx]; x++)
+			{
+				int cell = y * grid_size + x;
+				for (int i = arena.grid_start[cell]; i < arena.grid_start[cell + 1]; i++)
+				{
+					int j = arena.grid_items[i];
+					if ((j == idx) || (arena.visited[j] == idx))
+						continue;
+					arena.visited[j] = idx;
+
+					if (IsNested(quads[idx], quads[j]) || IsNested(quads[j], quads[idx]))
+					{
+						arena.keep[idx] = true; // don't remove both contours
+						arena.keep[j] = true;
+						break;
+					}
+				}
+			}
+	}
+
+	// remove contours keeping the order
+	int num = 0;
+	for (int idx = 0; idx < quads_num; idx++)
+	{
+		if (arena.keep[idx])
+			quads[num++] = quads[idx];
+	}
+	quads.resize(num);
 }
 
 
@@ -262,7 +500,7 @@ void FilterContours(CvSeq** root)
  *
  * @brief  			Sort contours from left to right
  *
- * @param  	in		CvSeq** root - sequence of contours
+ * @param  	in/out	vector<Quad> &quads - found quads
  *
  * @return 			-
  *
@@ -270,43 +508,12 @@ void FilterContours(CvSeq** root)
  * 					according to this value from left to right.
  *
  **************************************************************************************************************/
-void SortContours(CvSeq** root)
+void SortContours(vector<Quad> &quads)
 {
-	CvSeq * src_contour[CONTOURS_NUM];
-	CvPoint pt[CONTOURS_NUM][4];
-	int min_x[CONTOURS_NUM];
-	int sort_seq[CONTOURS_NUM];
-
-	// Search min value of contour points in X axis
-    for(int idx = 0; idx < CONTOURS_NUM; idx++)
-    {
-    	src_contour[idx] = *(CvSeq**)cvGetSeqElem(*root, idx);
-
-        for(int i = 0; i < 4; i++) {
-            pt[idx][i] = *(CvPoint*)cvGetSeqElem(src_contour[idx], i);
-        }
-
-        min_x[idx] = MIN4(pt[idx][0].x, pt[idx][1].x, pt[idx][2].x, pt[idx][3].x);
-        sort_seq[idx] = idx;
-    }
-
-    // Sort contours from left to right
-    for(int j = 0; j < CONTOURS_NUM; j++)
-        for(int i = j + 1; i < CONTOURS_NUM; i++)
-        {
-        	if(min_x[sort_seq[i]] < min_x[sort_seq[j]]){
-        		int tmp = sort_seq[j];
-        		sort_seq[j] = sort_seq[i];
-        		sort_seq[i] = tmp;
-        	}
-        }
-
-    // Push sorted contours to the input vector
-    cvClearSeq(*root);
-    for(int idx = 0; idx < CONTOURS_NUM; idx++)
-    {
-    	cvSeqPush(*root, &src_contour[sort_seq[idx]]);
-    }
+	// The min value of contour points in X axis is the left side of the bounding box
+	stable_sort(quads.begin(), quads.end(), [](const Quad &a, const Quad &b) {
+		return (a.box.x < b.box.x);
+	});
 }
 
 
@@ -314,7 +521,7 @@ void SortContours(CvSeq** root)
  *
  * @brief  			Generate vector of contour points in proper order.
  *
- * @param  	in		CvSeq** root - sequence of contours
+ * @param  	in		const vector<Quad> &quads - found quads
  * 			out		vector<Point2f> * feature_points
  * 			in		Point2f shift
  *
@@ -324,17 +531,12 @@ void SortContours(CvSeq** root)
  * 					coordinates and push the corners to the feature_points array in proper order.
  *
  **************************************************************************************************************/
-void GetFeaturePoints(CvSeq** root, vector<Point2f> &feature_points, Point2f shift)
+void GetFeaturePoints(const vector<Quad> &quads, vector<Point2f> &feature_points, Point2f shift)
 {
     // Sort contour points clockwise (start from the top left point)
-    for(int idx = 0; idx < CONTOURS_NUM; idx++)
+    for(uint idx = 0; idx < quads.size(); idx++)
     {
-    	CvSeq * src_contour = *(CvSeq**)cvGetSeqElem(*root, idx);
-        CvPoint pt[4];
-
-        for(int i = 0; i < 4; i++) {
-            pt[i] = *(CvPoint*)cvGetSeqElem(src_contour, i);
-        }
+        const Point *pt = quads[idx].pt;
 
         // Calculate Y coordinate of the contour center point
         float ym;
@@ -355,11 +557,11 @@ void GetFeaturePoints(CvSeq** root, vector<Point2f> &feature_points, Point2f shi
         }
 
         // Sort contours corners from top-left clockwise
-        CvPoint pt_[4] = {0};
+        Point pt_[4];
         for(int i = 0; i < 4; i++)
         {
         	// Contours found by findContours function has direction. Objects are counter-clockwise, and holes are clockwise
-        	if(CV_IS_SEQ_HOLE(src_contour)) { // Holes
+        	if(quads[idx].hole) { // Holes
         		if((pt[i].y <= ym) && (pt[(i + 1) & 3].y <= ym)){
         	        pt_[0] = pt[i];
         	        pt_[1] = pt[(i + 1) & 3];
@@ -386,26 +588,117 @@ void GetFeaturePoints(CvSeq** root, vector<Point2f> &feature_points, Point2f shi
 
 /**************************************************************************************************************
  *
- * @brief  			Convert contours sequence into the vector of points.
+ * @brief  			Convert contours vector into the vector of points.
  *
- * @param  	in		CvSeq** root - sequence of contours
+ * @param  	in		const vector<Quad> &quads - found quads
  * 			out		vector<Point2f> * feature_points
  * 			in		Point2f shift
  *
  * @return 			-
  *
- * @remarks 		The function convert sequence of contours into points array. The shift is applied on corners
+ * @remarks 		The function convert vector of contours into points array. The shift is applied on corners
  * 					coordinates.
  *
  **************************************************************************************************************/
-void sec2vector(CvSeq** root, vector<Point2f> &feature_points, Point2f shift)
+void sec2vector(const vector<Quad> &quads, vector<Point2f> &feature_points, Point2f shift)
 {
-	for (int idx = 0; idx < (*root)->total; idx++)
+	for (uint idx = 0; idx < quads.size(); idx++)
 	{
-		CvSeq * src_contour = *(CvSeq**)cvGetSeqElem(*root, idx);
-		for (int i = 0; i < (*root)->elem_size; i++) {
-			CvPoint pt = *(CvPoint*)cvGetSeqElem(src_contour, i);
- 			feature_points.push_back(Point2f(pt.x + shift.x, pt.y + shift.y));
+		for (int i = 0; i < 4; i++) {
+			const Point &pt = quads[idx].pt[i];
+			feature_points.push_back(Point2f(pt.x + shift.x, pt.y + shift.y));
+		}
+	}
+}
+
+
+/**************************************************************************************************************
+ *
+ * @brief  			Associate found quads with template quads.
+ *
+ * @param  	in		const vector<Point2f> &feature_points - corners of found quads sorted by SortContours and
+ * 					GetFeaturePoints (4 corners per quad)
+ * 			in		const vector<Point2f> &ref_points - corners of template quads (4 corners per quad)
+ * 			out		vector<int> &ref_quads - template quad index for each found quad, -1 if quad is not associated
+ * 			in		double max_error - max RMS error of the template to image homography (pixels)
+ *
+ * @return 			Functions returns the number of associated quads.
+ *
+ * @remarks 		Template quads are sorted from left to right as the found quads are. The shorter of two
+ * 					sequences is slid along the longer one, so quads missing at the template ends or extra quads
+ * 					at the image ends are tolerated. Each window is checked by homography from template corners
+ * 					to image corners, the window with the smallest error is returned. Sorting costs O(n log n),
+ * 					and the number of checked windows is the difference of quads numbers plus one.
+ * 					If another window fits almost as well (the template is repeated), then the association is
+ * 					ambiguous and 0 is returned.
+ *
+ **************************************************************************************************************/
+int AssociateContours(const vector<Point2f> &feature_points, const vector<Point2f> &ref_points,
+					  vector<int> &ref_quads, double max_error)
+{
+	int num = feature_points.size() / 4;
+	int ref_num = ref_points.size() / 4;
+	ref_quads.assign(num, -1);
+	if ((num == 0) || (ref_num == 0))
+		return (0);
+
+	/*********************** Sort template quads from left to right ***************************/
+	vector<int> ref_order(ref_num);
+	vector<float> ref_left(ref_num);
+	for (int q = 0; q < ref_num; q++) {
+		const Point2f *pt = &ref_points[4 * q];
+		ref_order[q] = q;
+		ref_left[q] = MIN4(pt[0].x, pt[1].x, pt[2].x, pt[3].x);
+	}
+	stable_sort(ref_order.begin(), ref_order.end(), [&ref_left](int a, int b) {
+		return (ref_left[a] < ref_left[b]);
+	});
+
+	/*********************** Slide the shorter sequence along the longer one ***************************/
+	int len = MIN(num, ref_num);
+	int windows = abs(num - ref_num) + 1;
+	int best_offset = -1;
+	double best_error = DBL_MAX, second_error = DBL_MAX;
+	vector<Point2f> src(4 * len), dst(4 * len), proj;
+
+	for (int offset = 0; offset < windows; offset++) {
+		for (int i = 0; i < len; i++) {
+			int img_q = (num > ref_num) ? i + offset : i;
+			int ref_q = ref_order[(num > ref_num) ? i : i + offset];
+			for (int c = 0; c < 4; c++) {
+				src[4 * i + c] = ref_points[4 * ref_q + c];
+				dst[4 * i + c] = feature_points[4 * img_q + c];
+			}
+		}
+
+		Mat H = findHomography(src, dst, 0);
+		if (H.empty())
+			continue;
+		perspectiveTransform(src, proj, H);
+
+		double error = 0;
+		for (uint i = 0; i < proj.size(); i++) {
+			Point2f d = proj[i] - dst[i];
+			error += d.dot(d);
+		}
+		error = sqrt(error / proj.size());
+
+		if (error < best_error) {
+			second_error = best_error;
+			best_error = error;
+			best_offset = offset;
+		} else if (error < second_error) {
+			second_error = error;
 		}
 	}
-}
\ No newline at end of file
+
+	if ((best_offset < 0) || (best_error > max_error) ||
+		(second_error < ASSOC_AMBIGUITY * best_error + 0.5))
+		return (0);
+
+	for (int i = 0; i < len; i++) {
+		int img_q = (num > ref_num) ? i + best_offset : i;
+		ref_quads[img_q] = ref_order[(num > ref_num) ? i : i + best_offset];
+	}
+	return (len);
+}
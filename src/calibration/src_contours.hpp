@@ -30,9 +30,11 @@
  * Includes
  *******************************************************************************************/
 #include <iostream>
+#include <cfloat>
+#include <algorithm>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
-#include <opencv2/imgproc/imgproc_c.h>
+#include <opencv2/calib3d/calib3d.hpp>
 
 using namespace cv;
 using namespace std;
@@ -41,7 +43,10 @@ using namespace std;
  * Macros
  *******************************************************************************************/
 #define MAX_CONTOUR_APPROX  7
-#define CONTOURS_NUM 4
+#define MAX_CONTOUR_APPROX_FISHEYE  12 // Template edges are curved in the fisheye image
+#define CONTOURS_NUM 4 // Default number of template quads
+#define ASSOC_AMBIGUITY 2.0 // Min ratio of the second best to the best association error
+#define THRESHOLD_PASSES 6 // Number of adaptive threshold block size/offset combinations
 
 #define MIN4(a,b,c,d)  (((a <= b) & (a <= c) & (a <= d)) ? (a) : \
 						(((b <= c) & (b <= d)) ? (b) : \
@@ -54,10 +59,37 @@ using namespace std;
 /*******************************************************************************************
  * Types
  *******************************************************************************************/
-struct CvContourEx
+/* Quadrangle approximated from the found contour */
+struct Quad
 {
-    CV_CONTOUR_FIELDS()
-    int counter;
+	Point pt[4];	/* Quad corners in the contour order. Objects are counter-clockwise, and holes are clockwise */
+	bool hole;		/* The source contour is a hole */
+	int contour;	/* Index of the source contour in ContourArena::contours */
+	int parent;		/* Index of the parent contour in ContourArena::contours (-1 if there is no parent) */
+	Rect box;		/* Bounding box of the quad corners */
+};
+
+/*******************************************************************************************
+ * Classes
+ *******************************************************************************************/
+/* ContourArena class - scratch memory of the contour search. The buffers keep their capacity between
+ * the searches, so a long-living arena does not allocate memory after the first frames. */
+class ContourArena {
+public:
+	Mat padded;							/* Input image with replicated border */
+	Mat integral;						/* Integral image of the padded input image */
+	Mat coarse;							/* Downsampled input image */
+	Mat coarse_integral;				/* Integral image of the padded downsampled image */
+	Mat threshold;						/* Thresholded image */
+	vector< vector<Point> > contours;	/* Contours found in the thresholded image */
+	vector<Vec4i> hierarchy;			/* Contours hierarchy */
+	vector<Point> approx[2];			/* Polygon approximation buffers */
+	vector<Quad> quads;					/* Found quads */
+	vector<int> quad_index;				/* Quad index of each contour (-1 if contour is not a quad) */
+	vector<int> grid_start;				/* Start of each grid cell in grid_items (FilterContours index) */
+	vector<int> grid_items;				/* Quads which bounding boxes overlap grid cells */
+	vector<int> visited;				/* Last quad which was tested against the quad */
+	vector<bool> keep;					/* Quads which are kept by FilterContours */
 };
 
 /*******************************************************************************************
@@ -68,24 +100,38 @@ struct CvContourEx
  * @brief  			Search contours in input image
  *
  * @param  	in		const Mat &img - input image
- * 			in/out	CvSeq** root - sequence of contours
- * 			in		CvMemStorage *storage - memory storage
+ * 			in/out	ContourArena &arena - scratch memory of the search. Found quads are returned in arena.quads
  *			in		int min_size - empiric bound for minimal allowed perimeter for contour squares
+ *			in		int max_approx - maximal accuracy of polygon approximation
+ *			in		int quads_num - number of quads in the template
  *
  * @return 			Functions returns the number of contours which were found.
  *
  * @remarks 		The function applies adaptive threshold on input image and searches contours in image.
- * 					If 4 contours are found then function has been terminated. Otherwise it changes block size
- * 					for adaptive threshold and tries again.
+ * 					If quads_num contours are found then function has been terminated. Otherwise it changes
+ * 					block size for adaptive threshold and tries again. If no threshold gives quads_num contours,
+ * 					then the result of the threshold with most contours not exceeding quads_num is returned
+ * 					(the template can be partially visible).
+ * 					The local means of all block sizes are taken from one integral image. Each threshold is tried
+ * 					on the downsampled image first: as soon as it gives exactly quads_num quads there, the same
+ * 					threshold is checked on the input image, so the common case costs one coarse and one full
+ * 					resolution pass. If no threshold succeeded, the other thresholds which give some quads on
+ * 					the downsampled image are checked on the input image, and then the thresholds which give no
+ * 					quads there: thin template borders or quads near the image border can be lost by the
+ * 					downsampling, so every threshold keeps its full resolution pass when the template is not
+ * 					found at once.
+ * 					For the fisheye image use MAX_CONTOUR_APPROX_FISHEYE: the template edges are curved there
+ * 					and a coarser approximation is required to reduce them to quadrangles.
  *
  **************************************************************************************************************/
-extern int GetContours(const Mat &img, CvSeq** root, CvMemStorage *storage, int min_size);
+extern int GetContours(const Mat &img, ContourArena &arena, int min_size,
+						int max_approx = MAX_CONTOUR_APPROX, int quads_num = CONTOURS_NUM);
 
 /**************************************************************************************************************
  *
  * @brief  			Sort contours from left to right
  *
- * @param  	in		CvSeq** root - sequence of contours
+ * @param  	in/out	vector<Quad> &quads - found quads
  *
  * @return 			-
  *
@@ -93,13 +139,13 @@ extern int GetContours(const Mat &img, CvSeq** root, CvMemStorage *storage, int
  * 					according to this value from left to right.
  *
  **************************************************************************************************************/
-extern void SortContours(CvSeq** root);
+extern void SortContours(vector<Quad> &quads);
 
 /**************************************************************************************************************
  *
  * @brief  			Generate vector of contour points in proper order.
  *
- * @param  	in		CvSeq** root - sequence of contours
+ * @param  	in		const vector<Quad> &quads - found quads
  * 			out		vector<Point2f> * feature_points
  * 			in		Point2f shift
  *
@@ -109,37 +155,64 @@ extern void SortContours(CvSeq** root);
  * 					coordinates and push the corners to the feature_points array in proper order.
  *
  **************************************************************************************************************/
-extern void GetFeaturePoints(CvSeq** root, vector<Point2f> &feature_points, Point2f shift);
+extern void GetFeaturePoints(const vector<Quad> &quads, vector<Point2f> &feature_points, Point2f shift);
 
 /**************************************************************************************************************
  *
  * @brief  			Filter found contours.
  *
- * @param  	in/out	CvSeq** root - sequence of contours
+ * @param  	in/out	ContourArena &arena - scratch memory of the search. Found quads are filtered in arena.quads
  *
  * @return 			-
  *
- * @remarks 		The function checks all contours from the input sequence and removes contours
- * 					which are not located inside another sequence contour or which do not contain
- * 					another sequence contour.
+ * @remarks 		The function checks all contours from the input vector and removes contours
+ * 					which are not located inside another vector contour or which do not contain
+ * 					another vector contour. The order of the remaining contours is kept.
+ * 					The hole contours are tested against their parent contours first. The rest of pairs is
+ * 					taken from the uniform grid of quads bounding boxes, and only the pairs with nested
+ * 					bounding boxes are tested.
  *
  **************************************************************************************************************/
-extern void FilterContours(CvSeq** root);
+extern void FilterContours(ContourArena &arena);
 
 /**************************************************************************************************************
  *
- * @brief  			Convert contours sequence into the vector of points.
+ * @brief  			Convert contours vector into the vector of points.
  *
- * @param  	in		CvSeq** root - sequence of contours
+ * @param  	in		const vector<Quad> &quads - found quads
  * 			out		vector<Point2f> * feature_points
  * 			in		Point2f shift
  *
  * @return 			-
  *
- * @remarks 		The function convert sequence of contours into points array. The shift is applied on corners
+ * @remarks 		The function convert vector of contours into points array. The shift is applied on corners
  * 					coordinates.
  *
  **************************************************************************************************************/
-extern void sec2vector(CvSeq** root, vector<Point2f> &feature_points, Point2f shift);
+extern void sec2vector(const vector<Quad> &quads, vector<Point2f> &feature_points, Point2f shift);
+
+/**************************************************************************************************************
+ *
+ * @brief  			Associate found quads with template quads.
+ *
+ * @param  	in		const vector<Point2f> &feature_points - corners of found quads sorted by SortContours and
+ * 					GetFeaturePoints (4 corners per quad)
+ * 			in		const vector<Point2f> &ref_points - corners of template quads (4 corners per quad)
+ * 			out		vector<int> &ref_quads - template quad index for each found quad, -1 if quad is not associated
+ * 			in		double max_error - max RMS error of the template to image homography (pixels)
+ *
+ * @return 			Functions returns the number of associated quads.
+ *
+ * @remarks 		Template quads are sorted from left to right as the found quads are. The shorter of two
+ * 					sequences is slid along the longer one, so quads missing at the template ends or extra quads
+ * 					at the image ends are tolerated. Each window is checked by homography from template corners
+ * 					to image corners, the window with the smallest error is returned. Sorting costs O(n log n),
+ * 					and the number of checked windows is the difference of quads numbers plus one.
+ * 					If another window fits almost as well (the template is repeated), then the association is
+ * 					ambiguous and 0 is returned.
+ *
+ **************************************************************************************************************/
+extern int AssociateContours(const vector<Point2f> &feature_points, const vector<Point2f> &ref_points,
+							 vector<int> &ref_quads, double max_error);
 
 #endif /* SRC_CONTOURS_HPP_ */
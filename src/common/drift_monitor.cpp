@@ -0,0 +1,247 @@
+#include "drift_monitor.h"
+#include "calibration/grid.hpp"
+#include "calibration/masks.hpp"
+
+#include <QtConcurrent>
+#include <QElapsedTimer>
+#include <QDebug>
+
+#define DRIFT_MIN_PATCH 16      // Min size of an overlap patch (pixels)
+#define DRIFT_MAX_MOTION 1.0    // Max shift of a patch between two checks of a still scene (pixels)
+#define DRIFT_MIN_RESPONSE 0.05 // Min phase correlation peak of a textured overlap
+
+DriftMonitor::DriftMonitor(std::vector<v4l2Camera> *v4lCams, const std::vector<CameraCalibrator *> *cams,
+                           const Param &p, QObject *parent) :
+    QObject(parent),
+    cameras(v4lCams),
+    calibs(cams),
+    param(p)
+{
+    pool.setMaxThreadCount(1);
+    timer.setSingleShot(true);
+    connect(&timer, &QTimer::timeout, this, &DriftMonitor::checkNext);
+    connect(&watcher, &QFutureWatcher<void>::finished, this, &DriftMonitor::checkFinished);
+
+    int num = std::min(cameras->size(), calibs->size());
+    overlaps.resize(num);
+    for(int i = 0; i < num; i++) {
+        overlaps[i].cam[0] = i;
+        overlaps[i].cam[1] = NEXT(i, num - 1);
+    }
+    resetRefs.resize(num, false);
+    drift.resize(num, 0);
+    detected.resize(num, false);
+}
+
+DriftMonitor::~DriftMonitor()
+{
+    stop();
+}
+
+void DriftMonitor::start()
+{
+    for(uint i = 0; i < overlaps.size(); i++)
+        resetReference(i);
+    current = 0;
+    running = true;
+    timer.start(param.minInterval);
+}
+
+void DriftMonitor::stop()
+{
+    running = false;
+    timer.stop();
+    watcher.waitForFinished();
+}
+
+void DriftMonitor::resume()
+{
+    running = true;
+    timer.start(param.minInterval);
+}
+
+void DriftMonitor::resetReference(int index)
+{
+    // Both overlaps of the camera are rebuilt with its new pose, not while the check is running
+    int num = overlaps.size();
+    resetRefs.at(index) = true;
+    resetRefs.at(PREV(index, num - 1)) = true;
+    drift.at(index) = 0;
+    detected.at(index) = false;
+}
+
+void DriftMonitor::checkNext()
+{
+    if(overlaps.size() < 2)
+        return;
+
+    // Calibrators are changed on the GUI thread only, so the maps are built here
+    if(resetRefs[current]) {
+        buildOverlap(current);
+        resetRefs[current] = false;
+    }
+    watcher.setFuture(QtConcurrent::run(&pool, this, &DriftMonitor::checkOverlap, current));
+}
+
+void DriftMonitor::checkFinished()
+{
+    if(!running)
+        return;
+
+    int num = overlaps.size();
+    for(int side = 0; side < 2; side++) {
+        // A drifted camera moves both its overlaps, a drifted neighbour only one of them
+        int index = overlaps[current].cam[side];
+        drift[index] = std::min(overlaps[index].shift, overlaps[PREV(index, num - 1)].shift);
+        emit driftChanged(index, drift[index]);
+
+        if((drift[index] > param.threshold) && !detected[index]) {
+            detected[index] = true;
+            qInfo() << "camera" << index << "drift" << drift[index] << "pixels";
+            emit driftDetected(index, drift[index]);
+        }
+    }
+
+    // Keep the average load inside the cpu budget
+    current = (current + 1) % num;
+    int interval = (int)(jobTime / 1000000 / param.cpuBudget);
+    timer.start(std::max(param.minInterval, interval));
+}
+
+void DriftMonitor::checkOverlap(int index)
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    Overlap &ov = overlaps[index];
+    cv::Mat patch[2];
+    if(!ov.map[0].empty() && (snapshot(ov, patch) == 0)) {
+        if((window.size() != patch[0].size()))
+            cv::createHanningWindow(window, patch[0].size(), CV_32F);
+
+        // The cameras are not synchronized, so the overlap is measured only in a still scene
+        bool still = true;
+        for(int side = 0; side < 2; side++) {
+            if(ov.prev[side].empty() ||
+                    (cv::norm(cv::phaseCorrelate(ov.prev[side], patch[side], window)) > DRIFT_MAX_MOTION))
+                still = false;
+            ov.prev[side] = patch[side];
+        }
+
+        double response = 0;
+        cv::Point2d shift;
+        if(still)
+            shift = cv::phaseCorrelate(patch[0], patch[1], window, &response);
+        if(response > DRIFT_MIN_RESPONSE) {
+            if(!ov.hasRef) {
+                ov.ref = shift;
+                ov.hasRef = true;
+            }
+            ov.shift = cv::norm(shift - ov.ref);
+        }
+    }
+
+    jobTime = elapsed.nsecsElapsed();
+}
+
+int DriftMonitor::buildOverlap(int index)
+{
+    Overlap &ov = overlaps[index];
+    for(int side = 0; side < 2; side++) {
+        ov.map[side].release();
+        ov.prev[side].release();
+    }
+    ov.hasRef = false;
+    ov.shift = 0;
+
+    cv::Mat map[2], valid[2];
+    for(int side = 0; side < 2; side++)
+        topMap(calibs->at(ov.cam[side]), map[side], valid[side]);
+
+    // The patch is centred where the overlap is the widest
+    cv::Mat both, dist;
+    cv::bitwise_and(valid[0], valid[1], both);
+    cv::distanceTransform(both, dist, cv::DIST_L2, 3);
+    double max_dist;
+    cv::Point centre;
+    cv::minMaxLoc(dist, NULL, &max_dist, NULL, &centre);
+    int half = std::min(param.patchSize / 2, (int)max_dist);
+    if(2 * half < DRIFT_MIN_PATCH) {
+        qInfo() << "cameras" << ov.cam[0] << ov.cam[1] << "have no overlap to check the drift";
+        return -1;
+    }
+
+    cv::Rect roi(centre.x - half, centre.y - half, 2 * half, 2 * half);
+    for(int side = 0; side < 2; side++)
+        map[side](roi).copyTo(ov.map[side]);
+    return 0;
+}
+
+void DriftMonitor::topMap(CameraCalibrator *cam, cv::Mat &map, cv::Mat &valid)
+{
+    int n = param.topSize;
+    double px = 2.0 * param.extent / n;
+    std::vector<cv::Point3f> p3d(n * n);
+    for(int v = 0; v < n; v++) {
+        for(int u = 0; u < n; u++) {
+            cv::Point3f g((u + 0.5) * px - param.extent, param.extent - (v + 0.5) * px, 0);
+            p3d[v * n + u] = rotatePoint(cam->index, g); // Ground of the camera template
+        }
+    }
+
+    cv::Mat rvec = cam->getRvec();
+    cv::Mat tvec = cam->getTvec();
+    if(rvec.empty() || tvec.empty()) {
+        valid = cv::Mat::zeros(n, n, CV_8UC1);
+        return;
+    }
+
+    std::vector<cv::Point2f> p2d;
+    cv::projectPoints(p3d, rvec, tvec, cam->getK(), cam->getDistCoeffs(), p2d);
+
+    // Ground behind the camera is projected too, move it out of the image
+    cv::Mat R;
+    cv::Rodrigues(rvec, R);
+    R.convertTo(R, CV_64F);
+    tvec.convertTo(tvec, CV_64F);
+    for(uint i = 0; i < p3d.size(); i++) {
+        if(R.at<double>(2, 0) * p3d[i].x + R.at<double>(2, 1) * p3d[i].y +
+                R.at<double>(2, 2) * p3d[i].z + tvec.at<double>(2) <= 0)
+            p2d[i] = cv::Point2f(-1, -1);
+    }
+
+    // Undistorted image coordinates are mapped to the fisheye frame by the defisheye LUT
+    cv::Mat undist = cv::Mat(p2d).reshape(2, n);
+    cv::Mat xy[2];
+    cv::remap(cam->xmap, xy[0], undist, cv::noArray(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(-1));
+    cv::remap(cam->ymap, xy[1], undist, cv::noArray(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(-1));
+    cv::merge(xy, 2, map);
+    cv::remap(cam->validMask, valid, undist, cv::noArray(), cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0));
+    cv::compare(valid, 255, valid, cv::CMP_EQ);
+}
+
+int DriftMonitor::snapshot(const Overlap &ov, cv::Mat *out)
+{
+    // Both patches are taken under one lock to keep them close in time, the remap
+    // of the small patches is cheap, so the frame delivery is not delayed
+    cv::Mat small[2];
+    pthread_mutex_lock(&v4l2Camera::th_mutex);
+    for(int side = 0; side < 2; side++) {
+        v4l2Camera &cam = cameras->at(ov.cam[side]);
+        if(cam.fill_buffer_inx < 0) {
+            pthread_mutex_unlock(&v4l2Camera::th_mutex);
+            return -1;
+        }
+        cv::Mat rgba(cam.getHeight(), cam.getWidth(), CV_8UC4, (char*)cam.buffers[cam.fill_buffer_inx].start);
+        cv::remap(rgba, small[side], ov.map[side], cv::noArray(), cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+    }
+    pthread_mutex_unlock(&v4l2Camera::th_mutex);
+
+    for(int side = 0; side < 2; side++) {
+        cv::Mat gray;
+        cv::cvtColor(small[side], gray, CV_RGBA2GRAY);
+        cv::GaussianBlur(gray, gray, cv::Size(3, 3), 0);
+        gray.convertTo(out[side], CV_32F);
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+#ifndef DRIFT_MONITOR_H
+#define DRIFT_MONITOR_H
+
+#include <QObject>
+#include <QTimer>
+#include <QThreadPool>
+#include <QFutureWatcher>
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "common/src_v4l2.hpp"
+#include "calibration/cameracalibrator.h"
+
+/* Background check of camera alignment on the live stream.
+ * Neighbouring cameras (NEXT/PREV) see the same ground in their overlap. Both cameras render a small
+ * top view patch of the overlap with the calibration of the last reset, and the shift between the two
+ * patches is measured by phase correlation. The ground moves alike in both patches when the vehicle
+ * moves, so the shift changes only when a camera moves relative to its neighbour. The drift of a camera
+ * is the smaller change of the shifts of its two overlaps (top view pixels), so a drifted neighbour
+ * does not move the camera. Overlaps are checked one per timer tick.
+ * The cameras are not synchronized, so an overlap is not measured while its patches move between
+ * checks (the vehicle or objects move), and an overlap without ground texture gives no measurement. */
+class DriftMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Param {
+        float cpuBudget = 0.05;     // Share of one core used by the monitor
+        int minInterval = 1000;     // Minimal interval between checks (ms)
+        float threshold = 4;        // Drift which is reported as detected (top view pixels)
+        float extent = 3;           // Half size of the top view in template units
+        int topSize = 128;          // Size of the top view (pixels)
+        int patchSize = 64;         // Max size of the overlap patches (pixels)
+    };
+
+    DriftMonitor(std::vector<v4l2Camera> *v4lCams, const std::vector<CameraCalibrator *> *cams,
+                 const Param &p, QObject *parent = 0);
+    ~DriftMonitor();
+
+    void start();
+    void stop();
+    void resume();                  // Continues after stop() with the current references
+    void resetReference(int index);
+    void setExtent(float value) { param.extent = value; }
+    float getDrift(int index) const { return drift.at(index); }
+
+signals:
+    void driftChanged(int index, float drift);
+    void driftDetected(int index, float drift);
+
+private slots:
+    void checkNext();
+    void checkFinished();
+
+private:
+    struct Overlap {
+        int cam[2];                 // Camera and its next camera
+        cv::Mat map[2];             // Fisheye coordinates of the patch pixels, empty if no overlap
+        cv::Mat prev[2];            // Patches of the last check
+        cv::Point2d ref;            // Shift of the patches after the reset
+        bool hasRef = false;
+        float shift = 0;            // Change of the shift since the reset (top view pixels)
+    };
+
+    std::vector<v4l2Camera> *cameras;
+    const std::vector<CameraCalibrator *> *calibs;
+    Param param;
+    QTimer timer;
+    QThreadPool pool;               // Single worker, calibration jobs use the global pool
+    QFutureWatcher<void> watcher;
+
+    std::vector<Overlap> overlaps;  // Overlap of camera i and its next camera
+    std::vector<bool> resetRefs;    // Overlap is rebuilt before the next check
+    std::vector<float> drift;
+    std::vector<bool> detected;
+    cv::Mat window;                 // Hanning window of phase correlation
+    int current = 0;                // Overlap which is checked
+    bool running = false;
+    qint64 jobTime = 0;             // Duration of the last check (ns)
+
+    void checkOverlap(int index);
+    int buildOverlap(int index);
+    void topMap(CameraCalibrator *cam, cv::Mat &map, cv::Mat &valid);
+    int snapshot(const Overlap &ov, cv::Mat *out);
+};
+
+#endif // DRIFT_MONITOR_H
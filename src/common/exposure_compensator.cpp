@@ -128,6 +128,7 @@ void Compensator::feed(vector<CameraCalibrator*> &cameras, vector< vector<Point3
  * @brief  			Save compensator info
  *
  * @param  	in		char* path - path name
+ * 			in		vector<bool> &update - grids which have to be regenerated (empty vector - all grids)
  *
  * @return 			-
  *
@@ -139,7 +140,7 @@ void Compensator::feed(vector<CameraCalibrator*> &cameras, vector< vector<Point3
  *					regions from frame buffer when it calculates exposure correction coefficients.
  *
  **************************************************************************************************************/
-int Compensator::save(const char* path)
+int Compensator::save(const char* path, const vector<bool> &update)
 {
 	double x_gain = 2 * cinf.radius;
 	double y_gain = 2 * cinf.radius * cinf.mask.rows / cinf.mask.cols;
@@ -156,19 +157,30 @@ int Compensator::save(const char* path)
 
 	for(uint i = 0; i < cinf.roi.size(); i++)
 	{
+		if((i < update.size()) && !update[i]) // The grid and the overlap regions around it have not been changed
+			continue;
+
 		char file_name[50], file_name_roi[50];
 		sprintf(file_name, "./array%d", i + 1);
 		sprintf(file_name_roi, "%s/array%d", path, i + 1);
 
-		ifstream ifs_ref(file_name);
-		if(ifs_ref) // // The file exists, and is open for input
+		MeshFile grid;
+		if(grid.open(file_name) == 0) // The file exists, and is open for input
 		{
-			ofstream outC; // Output file
-			outC.open(file_name_roi, std::ofstream::out | std::ofstream::trunc); // Any contents that existed in the file before it is open are discarded.
+			MeshWriter grid_roi; // Output grid
+			vector<int> remap(grid.getVertexNum(), -1); // Indices of input grid vertices in the output grid
 
-			float vx[3], vy[3], vz[3], tx[3], ty[3];
-			while (ifs_ref >> vx[0] >> vy[0] >> vz[0] >> tx[0] >> ty[0] >> vx[1] >> vy[1] >> vz[1] >> tx[1] >> ty[1] >> vx[2] >> vy[2] >> vz[2] >> tx[2] >> ty[2] ) // Read triangle
+			for(int t = 0; t < grid.getTriangleNum(); t++) // Read triangle
 			{
+				int idx[3];
+				float vx[3], vy[3], vz[3], tx[3], ty[3];
+				for(int j = 0; j < 3; j++)
+				{
+					idx[j] = grid.getTriangleVertex(t, j);
+					const float *v = grid.getVertex(idx[j]);
+					vx[j] = v[0]; vy[j] = v[1]; vz[j] = v[2]; tx[j] = v[3]; ty[j] = v[4];
+				}
+
 				if((vz[0] == 0) && (vz[1] == 0) && (vz[2] == 0))
 				{
 					double x0 = (vx[0] + cinf.radius) * height;
@@ -192,14 +204,17 @@ int Compensator::save(const char* path)
 
 						if(vertexes_sum == 765) // 3 * 255
 						{
-							outC << vx[0] / x_gain << " " << vy[0] / y_gain << " " << vz[0] << " " << tx[0] << " " << ty[0] << endl;
-							outC << vx[1] / x_gain << " " << vy[1] / y_gain << " " << vz[1] << " " << tx[1] << " " << ty[1] << endl;
-							outC << vx[2] / x_gain << " " << vy[2] / y_gain << " " << vz[2] << " " << tx[2] << " " << ty[2] << endl;
+							for(int j = 0; j < 3; j++)
+							{
+								if(remap[idx[j]] < 0)
+									remap[idx[j]] = grid_roi.addVertex(Point3f(vx[j] / x_gain, vy[j] / y_gain, vz[j]), Point2f(tx[j], ty[j]));
+							}
+							grid_roi.addTriangle(remap[idx[0]], remap[idx[1]], remap[idx[2]]);
 						}
 					}
 				}
 			}
-			outC.close(); // Close file
+			grid_roi.save(file_name_roi); // Save grid
 		}
 		else
 		{
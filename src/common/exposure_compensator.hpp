@@ -38,6 +38,7 @@
 
 #include "calibration/cameracalibrator.h"
 #include "lines.hpp"
+#include "mesh_file.h"
 #define CAMERA_HPP_EXIST
 
 
@@ -133,6 +134,7 @@ class Compensator {
 		 * @brief  			Save compensator info
 		 *
 		 * @param  	in		char* path - path name
+		 * 			in		vector<bool> &update - grids which have to be regenerated (empty vector - all grids)
 		 *
 		 * @return 			-
 		 *
@@ -144,7 +146,7 @@ class Compensator {
 		 *					regions from frame buffer when it calculates exposure correction coefficients.
 		 *
 		 **************************************************************************************************************/
-        int save(const char *path);
+        int save(const char *path, const vector<bool> &update = vector<bool>());
 		/**************************************************************************************************************
 		 *
 		 * @brief  			Load compensator info
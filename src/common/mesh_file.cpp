@@ -0,0 +1,437 @@
+#include "mesh_file.h"
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+uint32_t meshChecksum(const void *data, size_t size, uint32_t hash)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// IEEE 754 binary16, round to nearest even
+static uint16_t floatToHalf(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = (x >> 16) & 0x8000;
+    int exp = (int)((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+
+    if(((x >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mant ? 0x200 : 0);     // Inf, NaN
+    if(exp >= 0x1f)
+        return sign | 0x7c00;                           // Overflow
+    if(exp <= 0) {                                      // Subnormal
+        if(exp < -10)
+            return sign;
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        uint32_t half = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if((rem > mid) || ((rem == mid) && (half & 1)))
+            half++;
+        return sign | half;
+    }
+
+    uint32_t half = (exp << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    if((rem > 0x1000) || ((rem == 0x1000) && (half & 1)))
+        half++;                                         // Carry to the exponent is correct rounding
+    return sign | half;
+}
+
+static float halfToFloat(uint16_t h)
+{
+    int exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    float f;
+    if(exp == 0)
+        f = ldexpf((float)mant, -24);
+    else if(exp == 0x1f)
+        f = mant ? NAN : INFINITY;
+    else
+        f = ldexpf((float)(mant | 0x400), exp - 25);
+    return (h & 0x8000) ? -f : f;
+}
+
+static uint16_t floatToUnorm16(float f)
+{
+    return (uint16_t)lrintf(std::min(std::max(f, 0.0f), 1.0f) * 65535.0f);
+}
+
+static void dequantizeVertex(const char *src, float *dst)
+{
+    const uint16_t *q = (const uint16_t *)src;
+    dst[0] = halfToFloat(q[0]);
+    dst[1] = halfToFloat(q[1]);
+    dst[2] = halfToFloat(q[2]);
+    dst[3] = q[4] / 65535.0f;
+    dst[4] = q[5] / 65535.0f;
+}
+
+int MeshWriter::addVertex(const cv::Point3f &v, const cv::Point2f &t)
+{
+    data.push_back(v.x);
+    data.push_back(v.y);
+    data.push_back(v.z);
+    data.push_back(t.x);
+    data.push_back(t.y);
+    return getVertexNum() - 1;
+}
+
+int MeshWriter::addVertex(const float *v)
+{
+    data.insert(data.end(), v, v + MESH_COMPONENTS);
+    return getVertexNum() - 1;
+}
+
+void MeshWriter::addTriangle(int v1, int v2, int v3)
+{
+    indices.push_back(v1);
+    indices.push_back(v2);
+    indices.push_back(v3);
+}
+
+// Copy the triangle t of src, remap holds the index of each src vertex in this mesh (-1 if not copied yet)
+void MeshWriter::addTriangle(const MeshFile &src, int t, std::vector<int> &remap)
+{
+    remap.resize(src.getVertexNum(), -1);
+    for(int j = 0; j < 3; j++) {
+        int v = src.getTriangleVertex(t, j);
+        if(remap[v] < 0)
+            remap[v] = addVertex(src.getVertex(v));
+        indices.push_back(remap[v]);
+    }
+}
+
+// Append vertices and triangles of src, the indices are shifted past the vertices of this mesh
+void MeshWriter::append(const MeshWriter &src)
+{
+    uint32_t offset = getVertexNum();
+    data.insert(data.end(), src.data.begin(), src.data.end());
+    indices.reserve(indices.size() + src.indices.size());
+    for(uint32_t index : src.indices)
+        indices.push_back(index + offset);
+}
+
+// Reorder triangles for the post-transform vertex cache and vertices in the order of the first use
+void MeshWriter::optimize()
+{
+    if(indices.empty())
+        return;
+
+    optimizeVertexCache(indices, getVertexNum());
+
+    std::vector<int> remap;
+    int num = optimizeVertexFetch(indices, getVertexNum(), remap);
+    std::vector<float> out(num * MESH_COMPONENTS);
+    for(size_t v = 0; v < remap.size(); v++) {
+        if(remap[v] >= 0)
+            std::copy(&data[v * MESH_COMPONENTS], &data[(v + 1) * MESH_COMPONENTS], &out[remap[v] * MESH_COMPONENTS]);
+    }
+    data.swap(out);
+}
+
+float MeshWriter::getAcmr() const
+{
+    return meshAcmr(indices, getVertexNum());
+}
+
+size_t MeshWriter::getSize() const
+{
+    size_t index_size = (getVertexNum() <= 0x10000) ? sizeof(uint16_t) : sizeof(uint32_t);
+    return data.size() * sizeof(float) + indices.size() * index_size;
+}
+
+// Quantize the vertices and validate them against the float vertices
+bool MeshWriter::quantizeVertices(std::vector<char> &out, const std::string &path) const
+{
+    int num = getVertexNum();
+    out.assign((size_t)num * MESH_QUANTIZED_STRIDE, 0);
+
+    float pos_min = INFINITY, pos_max = -INFINITY, pos_error = 0, tex_error = 0;
+    for(int i = 0; i < num; i++) {
+        const float *v = &data[i * MESH_COMPONENTS];
+        uint16_t *q = (uint16_t *)&out[i * MESH_QUANTIZED_STRIDE];
+        q[0] = floatToHalf(v[0]);
+        q[1] = floatToHalf(v[1]);
+        q[2] = floatToHalf(v[2]);
+        q[4] = floatToUnorm16(v[3]);
+        q[5] = floatToUnorm16(v[4]);
+
+        float d[MESH_COMPONENTS];
+        dequantizeVertex((const char *)q, d);
+        for(int j = 0; j < 3; j++) {
+            pos_min = std::min(pos_min, v[j]);
+            pos_max = std::max(pos_max, v[j]);
+            pos_error = std::max(pos_error, std::fabs(d[j] - v[j]));
+        }
+        for(int j = 3; j < 5; j++)
+            tex_error = std::max(tex_error, std::fabs(d[j] - v[j]));
+    }
+
+    // NaN errors (half overflow) fail the checks as well
+    float extent = std::max(pos_max - pos_min, 1e-6f);
+    if(!(pos_error <= MESH_QUANTIZE_ERROR * extent) || !(tex_error <= 1.0f / 65535.0f)) {
+        std::cout << "Mesh " << path << " is saved with float vertices, quantization error "
+                  << pos_error << " (position), " << tex_error << " (texcoord)" << std::endl;
+        return false;
+    }
+    std::cout << "Mesh " << path << " is quantized, max error " << pos_error << " of extent " << extent
+              << " (position), " << tex_error << " (texcoord)" << std::endl;
+    return true;
+}
+
+int MeshWriter::save(const std::string &path, bool quantize) const
+{
+    MeshHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MESH_MAGIC;
+    header.version = MESH_VERSION;
+    header.vertexNum = getVertexNum();
+
+    std::vector<char> quantized;
+    const char *vertex_data = (const char *)data.data();
+    if(quantize && quantizeVertices(quantized, path)) {
+        vertex_data = quantized.data();
+        header.stride = MESH_QUANTIZED_STRIDE;
+        header.attr[0] = {3, MESH_HALF, 0};                         // Position
+        header.attr[1] = {2, MESH_UNORM16, 4 * sizeof(uint16_t)};   // Texcoord
+    } else {
+        header.stride = MESH_COMPONENTS * sizeof(float);
+        header.attr[0] = {3, MESH_FLOAT, 0};                        // Position
+        header.attr[1] = {2, MESH_FLOAT, 3 * sizeof(float)};        // Texcoord
+    }
+    header.dataOffset = MESH_ALIGN;
+    header.dataSize = header.vertexNum * header.stride;
+
+    // 16 bit indices are used if the vertices allow it
+    std::vector<uint16_t> indices16;
+    const char *index_data = (const char *)indices.data();
+    size_t index_size = indices.size() * sizeof(uint32_t);
+    header.indexNum = indices.size();
+    header.indexType = indices.empty() ? MESH_NONE : MESH_UINT32;
+    header.indexOffset = header.dataOffset + header.dataSize;
+    if(!indices.empty() && (getVertexNum() <= 0x10000)) {
+        indices16.assign(indices.begin(), indices.end());
+        index_data = (const char *)indices16.data();
+        index_size = indices16.size() * sizeof(uint16_t);
+        header.indexType = MESH_UINT16;
+    }
+
+    header.checksum = meshChecksum(vertex_data, header.dataSize);
+    header.checksum = meshChecksum(index_data, index_size, header.checksum);
+
+    // The file is written aside and renamed, so a render which maps the old file keeps valid data
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp.c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+    if(!out) {
+        std::cout << "Mesh has not been saved. Can not open " << tmp << std::endl;
+        return -1;
+    }
+
+    char pad[MESH_ALIGN] = {0};
+    out.write((const char *)&header, sizeof(header));
+    out.write(pad, MESH_ALIGN - sizeof(header));
+    out.write(vertex_data, header.dataSize);
+    out.write(index_data, index_size);
+    out.close();
+
+    // open() does not read the data, so the written data is verified here
+    MeshFile written;
+    bool verified = out && (written.open(tmp) == 0) && (written.verify() == 0);
+    written.close();
+
+    if(!verified || rename(tmp.c_str(), path.c_str())) {
+        std::cout << "Mesh has not been saved to " << path << std::endl;
+        remove(tmp.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int MeshFile::open(const std::string &path)
+{
+    close();
+    filePath = path;
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        std::cout << "Mesh file " << path << " not found" << std::endl;
+        return -1;
+    }
+
+    struct stat st;
+    if((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(MeshHeader))) {
+        ::close(fd);
+        return openText(path);
+    }
+
+    mapSize = st.st_size;
+    map = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(map == MAP_FAILED) {
+        map = NULL;
+        mapSize = 0;
+        return openText(path);
+    }
+
+    const MeshHeader *header = (const MeshHeader *)map;
+    if(header->magic != MESH_MAGIC) {
+        close();
+        return openText(path);
+    }
+
+    if(check(header, mapSize)) {
+        close();
+        return -1;
+    }
+
+    data = (const char *)map + header->dataOffset;
+    vertexNum = header->vertexNum;
+    stride = header->stride;
+    quantized = (header->attr[0].type == MESH_HALF);
+    if(!quantized)
+        vertices = (const float *)data;
+    if(header->indexNum) {
+        indices = (const char *)map + header->indexOffset;
+        indexNum = header->indexNum;
+        indexType = header->indexType;
+    }
+    return 0;
+}
+
+void MeshFile::close()
+{
+    if(map)
+        munmap(map, mapSize);
+    filePath.clear();
+    map = NULL;
+    mapSize = 0;
+    text.clear();
+    vertices = NULL;
+    data = NULL;
+    stride = 0;
+    quantized = false;
+    vertexNum = 0;
+    indices = NULL;
+    indexNum = 0;
+    indexType = MESH_NONE;
+}
+
+const float *MeshFile::getVertices() const
+{
+    if(!vertices && quantized) {
+        text.resize((size_t)vertexNum * MESH_COMPONENTS);
+        for(int i = 0; i < vertexNum; i++)
+            dequantizeVertex((const char *)data + i * stride, &text[i * MESH_COMPONENTS]);
+        vertices = text.data();
+    }
+    return vertices;
+}
+
+int MeshFile::getTriangleVertex(int t, int j) const
+{
+    int i = 3 * t + j;
+    if(indexNum == 0)
+        return i;
+    if(indexType == MESH_UINT16)
+        return ((const uint16_t *)indices)[i];
+    return ((const uint32_t *)indices)[i];
+}
+
+int MeshFile::check(const MeshHeader *header, size_t size) const
+{
+    if(header->version != MESH_VERSION) {
+        std::cout << "Mesh " << filePath << " has unsupported version " << header->version << std::endl;
+        return -1;
+    }
+
+    bool float_layout = (header->stride == MESH_COMPONENTS * sizeof(float)) &&
+            (header->attr[0].size == 3) && (header->attr[0].type == MESH_FLOAT) && (header->attr[0].offset == 0) &&
+            (header->attr[1].size == 2) && (header->attr[1].type == MESH_FLOAT) &&
+            (header->attr[1].offset == 3 * sizeof(float));
+    bool quantized_layout = (header->stride == MESH_QUANTIZED_STRIDE) &&
+            (header->attr[0].size == 3) && (header->attr[0].type == MESH_HALF) && (header->attr[0].offset == 0) &&
+            (header->attr[1].size == 2) && (header->attr[1].type == MESH_UNORM16) &&
+            (header->attr[1].offset == 4 * sizeof(uint16_t));
+    if(!float_layout && !quantized_layout) {
+        std::cout << "Mesh " << filePath << " has unsupported vertex layout" << std::endl;
+        return -1;
+    }
+
+    if((header->indexNum != 0) && (header->indexType != MESH_UINT16) && (header->indexType != MESH_UINT32)) {
+        std::cout << "Mesh " << filePath << " has unsupported index type" << std::endl;
+        return -1;
+    }
+    uint64_t index_size = (uint64_t)header->indexNum * (header->indexType == MESH_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t));
+
+    if((header->dataOffset % sizeof(float) != 0) ||
+       (header->dataSize != (uint64_t)header->vertexNum * header->stride) ||
+       ((uint64_t)header->dataOffset + header->dataSize > size) ||
+       (header->indexOffset % sizeof(uint16_t) != 0) ||
+       ((uint64_t)header->indexOffset + index_size > size)) {
+        std::cout << "Mesh " << filePath << " is truncated" << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+// Reads all data of an opened binary file, text files have no checksum
+int MeshFile::verify() const
+{
+    if(!map)
+        return 0;
+
+    const MeshHeader *header = (const MeshHeader *)map;
+    uint32_t checksum = meshChecksum(data, getDataSize());
+    checksum = meshChecksum(indices, getIndexSize(), checksum);
+    if(checksum != header->checksum) {
+        std::cout << "Mesh " << filePath << " is corrupted, checksum mismatch" << std::endl;
+        return -1;
+    }
+
+    for(int i = 0; i < indexNum; i++) {
+        int v = getTriangleVertex(i / 3, i % 3);
+        if((v < 0) || (v >= vertexNum)) {
+            std::cout << "Mesh " << filePath << " has index out of range" << std::endl;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int MeshFile::openText(const std::string &path)
+{
+    std::ifstream input(path.c_str());
+    if(!input) {
+        std::cout << "Mesh file " << path << " not found" << std::endl;
+        return -1;
+    }
+
+    float v;
+    while(input >> v)
+        text.push_back(v);
+    text.resize(text.size() - text.size() % MESH_COMPONENTS);
+
+    vertices = text.data();
+    data = vertices;
+    vertexNum = text.size() / MESH_COMPONENTS;
+    stride = MESH_COMPONENTS * sizeof(float);
+    return 0;
+}
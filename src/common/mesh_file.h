@@ -0,0 +1,128 @@
+#ifndef MESH_FILE_H
+#define MESH_FILE_H
+
+#include <opencv2/opencv.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Binary container of the triangle grids (arrayX, arrayX1, arrayX2).
+ * The file is a fixed size header followed by the vertex data, which starts at a MESH_ALIGN boundary
+ * and is stored in the layout of the vertex buffers (position xyz, texcoord uv, float).
+ * Grid points shared by several triangles are stored once, the triangles are described by an index
+ * array (16 bit if the vertices allow it, 32 bit otherwise) which follows the vertex data.
+ * The header holds the layout descriptor and an FNV-1a checksum of the data. open() checks only the
+ * header against the file size, so a truncated file is rejected without reading the data. The checksum
+ * and the index range are verified when the file is written (save() reads the file back before it
+ * replaces the old one) and by verify(). The render maps the file and passes the data to glBufferData
+ * directly.
+ * Rendered grids can be quantized: half float position and 16 bit unorm texcoord (12 bytes per vertex
+ * instead of 20). The vertex attributes are dequantized by the vertex fetch. getVertices() dequantizes
+ * the float vertices for the CPU users on its first call, the render uploads getData() only.
+ * Files in the old text format (5 values per line, triangle soup) are still read. */
+
+#define MESH_MAGIC          0x4853454d  // "MESH"
+#define MESH_VERSION        2
+#define MESH_ALIGN          64          // Alignment of the data (bytes)
+#define MESH_ATTR_MAX       4
+#define MESH_COMPONENTS     5           // Floats per vertex
+#define MESH_QUANTIZED_STRIDE   12      // Half xyz, padding, unorm16 uv
+#define MESH_QUANTIZE_ERROR 1e-3f       // Max position error of the quantized mesh (fraction of the mesh extent)
+
+enum MeshType {MESH_NONE = 0, MESH_FLOAT, MESH_UINT16, MESH_UINT32, MESH_HALF, MESH_UNORM16};
+
+struct MeshAttr {
+    uint8_t size;               // Number of components, 0 - unused attribute
+    uint8_t type;               // MeshType of the components
+    uint16_t offset;            // Offset in the vertex (bytes)
+};
+
+struct MeshHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertexNum;
+    uint32_t stride;            // Size of a vertex (bytes)
+    MeshAttr attr[MESH_ATTR_MAX];
+    uint32_t dataOffset;
+    uint32_t dataSize;
+    uint32_t indexNum;          // 0 - the vertices are a triangle soup
+    uint32_t indexType;         // MeshType of the indices
+    uint32_t indexOffset;
+    uint32_t checksum;          // FNV-1a of the vertices and the indices
+};
+
+#define MESH_FNV_BASIS      2166136261u
+
+uint32_t meshChecksum(const void *data, size_t size, uint32_t hash = MESH_FNV_BASIS);
+
+class MeshFile;
+
+class MeshWriter
+{
+public:
+    int addVertex(const cv::Point3f &v, const cv::Point2f &t);
+    int addVertex(const float *v);
+    void addTriangle(int v1, int v2, int v3);
+    void addTriangle(const MeshFile &src, int t, std::vector<int> &remap);
+    void append(const MeshWriter &src);
+    void optimize();
+    float getAcmr() const;
+    int getVertexNum() const { return (int)(data.size() / MESH_COMPONENTS); }
+    int getIndexNum() const { return (int)indices.size(); }
+    size_t getSize() const;
+    void clear() { data.clear(); indices.clear(); }
+    int save(const std::string &path, bool quantize = false) const;
+
+private:
+    bool quantizeVertices(std::vector<char> &out, const std::string &path) const;
+
+    std::vector<float> data;
+    std::vector<uint32_t> indices;
+};
+
+class MeshFile
+{
+public:
+    MeshFile() {}
+    ~MeshFile() { close(); }
+
+    int open(const std::string &path);
+    int verify() const;
+    void close();
+    const float *getVertices() const;   // Not thread safe on the first call of a quantized mesh
+    const void *getData() const { return data; }
+    size_t getDataSize() const { return (size_t)vertexNum * stride; }
+    int getStride() const { return stride; }
+    bool isQuantized() const { return quantized; }
+    const float *getVertex(int i) const { return getVertices() + i * MESH_COMPONENTS; }
+    int getVertexNum() const { return vertexNum; }
+    const void *getIndices() const { return indices; }
+    int getIndexNum() const { return indexNum; }
+    int getIndexType() const { return indexType; }
+    size_t getIndexSize() const { return indexNum * (indexType == MESH_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t)); }
+    int getTriangleNum() const { return (indexNum ? indexNum : vertexNum) / 3; }
+    int getTriangleVertex(int t, int j) const;
+    bool isMapped() const { return map != NULL; }
+
+private:
+    MeshFile(const MeshFile &);
+    MeshFile &operator=(const MeshFile &);
+
+    int openText(const std::string &path);
+    int check(const MeshHeader *header, size_t size) const;
+
+    std::string filePath;       // Path of the opened file for the messages
+    void *map = NULL;
+    size_t mapSize = 0;
+    mutable std::vector<float> text;    // Vertices of a text file or dequantized vertices
+    mutable const float *vertices = NULL; // NULL until a quantized mesh is dequantized
+    const void *data = NULL;    // Vertices in the file layout
+    int stride = 0;
+    bool quantized = false;
+    int vertexNum = 0;
+    const void *indices = NULL;
+    int indexNum = 0;
+    int indexType = MESH_NONE;
+};
+
+#endif // MESH_FILE_H
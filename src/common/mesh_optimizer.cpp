@@ -0,0 +1,153 @@
+#include "mesh_optimizer.h"
+
+#include <cmath>
+
+// Parameters of the Forsyth vertex scoring
+#define FORSYTH_CACHE_SIZE      32
+#define FORSYTH_CACHE_DECAY     1.5f
+#define FORSYTH_LAST_TRI_SCORE  0.75f
+#define FORSYTH_VALENCE_SCALE   2.0f
+#define FORSYTH_VALENCE_POWER   0.5f
+
+float meshAcmr(const std::vector<uint32_t> &indices, int vertexNum, int cacheSize)
+{
+    if(indices.size() < 3)
+        return 0;
+
+    // A vertex is in the FIFO if less than cacheSize misses happened since it was loaded
+    std::vector<int> stamp(vertexNum, -cacheSize);
+    int misses = 0;
+    for(uint32_t v : indices) {
+        if(misses - stamp[v] >= cacheSize) {
+            stamp[v] = misses;
+            misses++;
+        }
+    }
+    return (float)misses / (indices.size() / 3);
+}
+
+static float vertexScore(int cachePos, int remaining)
+{
+    if(remaining == 0)
+        return -1.0f;   // All triangles of the vertex are drawn
+
+    float score = 0;
+    if(cachePos >= 0) {
+        // Vertices of the last triangle have a fixed score, so the next triangle does not reuse them all
+        if(cachePos < 3)
+            score = FORSYTH_LAST_TRI_SCORE;
+        else
+            score = powf(1.0f - (float)(cachePos - 3) / (FORSYTH_CACHE_SIZE - 3), FORSYTH_CACHE_DECAY);
+    }
+
+    // Vertices with few remaining triangles are preferred, so the mesh is not left with isolated triangles
+    return score + FORSYTH_VALENCE_SCALE * powf((float)remaining, -FORSYTH_VALENCE_POWER);
+}
+
+void optimizeVertexCache(std::vector<uint32_t> &indices, int vertexNum)
+{
+    int triNum = indices.size() / 3;
+    if(triNum < 2)
+        return;
+
+    // Triangles of each vertex, the remaining (not drawn) triangles are kept at the beginning of the vertex range
+    std::vector<int> offset(vertexNum + 1, 0), remaining(vertexNum, 0);
+    for(int i = 0; i < triNum * 3; i++)
+        remaining[indices[i]]++;
+    for(int v = 0; v < vertexNum; v++)
+        offset[v + 1] = offset[v] + remaining[v];
+    std::vector<int> vertexTris(offset[vertexNum]);
+    std::vector<int> fill(offset.begin(), offset.end() - 1);
+    for(int i = 0; i < triNum * 3; i++)
+        vertexTris[fill[indices[i]]++] = i / 3;
+
+    std::vector<int> cachePos(vertexNum, -1);
+    std::vector<float> score(vertexNum);
+    for(int v = 0; v < vertexNum; v++)
+        score[v] = vertexScore(-1, remaining[v]);
+
+    std::vector<float> triScore(triNum);
+    std::vector<bool> drawn(triNum, false);
+    for(int t = 0; t < triNum; t++)
+        triScore[t] = score[indices[3 * t]] + score[indices[3 * t + 1]] + score[indices[3 * t + 2]];
+
+    std::vector<uint32_t> out;
+    out.reserve(triNum * 3);
+    std::vector<int> cache, newCache;
+    int best = -1, cursor = 0;
+
+    while((int)out.size() < triNum * 3) {
+        // The cache does not touch any remaining triangle, continue with the next one in the input order
+        if(best < 0) {
+            while(drawn[cursor])
+                cursor++;
+            best = cursor;
+        }
+
+        drawn[best] = true;
+        const uint32_t *tri = &indices[3 * best];
+        out.insert(out.end(), tri, tri + 3);
+
+        // Remove the triangle from the remaining triangles of its vertices
+        for(int j = 0; j < 3; j++) {
+            int v = tri[j];
+            int *begin = &vertexTris[offset[v]];
+            int *end = begin + remaining[v];
+            for(int *p = begin; p < end; p++) {
+                if(*p == best) {
+                    *p = *(end - 1);
+                    *(end - 1) = best;
+                    break;
+                }
+            }
+            remaining[v]--;
+        }
+
+        // The triangle vertices move to the front of the LRU cache
+        newCache.assign(tri, tri + 3);
+        for(int v : cache) {
+            if((v != (int)tri[0]) && (v != (int)tri[1]) && (v != (int)tri[2]))
+                newCache.push_back(v);
+        }
+        cache.swap(newCache);
+
+        // Vertices beyond the cache size are evicted, their score is updated as well
+        for(size_t i = 0; i < cache.size(); i++) {
+            int v = cache[i];
+            cachePos[v] = (i < FORSYTH_CACHE_SIZE) ? (int)i : -1;
+            score[v] = vertexScore(cachePos[v], remaining[v]);
+        }
+
+        // The next triangle is the best one among the remaining triangles of the cached vertices
+        best = -1;
+        float bestScore = -1;
+        for(int v : cache) {
+            for(int k = 0; k < remaining[v]; k++) {
+                int t = vertexTris[offset[v] + k];
+                triScore[t] = score[indices[3 * t]] + score[indices[3 * t + 1]] + score[indices[3 * t + 2]];
+                if(triScore[t] > bestScore) {
+                    bestScore = triScore[t];
+                    best = t;
+                }
+            }
+        }
+
+        if(cache.size() > FORSYTH_CACHE_SIZE)
+            cache.resize(FORSYTH_CACHE_SIZE);
+    }
+
+    indices.swap(out);
+}
+
+int optimizeVertexFetch(std::vector<uint32_t> &indices, int vertexNum, std::vector<int> &remap)
+{
+    // Vertices are numbered in the order of the first use, unused vertices are dropped (remap = -1)
+    remap.assign(vertexNum, -1);
+    int num = 0;
+    for(uint32_t &v : indices) {
+        if(remap[v] < 0)
+            remap[v] = num++;
+        v = remap[v];
+    }
+    return num;
+}
@@ -0,0 +1,21 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <stdint.h>
+#include <vector>
+
+/* Build time optimization of indexed triangle lists for the GPU.
+ * optimizeVertexCache() reorders the triangles with the Forsyth algorithm ("Linear-Speed Vertex Cache
+ * Optimisation"), so the triangles sharing vertices are drawn close together and hit the post-transform cache.
+ * optimizeVertexFetch() then renumbers the vertices in the order of their first use, so the vertex fetch
+ * reads the vertex buffer almost sequentially.
+ * meshAcmr() reports the average cache miss ratio (transformed vertices per triangle) of a FIFO cache,
+ * 0.5 is the optimum of a regular grid, 3 means no reuse at all. */
+
+#define MESH_CACHE_SIZE     16          // FIFO size used to report ACMR (entries of the GC7000 post-transform cache)
+
+float meshAcmr(const std::vector<uint32_t> &indices, int vertexNum, int cacheSize = MESH_CACHE_SIZE);
+void optimizeVertexCache(std::vector<uint32_t> &indices, int vertexNum);
+int optimizeVertexFetch(std::vector<uint32_t> &indices, int vertexNum, std::vector<int> &remap);
+
+#endif // MESH_OPTIMIZER_H
@@ -51,16 +51,46 @@ int Settings::load(const std::string &path)
         camparams.push_back(pcam);
     }
 
+    n = fs["extrinsic"];
+    n["fisheye_detect"] >> fisheyeDetect;
+    n["tracking"] >> tracking;
+    n["frames"] >> extrinsicFrames;
+
+    n = fs["quality"];
+    n["check"] >> qualityCheck;
+    n["min_sharpness"] >> qualitySharpness;
+    n["max_clipping"] >> qualityClipping;
+    n["min_contrast"] >> qualityContrast;
+
     n = fs["grid"];
     n["angles"] >> angles;
     n["start_angle"] >> startAngle;
     n["nop_z"] >> nopZ;
     n["step_x"] >> stepX;
     n["radius_scale"] >> radiusScale;
+    n["adaptive_threshold"] >> adaptiveThreshold;
+    n["type"] >> gridType;
+    n["lod_levels"] >> lodLevels;
 
     n = fs["mask"];
     n["smooth_angle"] >> smoothAngle;
 
+    n = fs["bundle"];
+    n["adjust"] >> bundleAdjust;
+    n["iterations"] >> bundleIterations;
+    n["time_budget"] >> bundleTimeBudget;
+    n["features"] >> bundleFeatures;
+
+    n = fs["drift"];
+    n["monitor"] >> driftMonitor;
+    n["cpu_budget"] >> driftCpuBudget;
+    n["min_interval"] >> driftInterval;
+    n["threshold"] >> driftThreshold;
+    n["auto_recalibrate"] >> driftRecalibrate;
+
+    n = fs["render"];
+    n["parametric"] >> parametric;
+
     n = fs["car_model"];
     n["x_scale"]  >> model_scale[0];
     n["y_scale"] >> model_scale[1];
@@ -108,18 +138,53 @@ void Settings::save(const std::string &path)
     }
     fs << "}";
 
+    fs << "extrinsic" << "{"
+       << "fisheye_detect" << fisheyeDetect
+       << "tracking" << tracking
+       << "frames" << extrinsicFrames
+       << "}";
+
+    fs << "quality" << "{"
+       << "check" << qualityCheck
+       << "min_sharpness" << qualitySharpness
+       << "max_clipping" << qualityClipping
+       << "min_contrast" << qualityContrast
+       << "}";
+
     fs << "grid" << "{"
        << "angles" << angles
        << "start_angle" << startAngle
        << "nop_z" << nopZ
        << "step_x" << stepX
        << "radius_scale" << radiusScale
+       << "adaptive_threshold" << adaptiveThreshold
+       << "type" << gridType
+       << "lod_levels" << lodLevels
        << "}";
 
     fs << "mask" << "{"
        << "smooth_angle" << smoothAngle
        << "}";
 
+    fs << "bundle" << "{"
+       << "adjust" << bundleAdjust
+       << "iterations" << bundleIterations
+       << "time_budget" << bundleTimeBudget
+       << "features" << bundleFeatures
+       << "}";
+
+    fs << "drift" << "{"
+       << "monitor" << driftMonitor
+       << "cpu_budget" << driftCpuBudget
+       << "min_interval" << driftInterval
+       << "threshold" << driftThreshold
+       << "auto_recalibrate" << driftRecalibrate
+       << "}";
+
+    fs << "render" << "{"
+       << "parametric" << parametric
+       << "}";
+
     fs << "car_model" << "{"
        << "x_scale" <<  model_scale[0]
        << "y_scale" << model_scale[1]
@@ -7,6 +7,11 @@
 class Settings
 {
 public:
+    enum GridType {
+        GridCurvilinear = 0,
+        GridRectilinear
+    };
+
     struct CamParam {
         int devId = -1;
         int width = 0;
@@ -22,14 +27,39 @@ public:
     int cameraNum = 4;
     std::vector<std::shared_ptr<CamParam>> camparams;
 
+    bool fisheyeDetect = false;
+    bool tracking = false;
+    int extrinsicFrames = 1;
+
+    bool qualityCheck = false;
+    float qualitySharpness = 20;
+    float qualityClipping = 0.25;
+    float qualityContrast = 60;
+
     int angles = 60;
     int startAngle = 4;
     int nopZ = 30;
     float stepX = 0.2;
     float radiusScale = 1.5;
+    float adaptiveThreshold = 0;
+    int gridType = GridCurvilinear;
+    int lodLevels = 1;
 
     float smoothAngle = 0.2;
 
+    bool bundleAdjust = false;
+    int bundleIterations = 20;
+    int bundleTimeBudget = 500;
+    int bundleFeatures = 100;
+
+    bool driftMonitor = false;
+    float driftCpuBudget = 0.05;
+    int driftInterval = 1000;
+    float driftThreshold = 4;
+    bool driftRecalibrate = false;
+
+    bool parametric = false;
+
     float model_scale[3] = {0.5, 0.5 , 0.5};
     bool readyToShow = false;
 
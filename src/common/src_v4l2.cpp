@@ -26,6 +26,8 @@
 
 int v4l2Camera::exit_flag = 0; // Exit flag
 pthread_mutex_t v4l2Camera::th_mutex = PTHREAD_MUTEX_INITIALIZER;	// Mutex for camera access sinchronization
+pthread_cond_t v4l2Camera::th_cond = PTHREAD_COND_INITIALIZER;	// Signaled when a camera captures a frame
+unsigned int v4l2Camera::frame_count = 0;	// Number of frames captured by all cameras
 
 /**************************************************************************************************************
  *
@@ -343,6 +345,7 @@ void v4l2Camera::stopCapturing()
  *
  * @remarks 		The function creates thread with camera frame capturing loop. The capturing loop is terminated
  *					when the exit flag exit_flag is set to 1. Access to camera is synchronized by the mutex th_mutex.
+ *					Each captured frame increments frame_count and is signaled by th_cond.
  *
  **************************************************************************************************************/
 void* v4l2Camera::getFrameThread(void* input_args)
@@ -380,6 +383,8 @@ void* v4l2Camera::getFrameThread(void* input_args)
             pthread_mutex_lock(&th_mutex);
             th_arg.buffers[i]->filled = 1;
             *th_arg.fill_buffer_inx = i;
+            frame_count++;
+            pthread_cond_broadcast(&th_cond);
             pthread_mutex_unlock(&th_mutex);
         }
 
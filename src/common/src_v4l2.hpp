@@ -102,6 +102,8 @@ class v4l2Camera {
         int fill_buffer_inx;	// 1: buffer is filled with camera data, 0: not filled
         videobuffer buffers[BUFFER_NUM]; // buffers
         static pthread_mutex_t th_mutex;	// Mutex for camera access sinchronization
+        static pthread_cond_t th_cond;		// Signaled with th_mutex when a camera captures a frame
+        static unsigned int frame_count;	// Number of frames captured by all cameras
         static int exit_flag;				// Exit flag
 
         int getWidth() {return width;}		// Camera frame width
@@ -217,6 +219,7 @@ class v4l2Camera {
          *
          * @remarks 		The function creates thread with camera frame capturing loop. The capturing loop is terminated
          *					when the exit flag exit_flag is set to 1. Access to camera is synchronized by the mutex th_mutex.
+         *					Each captured frame increments frame_count and is signaled by th_cond.
          *
          *					The function isn't used for image inputs.
          *
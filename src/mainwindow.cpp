@@ -4,6 +4,7 @@
 #include "render/gpurender.h"
 #include "common/exposure_compensator.hpp"
 #include "render/svgpurender.h"
+#include "calibration/bundleadjuster.h"
 
 #include <QFile>
 #include <QTimer>
@@ -12,6 +13,12 @@
 #include <QLayout>
 #include <QSpacerItem>
 #include <QDesktopWidget>
+#include <QtConcurrent>
+#include <QElapsedTimer>
+
+#define CAPTURE_TIMEOUT 1000 // Time in ms to wait for the frames of the extrinsic search
+#define SEARCH_BACKOFF_MIN 200 // Time in ms between the background searches of the lost templates
+#define SEARCH_BACKOFF_MAX 3200
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
@@ -23,29 +30,45 @@ MainWindow::MainWindow(QWidget *parent) :
 
     settings = new Settings(contentPath + "settings.xml");
 
-    std::string cameraModelPath = contentPath + "camera_models/";
-    for(uint i = 0; i < settings->camparams.size(); i++) {
-        std::string calibResTxt = cameraModelPath + "calib_results_"
-                + std::to_string(i + 1) + ".txt";
-        CameraCalibrator *pcam = new CameraCalibrator(calibResTxt, i, settings->camparams[i]->sf,
-                                  settings->camparams[i]->roi,
-                                  settings->camparams[i]->contourMinSize);
-        if (pcam->setIntrinsic(cameraModelPath + "chessboard_" + std::to_string(i + 1) + "/",
-                               "frame" + std::to_string(i + 1) + "_",
-                               settings->camparams[i]->chessboardNum,
-                               settings->chessboardSize)) {
+    // Cameras are independent until the templates are normalized,
+    // so run calibration chain of each camera in the thread pool
+    camCalibs.resize(settings->camparams.size(), NULL);
+    std::vector<CameraCalibrator::Chessboards> boards(camCalibs.size());
+    std::vector<QFuture<int>> jobs;
+    for(uint i = 0; i < camCalibs.size(); i++)
+        jobs.push_back(QtConcurrent::run(this, &MainWindow::initCamera, (int)i, &boards[i]));
+    std::vector<int> status;
+    for(QFuture<int> &job : jobs)
+        status.push_back(job.result());
+
+    // One job for each chessboard image of all cameras, so the pool is not blocked by nested jobs
+    std::vector<QFuture<int>> detections;
+    for(uint i = 0; i < camCalibs.size(); i++) {
+        if(status[i] != 1)
+            continue;
+        CameraCalibrator *pcam = camCalibs[i];
+        CameraCalibrator::Chessboards *pboards = &boards[i];
+        for(uint k = 0; k < pboards->names.size(); k++)
+            detections.push_back(QtConcurrent::run([pcam, pboards, k]() {
+                return pcam->detectChessboard(*pboards, k);
+            }));
+    }
+    for(QFuture<int> &detection : detections)
+        detection.waitForFinished();
+    for(uint i = 0; i < camCalibs.size(); i++)
+        if(status[i] == 1)
+            status[i] = camCalibs[i]->setIntrinsic(boards[i]);
+
+    for(int ret : status) {
+        if(ret == -1) {
             QMessageBox::critical(this, " ", "set intrinsic error",
                                   QMessageBox::Cancel);
             exit(-1);
-        }
-        if (pcam->setTemplate(contentPath + "template/" +
-                              "template_" + std::to_string(i + 1) + ".txt")) {
+        } else if(ret == -2) {
             QMessageBox::critical(this, " ", "set template error",
                                   QMessageBox::Cancel);
             exit(-1);
         }
-
-        camCalibs.push_back(pcam);
     }
     CameraCalibrator::normTemplate(camCalibs);
 
@@ -68,6 +91,11 @@ MainWindow::MainWindow(QWidget *parent) :
 
     ui->statusBar->showMessage("fisheye view");
 
+    searching.assign(camCalibs.size(), false);
+    searchBackoff = SEARCH_BACKOFF_MIN;
+    searchPool.setMaxThreadCount(1);
+    connect(&searchWatcher, &QFutureWatcher<void>::finished, this, &MainWindow::onSearchFinished);
+
     timer = new QTimer(this);
     connect(timer, &QTimer::timeout, this, &MainWindow::updateRender);
     timer->start(50);
@@ -78,18 +106,66 @@ MainWindow::~MainWindow()
 //    cv::FileStorage fs(dataPath + "status.xml", cv::FileStorage::WRITE);
 //    fs << "readyToShow" << readyToShow;
 
+    stopSearch(); // Uses the calibrators and camera buffers of the render
+    delete driftMonitor; // Uses camera buffers of the render
+    delete svRender;
     delete ui;
     delete settings;
     for(CameraCalibrator *pcam : camCalibs) {
         delete pcam;
     }
 
-    for(CurvilinearGrid *pgrid : grids) {
+    for(Grid *pgrid : grids) {
         delete pgrid;
     }
 }
 
+int MainWindow::initCamera(int index, CameraCalibrator::Chessboards *boards)
+{
+    std::string cameraModelPath = contentPath + "camera_models/";
+    std::string calibResTxt = cameraModelPath + "calib_results_"
+            + std::to_string(index + 1) + ".txt";
+    CameraCalibrator *pcam = new CameraCalibrator(calibResTxt, index, settings->camparams[index]->sf,
+                              settings->camparams[index]->roi,
+                              settings->camparams[index]->contourMinSize);
+    pcam->setFisheyeDetect(settings->fisheyeDetect);
+    pcam->setTracking(settings->tracking);
+
+    CameraCalibrator::FrameQuality quality;
+    quality.check = settings->qualityCheck;
+    quality.minSharpness = settings->qualitySharpness;
+    quality.maxClipping = settings->qualityClipping;
+    quality.minContrast = settings->qualityContrast;
+    pcam->setFrameQuality(quality);
+    camCalibs[index] = pcam;
+
+    if (pcam->setTemplate(contentPath + "template/" +
+                          "template_" + std::to_string(index + 1) + ".txt"))
+        return -2;
+
+    // Returns 1 if the chessboards must be detected before setIntrinsic
+    return pcam->prepareIntrinsic(cameraModelPath + "chessboard_" + std::to_string(index + 1) + "/",
+                                  "frame" + std::to_string(index + 1) + "_",
+                                  settings->camparams[index]->chessboardNum,
+                                  settings->chessboardSize, *boards);
+}
+
 int MainWindow::getContours(float **gl_lines)
+{
+    // Search contours for all cameras in parallel
+    std::vector<int> cameras(camCalibs.size());
+    for (uint i = 0; i < camCalibs.size(); i++)
+        cameras[i] = i;
+    std::vector<int> status;
+    estimateExtrinsics(cameras, status);
+
+    std::vector<bool> found(camCalibs.size());
+    for (uint i = 0; i < camCalibs.size(); i++)
+        found[i] = (status[i] == 0);
+    return getContourLines(found, gl_lines);
+}
+
+int MainWindow::getContourLines(const std::vector<bool> &found, float **gl_lines)
 {
     float** contours = (float**)calloc(camCalibs.size(), sizeof(float*)); // Contour arrays for each camera
     int array_num[camCalibs.size()] = {0}; // Number of array elements for each camera
@@ -98,7 +174,7 @@ int MainWindow::getContours(float **gl_lines)
 
     for (uint i = 0; i < camCalibs.size(); i++)
     {
-        if(searchContours(i) == 0)
+        if(found[i])
         {
             array_num[i] = camCalibs[i]->getContours(&contours[i]);
             sum_num += array_num[i];
@@ -129,27 +205,16 @@ int MainWindow::getGrids(float **gl_grid)
         cout << "Cannot allocate memory" << endl;
         return(0);
     }
-    int array_num[camCalibs.size()] = {0}; // Number of array elements for each camera
+    std::vector<int> array_num(camCalibs.size(), 0); // Number of array elements for each camera
     int sum_num = 0;
     int index = 0;
 
-    int nopZ = settings->nopZ;
-    for(CameraCalibrator *pcam : camCalibs) {
-        int tmp = pcam->getBowlHeight(
-                    settings->radiusScale * pcam->getBaseRadius(),
-                    settings->stepX);
-        nopZ = std::min(nopZ, tmp);
-    }
+    // All cameras may have been changed
+    dirtyGrids.assign(camCalibs.size(), true);
+    updateGrids();
 
-    vector< vector<Point3f> > seam;
-    for(uint i = 0; i < camCalibs.size(); i++) {
-        CurvilinearGrid *pgrid =
-                new CurvilinearGrid(settings->angles, settings->startAngle,
-                                    nopZ, settings->stepX);
-        pgrid->createGrid(camCalibs[i],
-                          settings->radiusScale * camCalibs[i]->getBaseRadius());
-        grids.push_back(pgrid);
-        array_num[i] = pgrid->getGrid(&grids_data[i]);
+    for(uint i = 0; i < grids.size(); i++) {
+        array_num[i] = grids[i]->getGrid(&grids_data[i]);
         sum_num += array_num[i];
     }
 
@@ -170,41 +235,446 @@ int MainWindow::getGrids(float **gl_grid)
     return sum_num;
 }
 
+int MainWindow::getBowlNopZ()
+{
+    int nopZ = settings->nopZ;
+    for(CameraCalibrator *pcam : camCalibs) {
+        int tmp = pcam->getBowlHeight(
+                    settings->radiusScale * pcam->getBaseRadius(),
+                    settings->stepX);
+        nopZ = std::min(nopZ, tmp);
+    }
+    return nopZ;
+}
+
+void MainWindow::updateGrids()
+{
+    // The bowl height is common for all grids, if it changes all grids are regenerated
+    int nopZ = getBowlNopZ();
+    if((nopZ != gridNopZ) || (grids.size() != camCalibs.size())) {
+        for(Grid *pgrid : grids)
+            delete pgrid;
+        grids.assign(camCalibs.size(), NULL);
+        dirtyGrids.assign(camCalibs.size(), true);
+        gridNopZ = nopZ;
+    }
+
+    // Grids of the cameras are independent, they are generated in parallel
+    std::vector<QFuture<void>> jobs;
+    for(uint i = 0; i < camCalibs.size(); i++) {
+        if(!dirtyGrids[i])
+            continue;
+
+        Grid *pgrid;
+        if(settings->gridType == Settings::GridRectilinear)
+            pgrid = new RectilinearGrid(settings->angles, settings->startAngle,
+                                        nopZ, settings->stepX);
+        else
+            pgrid = new CurvilinearGrid(settings->angles, settings->startAngle,
+                                        nopZ, settings->stepX);
+        pgrid->setAdaptiveThreshold(settings->adaptiveThreshold);
+        delete grids[i];
+        grids[i] = pgrid;
+        jobs.push_back(QtConcurrent::run([this, pgrid, i]() {
+            pgrid->createGrid(camCalibs[i],
+                              settings->radiusScale * camCalibs[i]->getBaseRadius());
+        }));
+    }
+    for(QFuture<void> &job : jobs)
+        job.waitForFinished();
+}
+
 int MainWindow::searchContours(int index)
 {
-    Mat img = ui->glRender->takeFrame(cam_views[index].camera_index);
-    if (camCalibs[index]->setExtrinsic(img) != 0)
-        return (-1);
+    std::vector<int> status;
+    estimateExtrinsics(std::vector<int>(1, index), status);
+    return status[0];
+}
 
-    return 0;
+void MainWindow::estimateExtrinsics(const std::vector<int> &cameras, std::vector<int> &status, bool search)
+{
+    uint cam_num = cameras.size();
+    QElapsedTimer elapsed;
+    elapsed.start();
+    status.assign(cam_num, -1);
+
+    // The newest frames of all cameras are copied from the capture rings without waiting
+    std::vector<int> last(cam_num, -1);
+    std::vector<std::vector<Mat>> frames(cam_num);
+    for (uint c = 0; c < cam_num; c++) {
+        int index = cameras[c];
+        int num = camCalibs[index]->isTracked() ? 1 : std::max(1, settings->extrinsicFrames);
+        ui->glRender->takeFrames(cam_views[index].camera_index, num, last[c], frames[c]);
+    }
+
+    // Tracked cameras follow the template in the last frame
+    std::vector<QFuture<int>> tracks(cam_num);
+    std::vector<bool> tracked(cam_num, false);
+    for (uint c = 0; c < cam_num; c++) {
+        CameraCalibrator *calib = camCalibs[cameras[c]];
+        if (calib->isTracked() && !frames[c].empty()) {
+            tracks[c] = QtConcurrent::run(calib, &CameraCalibrator::updateTracking, frames[c].back());
+            tracked[c] = true;
+        }
+    }
+
+    // Several consecutive frames are fused for the other cameras
+    std::vector<int> num(cam_num, 0);
+    std::vector<std::vector<CameraCalibrator::Pose>> poses(cam_num);
+    std::vector<std::vector<QFuture<int>>> jobs(cam_num);
+    for (uint c = 0; c < cam_num; c++) {
+        if (tracked[c] && (tracks[c].result() == 0)) {
+            status[c] = 0;
+            continue;
+        }
+        if (!search)
+            continue;
+        num[c] = std::max(1, settings->extrinsicFrames);
+        poses[c].resize(num[c]);
+        camCalibs[cameras[c]]->prepareFrames(num[c]);
+    }
+
+    // Frame k is searched in the thread pool while the frames after it are captured
+    std::vector<std::vector<qint64>> durations(cam_num);
+    for (uint c = 0; c < cam_num; c++)
+        durations[c].resize(num[c], 0);
+    bool capturing = true;
+    while (capturing) {
+        capturing = false;
+        unsigned int captured = ui->glRender->frameCount();
+        for (uint c = 0; c < cam_num; c++) {
+            CameraCalibrator *calib = camCalibs[cameras[c]];
+            if ((int)frames[c].size() < num[c])
+                ui->glRender->takeFrames(cam_views[cameras[c]].camera_index,
+                                         num[c] - frames[c].size(), last[c], frames[c]);
+            while ((int)jobs[c].size() < std::min(num[c], (int)frames[c].size())) {
+                uint k = jobs[c].size();
+                Mat img = frames[c][k];
+                CameraCalibrator::Pose *pose = &poses[c][k];
+                qint64 *duration = &durations[c][k];
+                jobs[c].push_back(QtConcurrent::run([calib, img, k, pose, duration]() {
+                    QElapsedTimer job;
+                    job.start();
+                    int ret = calib->estimateFramePose(img, k, *pose);
+                    *duration = job.elapsed();
+                    return ret;
+                }));
+            }
+            if ((int)frames[c].size() < num[c])
+                capturing = true;
+        }
+        int remaining = CAPTURE_TIMEOUT - (int)elapsed.elapsed();
+        if (capturing && (remaining <= 0)) {
+            cout << "Extrinsic search: the cameras stopped capturing, fuse the taken frames" << endl;
+            break;
+        }
+        if (capturing)
+            ui->glRender->waitFrame(captured, remaining); // The searches run meanwhile
+    }
+    qint64 captured_time = elapsed.elapsed();
+
+    int frame_num = 0;
+    qint64 longest = 0;
+    for (uint c = 0; c < cam_num; c++) {
+        if (num[c] == 0)
+            continue;
+        std::vector<int> found(jobs[c].size());
+        for (uint k = 0; k < jobs[c].size(); k++) {
+            found[k] = jobs[c][k].result();
+            longest = std::max(longest, durations[c][k]);
+        }
+        poses[c].resize(jobs[c].size());
+        status[c] = camCalibs[cameras[c]]->fusePoses(poses[c], found);
+        frame_num += jobs[c].size();
+    }
+
+    // The searches overlap the capture, so the time after the last frame stays near one frame search
+    if (frame_num > 0)
+        cout << "Extrinsic search: " << cam_num << " cameras, " << frame_num << " searched frames, "
+             << elapsed.elapsed() << " ms, " << elapsed.elapsed() - captured_time
+             << " ms after the last frame, longest frame search " << longest << " ms" << endl;
 }
 
 void MainWindow::updateRender()
 {
+    // Tracking makes the contour update cheap enough to follow the live frames
+    if((state == contours_view) && settings->tracking)
+        trackContours();
+
     ui->glRender->update();
 }
 
+void MainWindow::trackContours()
+{
+    // Only the tracked templates are updated on the GUI thread
+    std::vector<int> cameras;
+    for (uint i = 0; i < camCalibs.size(); i++)
+        if(!searching[i] && camCalibs[i]->isTracked())
+            cameras.push_back(i);
+    std::vector<int> status;
+    estimateExtrinsics(cameras, status, false);
+
+    std::vector<bool> found(camCalibs.size(), false);
+    for (uint c = 0; c < cameras.size(); c++)
+        found[cameras[c]] = (status[c] == 0);
+
+    // Lost templates are searched in the whole frame in the background
+    requestSearch();
+
+    float* data;
+    int data_num = getContourLines(found, &data);
+    setContourLines(data, data_num);
+}
+
+void MainWindow::requestSearch()
+{
+    if(searchWatcher.isRunning() ||
+            (searchClock.isValid() && (searchClock.elapsed() < searchBackoff)))
+        return;
+
+    std::vector<int> cameras;
+    for (uint i = 0; i < camCalibs.size(); i++)
+        if(!camCalibs[i]->isTracked())
+            cameras.push_back(i);
+    if(!cameras.empty())
+        startSearch(cameras);
+}
+
+void MainWindow::startSearch(const std::vector<int> &cameras)
+{
+    // The search waits for its frame jobs, so it runs outside of the global pool
+    searchCameras = cameras;
+    searching.assign(camCalibs.size(), false);
+    for (int i : searchCameras)
+        searching[i] = true;
+    searchWatcher.setFuture(QtConcurrent::run(&searchPool, [this]() {
+        estimateExtrinsics(searchCameras, searchStatus);
+    }));
+}
+
+void MainWindow::onSearchFinished()
+{
+    bool found = false;
+    std::vector<bool> lines(camCalibs.size(), false);
+    for (uint c = 0; c < searchStatus.size(); c++) {
+        found |= (searchStatus[c] == 0);
+        lines[searchCameras[c]] = (searchStatus[c] == 0);
+    }
+    searchStatus.clear();
+    searching.assign(camCalibs.size(), false);
+
+    if(recalibrating) {
+        recalibrating = false;
+        finishRecalibration(searchCameras[0], found);
+        return;
+    }
+
+    // The search is repeated less often while no template is in view
+    searchBackoff = found ? SEARCH_BACKOFF_MIN : std::min(2 * searchBackoff, SEARCH_BACKOFF_MAX);
+    searchClock.restart();
+
+    // Without tracking the contours are drawn once, when the search of all cameras is finished
+    if((state == contours_view) && !settings->tracking) {
+        float* data;
+        int data_num = getContourLines(lines, &data);
+        setContourLines(data, data_num);
+    }
+}
+
+void MainWindow::stopSearch()
+{
+    searchWatcher.waitForFinished();
+    searching.assign(camCalibs.size(), false);
+    searchBackoff = SEARCH_BACKOFF_MIN;
+    searchClock.invalidate();
+}
+
+void MainWindow::onDriftDetected(int index, float drift)
+{
+    ui->statusBar->showMessage("camera " + QString::number(index + 1) + " drift " +
+                               QString::number(drift) + " pixels");
+    if(settings->driftRecalibrate)
+        recalibrateCamera(index);
+}
+
+void MainWindow::recalibrateCamera(int index)
+{
+    // The monitor is paused, so it does not read the calibrator while the search changes it
+    if(searchWatcher.isRunning())
+        return;
+    if(driftMonitor)
+        driftMonitor->stop();
+    recalibrating = true;
+    startSearch(std::vector<int>(1, index));
+}
+
+void MainWindow::finishRecalibration(int index, bool found)
+{
+    if(found) {
+        // Only the grid of the camera, the masks of the camera and its neighbours are updated
+        dirtyGrids.resize(camCalibs.size(), true);
+        dirtyGrids[index] = true;
+        updateGrids();
+        saveGrids();
+    }
+
+    if(driftMonitor && (state == result_view)) {
+        if(found)
+            driftMonitor->resetReference(index);
+        driftMonitor->resume();
+    }
+}
+
+int MainWindow::adjustCameras()
+{
+    std::vector<cv::Mat> images(camCalibs.size());
+    float extent = 0;
+    for(uint i = 0; i < camCalibs.size(); i++) {
+        Mat img = ui->glRender->takeFrame(cam_views[i].camera_index);
+        camCalibs[i]->defisheye(img, images[i]);
+        extent = std::max(extent, (float)(settings->radiusScale * camCalibs[i]->getBaseRadius()));
+    }
+
+    BundleAdjuster::Param param;
+    param.iterations = settings->bundleIterations;
+    param.timeBudget = settings->bundleTimeBudget;
+    param.features = settings->bundleFeatures;
+    param.extent = extent;
+
+    BundleAdjuster adjuster(param);
+    if(adjuster.adjust(camCalibs, images) != 0)
+        return -1;
+
+    ui->statusBar->showMessage("grids view, seam error " + QString::number(adjuster.getInitialRms()) +
+                               " -> " + QString::number(adjuster.getFinalRms()) + " pixels");
+    return 0;
+}
+
+void MainWindow::setContourLines(float *data, int data_num)
+{
+    if(contoursVaoIndex == 0) {
+        contoursVaoIndex = ui->glRender->addBuffer(&data[0], data_num / 3);
+    } else {
+        ui->glRender->updateBuffer(contoursVaoIndex, &data[0], data_num / 3);
+    }
+    ui->glRender->setBufferAsAttr(contoursVaoIndex, 1, (char*)"vPosition");
+    if (data) free(data);
+}
+
 void MainWindow::saveGrids()
 {
-    vector< vector<Point3f> > seams;
-    vector<Point3f> seam_points;
+    uint num = grids.size();
+    if(num == 0) return;
+    seams.resize(num);
+    dirtyGrids.resize(num, true);
+
+    // Masks, split grids and compensator grids depend on the seams of the camera and its neighbours
+    vector<bool> affected(num, false);
+    for (uint i = 0; i < num; i++)
+    {
+        if(dirtyGrids[i])
+            affected[i] = affected[NEXT(i, num - 1)] = affected[PREV(i, num - 1)] = true;
+    }
 
-    for (uint i = 0; i < grids.size(); i++)
+    // Changed grids are saved in parallel, masks need seams of all grids
+    std::vector<QFuture<void>> jobs;
+    for (uint i = 0; i < num; i++)
     {
-        grids[i]->saveGrid(camCalibs[i]);
-        grids[i]->getSeamPoints(seam_points);	// Get grid seams
-        seams.push_back(seam_points);
+        if(!dirtyGrids[i])
+            continue;
+        jobs.push_back(QtConcurrent::run([this, i]() {
+            grids[i]->saveGrid(camCalibs[i], settings->lodLevels);
+            grids[i]->getSeamPoints(seams[i]);	// Get grid seams
+        }));
     }
+    for (QFuture<void> &job : jobs)
+        job.waitForFinished();
 
-    Masks masks;
-    masks.createMasks(camCalibs, seams, settings->smoothAngle, appPath); // Calculate masks for blending
-    masks.splitGrids(appPath);
+    masks.createMasks(camCalibs, seams, settings->smoothAngle, appPath, affected); // Calculate masks for blending
+    masks.splitGrids(appPath, settings->lodLevels, affected);
 
     QRect rec = QApplication::desktop()->screenGeometry();
 
+    // All compensator grids are scaled and clipped by the radius of the seam of camera 0
+    vector<bool> compensated = affected;
+    if(dirtyGrids[0])
+        compensated.assign(num, true);
+
     Compensator compensator(Size(rec.width(), rec.height())); // Exposure correction
     compensator.feed(camCalibs, seams);
-    compensator.save((appPath + "/compensator").c_str());
+    compensator.save((appPath + "/compensator").c_str(), compensated);
+
+    dirtyGrids.assign(num, false);
+
+    // The running render swaps only the buffers of the changed cameras
+    updateBowl(affected);
+    if(svRender) {
+        for (uint i = 0; i < num; i++)
+            if(affected[i])
+                svRender->reloadCamera(i);
+    }
+}
+
+void MainWindow::updateBowl(const vector<bool> &update)
+{
+    if(!svRender || !settings->parametric)
+        return;
+
+    // The lattice follows the densest bowl bottom, its rings are scaled to the bowl of each camera
+    SvGpuRender::BowlShape shape;
+    shape.angles = settings->angles;
+    shape.startAngle = settings->startAngle;
+    shape.sideRings = gridNopZ;
+    shape.height = gridNopZ * settings->stepX;
+    for(CameraCalibrator *pcam : camCalibs) {
+        if(pcam->getRvec().empty())
+            continue;
+        double radius = settings->radiusScale * pcam->getBaseRadius();
+        int rings = (int)(radius / settings->stepX) -
+                CurvilinearGrid::getFirstRow(pcam, radius, settings->stepX);
+        shape.flatRings = std::max(shape.flatRings, rings);
+    }
+    svRender->setBowlShape(shape);
+
+    for(uint i = 0; i < camCalibs.size(); i++) {
+        CameraCalibrator *pcam = camCalibs[i];
+        if((i < update.size() && !update[i]) || pcam->getRvec().empty() || pcam->getTvec().empty())
+            continue;
+
+        const camera_model &model = pcam->model.model;
+        SvGpuRender::BowlCamera param;
+
+        // Columns of the grid rotation are the rotated axes
+        for(int k = 0; k < 3; k++) {
+            Point3f axis = rotatePoint(pcam->index, Point3f(k == 0, k == 1, k == 2));
+            param.rotation[k] = glm::vec3(axis.x, axis.y, axis.z);
+        }
+
+        Mat R, T, K, dist;
+        Rodrigues(pcam->getRvec(), R);
+        R.convertTo(R, CV_32F);
+        pcam->getTvec().convertTo(T, CV_32F);
+        pcam->getK().convertTo(K, CV_32F);
+        pcam->getDistCoeffs().convertTo(dist, CV_32F);
+        for(int r = 0; r < 3; r++) {
+            for(int c = 0; c < 3; c++)
+                param.R[c][r] = R.at<float>(r, c);
+            param.T[r] = T.at<float>(r);
+        }
+        param.K = glm::vec4(K.at<float>(0, 0), K.at<float>(1, 1), K.at<float>(0, 2), K.at<float>(1, 2));
+        for(int k = 0; k < std::min((int)dist.total(), 4); k++)
+            param.dist[k] = dist.at<float>(k);
+
+        param.invpol.assign(model.invpol.begin(), model.invpol.end());
+        param.center = glm::vec2(model.center.x, model.center.y);
+        param.affine = glm::vec3(model.affine(0, 0), model.affine(0, 1), model.affine(1, 0));
+        param.frameSize = glm::vec2(model.img_size.width, model.img_size.height);
+        param.planeZ = -model.img_size.width / pcam->getSf();
+
+        param.radius = settings->radiusScale * pcam->getBaseRadius();
+        param.innerRadius = CurvilinearGrid::getFirstRow(pcam, param.radius, settings->stepX) * settings->stepX;
+        svRender->setBowlCamera(i, param);
+    }
 }
 
 void MainWindow::switchState(viewStates new_state)
@@ -212,6 +682,10 @@ void MainWindow::switchState(viewStates new_state)
     float* data;
     int data_num;
 
+    if(driftMonitor && (new_state != result_view))
+        driftMonitor->stop();
+    stopSearch();
+
     switch (new_state) {
     case fisheye_view:
         ui->statusBar->showMessage("fisheye view");
@@ -233,19 +707,13 @@ void MainWindow::switchState(viewStates new_state)
         break;
     case contours_view:
         ui->statusBar->showMessage("contours view");
-        data_num = getContours(&data);
-
-        if(contoursVaoIndex == 0) {
-            contoursVaoIndex = ui->glRender->addBuffer(&data[0], data_num / 3);
-        } else {
-            ui->glRender->updateBuffer(contoursVaoIndex, &data[0], data_num / 3);
-        }
-        ui->glRender->setBufferAsAttr(contoursVaoIndex, 1, (char*)"vPosition");
-        if (data) free(data);
+        requestSearch(); // The contours are drawn when the search is finished
         ui->glRender->setRenderState(GpuRender::RenderLines);
         break;
     case grids_view:
         ui->statusBar->showMessage("grids view");
+        if(settings->bundleAdjust)
+            adjustCameras();
         data_num = getGrids(&data);
         if(gridsVaoIndex == 0) {
             gridsVaoIndex = ui->glRender->addBuffer(&data[0], data_num / 3);
@@ -259,15 +727,40 @@ void MainWindow::switchState(viewStates new_state)
     case result_view:
     {
         ui->statusBar->showMessage("result view");
-        saveGrids();
         timer->stop();
-        SvGpuRender *svRender = new SvGpuRender(&ui->glRender->v4l2_cameras);
+
+        // The render is replaced, so saveGrids() must not upload the new buffers into the old one
+        delete svRender;
+        svRender = NULL;
+        saveGrids();
+        svRender = new SvGpuRender(&ui->glRender->v4l2_cameras);
         svRender->setPath(appPath);
+        svRender->setLodLevels(settings->lodLevels);
+        updateBowl(vector<bool>());
         svRender->setParam(settings->cameraNum, camCalibs.at(0)->model.model.img_size.width,
                      camCalibs.at(0)->model.model.img_size.height,
                      settings->model_scale);
         svRender->showFullScreen();
 
+        if(settings->driftMonitor) {
+            if(driftMonitor == NULL) {
+                DriftMonitor::Param param;
+                param.cpuBudget = settings->driftCpuBudget;
+                param.minInterval = settings->driftInterval;
+                param.threshold = settings->driftThreshold;
+                driftMonitor = new DriftMonitor(&ui->glRender->v4l2_cameras, &camCalibs, param, this);
+                connect(driftMonitor, &DriftMonitor::driftDetected,
+                        this, &MainWindow::onDriftDetected);
+            }
+
+            // Overlaps are rendered on the ground covered by the grids
+            float extent = 0;
+            for(uint i = 0; i < camCalibs.size(); i++)
+                extent = std::max(extent, (float)(settings->radiusScale * camCalibs[i]->getBaseRadius()));
+            driftMonitor->setExtent(extent);
+            driftMonitor->start(); // The current calibration is the reference
+        }
+
         break;
     }
     default:
@@ -3,11 +3,15 @@
 
 #include <QMainWindow>
 #include <QPushButton>
+#include <QFutureWatcher>
+#include <QThreadPool>
+#include <QElapsedTimer>
 
 #include "calibration/cameracalibrator.h"
 #include "calibration/grid.hpp"
 #include "calibration/masks.hpp"
 #include "common/settings.h"
+#include "common/drift_monitor.h"
 
 #include "render/gpurender.h"
 
@@ -15,6 +19,8 @@ namespace Ui {
 class MainWindow;
 }
 
+class SvGpuRender;
+
 /**********************************************************************************************************************
  * Types
  **********************************************************************************************************************/
@@ -43,26 +49,58 @@ public slots:
     int getGrids(float** gl_grid);
     int searchContours(int index);
     void updateRender();
+    void onDriftDetected(int index, float drift);
 
 private slots:
     void on_backButton_clicked();
     void on_nextButton_clicked();
+    void onSearchFinished();
 
 private:
     Ui::MainWindow *ui;
     vector<camera_view> cam_views;	// View indexes
     vector<CameraCalibrator *> camCalibs;
-    vector<CurvilinearGrid*> grids;	// Grids
+    vector<Grid*> grids;	// Grids
+    vector<bool> dirtyGrids;	// Grids which have to be regenerated and saved
+    int gridNopZ = 0;	// Bowl height of the grids
+    vector< vector<Point3f> > seams;	// Seam points of the saved grids
+    Masks masks;	// Blending masks of the saved grids
     const std::string appPath;
     const std::string contentPath;
     Settings *settings;
     viewStates state = fisheye_view;
     QTimer *timer;
+    DriftMonitor *driftMonitor = NULL;
+    SvGpuRender *svRender = NULL;
+
+    // Background search of the templates lost by tracking or of a drifted camera
+    QThreadPool searchPool;
+    QFutureWatcher<void> searchWatcher;
+    vector<int> searchCameras;	// Cameras of the running search
+    vector<int> searchStatus;	// Search results of searchCameras
+    vector<bool> searching;	// Cameras of the running search, not updated by the GUI
+    int searchBackoff = 0;	// Time in ms between the searches
+    QElapsedTimer searchClock;	// Time since the last search
+    bool recalibrating = false;	// The running search recalibrates the drifted camera searchCameras[0]
 
     int contoursVaoIndex = 0;
     int gridsVaoIndex = 0;
 
+    int initCamera(int index, CameraCalibrator::Chessboards *boards);
+    int getBowlNopZ();
+    void updateGrids();
+    void trackContours();
+    void requestSearch();
+    void startSearch(const std::vector<int> &cameras);
+    void stopSearch();
+    int getContourLines(const std::vector<bool> &found, float **gl_lines);
+    void setContourLines(float *data, int data_num);
+    void recalibrateCamera(int index);
+    void finishRecalibration(int index, bool found);
+    void estimateExtrinsics(const std::vector<int> &cameras, std::vector<int> &status, bool search = true);
+    int adjustCameras();
     void saveGrids();
+    void updateBowl(const vector<bool> &update);
     void switchState(viewStates new_state);
 };
 
@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -35,6 +35,8 @@ SOURCES += \
     calibration/grid.cpp \
     calibration/masks.cpp \
     calibration/cameracalibrator.cpp \
+    calibration/planar_pose.cpp \
+    calibration/bundleadjuster.cpp \
     common/settings.cpp \
     common/src_v4l2.cpp \
     render/gpurender.cpp \
@@ -43,7 +45,10 @@ SOURCES += \
     render/model_loader/ModelLoader.cpp \
     render/MRT.cpp \
     render/model_loader/VBO.cpp \
-    render/svgpurender.cpp
+    render/svgpurender.cpp \
+    common/drift_monitor.cpp \
+    common/mesh_file.cpp \
+    common/mesh_optimizer.cpp
 
 HEADERS += \
         mainwindow.h \
@@ -52,6 +57,8 @@ HEADERS += \
     calibration/grid.hpp \
     calibration/masks.hpp \
     calibration/cameracalibrator.h \
+    calibration/planar_pose.hpp \
+    calibration/bundleadjuster.h \
     common/lines.hpp \
     common/settings.h \
     common/src_v4l2.hpp \
@@ -61,7 +68,10 @@ HEADERS += \
     render/model_loader/ModelLoader.hpp \
     render/MRT.hpp \
     render/model_loader/VBO.hpp \
-    render/svgpurender.h
+    render/svgpurender.h \
+    common/drift_monitor.h \
+    common/mesh_file.h \
+    common/mesh_optimizer.h
 
 FORMS += \
         mainwindow.ui
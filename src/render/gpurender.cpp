@@ -109,20 +109,20 @@ int GpuRender::addMesh(string filename)
 
     ///////////////////////////////// Load vertices arrays ///////////////////////////////
     vertices_obj vo_tmp;
-    GLfloat* vert;
-    vLoad(&vert, &vo_tmp.num, filename);
+    MeshFile mesh;
+    if (mesh.open(filename) != 0)
+        cout << "Mesh " << filename << " was not loaded, the view is empty" << endl;
+    vo_tmp.num = mesh.getVertexNum();   // 0 if the file was not loaded
 
     //////////////////////// Camera textures initialization /////////////////////////////
     glGenVertexArrays(1, &vo_tmp.vao);
     glGenBuffers(1, &vo_tmp.vbo);
 
-    bufferObjectInit(&vo_tmp.vao, &vo_tmp.vbo, vert, vo_tmp.num);
+    bufferObjectInit(&vo_tmp.vao, &vo_tmp.vbo, mesh.getVertices(), vo_tmp.num);
     texture2dInit(&vo_tmp.tex);
 
     v_obj.push_back(vo_tmp);
 
-    if(vert) free(vert);
-
     doneCurrent();
 
     mesh_index.push_back(v_obj.size() - 1);
@@ -137,17 +137,23 @@ int GpuRender::runCamera(int index)
     return 0;
 }
 
-void GpuRender::reloadMesh(int index, string filename)
+int GpuRender::reloadMesh(int index, string filename)
 {
-    makeCurrent();
+    // A missing, corrupted or old version file keeps the previous buffer
+    MeshFile mesh;
+    if (mesh.open(filename) != 0)
+    {
+        cout << "Mesh " << filename << " was not loaded, the previous mesh is kept" << endl;
+        return (-1);
+    }
 
-    GLfloat* vert;
-    vLoad(&vert, &v_obj[index].num, filename);
+    makeCurrent();
+    v_obj[index].num = mesh.getVertexNum();
     glBindBuffer(GL_ARRAY_BUFFER, v_obj[index].vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 5 * v_obj[index].num, &vert[0], GL_DYNAMIC_DRAW);
-    if(vert) free(vert);
-
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 5 * v_obj[index].num, mesh.getVertices(), GL_DYNAMIC_DRAW);
     doneCurrent();
+
+    return (0);
 }
 
 int GpuRender::changeMesh(Mat xmap, Mat ymap, int density, Point2f top, int index)
@@ -288,6 +294,74 @@ Mat GpuRender::takeFrame(int index)
     return out;
 }
 
+// The capture thread requeues a buffer right after it is dequeued, so only the newest
+// buffers are safe from being overwritten by the driver while they are copied
+#define CAPTURE_HISTORY (BUFFER_NUM - 2)
+
+// Appends up to num frames captured after the buffer "last" in the capture order and
+// updates "last", returns 0 without waiting if no new frame is in the ring
+int GpuRender::takeFrames(int index, int num, int &last, vector<Mat> &frames)
+{
+    v4l2Camera &camera = v4l2_cameras[index];
+    int inx[CAPTURE_HISTORY];
+    int count = 0;
+
+    pthread_mutex_lock(&camera.th_mutex);
+
+    // Filled buffers newer than the last taken one, from the newest to the oldest
+    int newest = camera.fill_buffer_inx;
+    for (int k = 0; (newest != -1) && (k < min(num, CAPTURE_HISTORY)); k++) {
+        int b = (newest - k + BUFFER_NUM) % BUFFER_NUM;
+        if ((b == last) || !camera.buffers[b].filled)
+            break;
+        inx[count++] = b;
+    }
+
+    for (int k = count - 1; k >= 0; k--) {
+        Mat rgba(camera.getHeight(), camera.getWidth(), CV_8UC4, (char*)camera.buffers[inx[k]].start);
+        Mat out;
+        cvtColor(rgba, out, CV_RGBA2RGB);
+        frames.push_back(out);
+    }
+    if (count > 0)
+        last = newest;
+
+    pthread_mutex_unlock(&camera.th_mutex);
+
+    return count;
+}
+
+// Number of frames captured by all cameras, for waitFrame
+unsigned int GpuRender::frameCount()
+{
+    pthread_mutex_lock(&v4l2Camera::th_mutex);
+    unsigned int count = v4l2Camera::frame_count;
+    pthread_mutex_unlock(&v4l2Camera::th_mutex);
+    return count;
+}
+
+// Blocks until any camera captures a frame after frameCount() returned "count",
+// returns -1 if no frame is captured in timeout ms
+int GpuRender::waitFrame(unsigned int count, int timeout)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    int ret = 0;
+    pthread_mutex_lock(&v4l2Camera::th_mutex);
+    while ((v4l2Camera::frame_count == count) && (ret == 0))
+        ret = pthread_cond_timedwait(&v4l2Camera::th_cond, &v4l2Camera::th_mutex, &deadline);
+    pthread_mutex_unlock(&v4l2Camera::th_mutex);
+
+    return (ret == 0) ? 0 : -1;
+}
+
 int GpuRender::addBuffer(GLfloat *buf, int num)
 {
     makeCurrent();
@@ -509,26 +583,7 @@ void GpuRender::resizeGL(int w, int h)
 //    pz = glm::clamp(pz, CAM_LIMIT_ZOOM_MIN, CAM_LIMIT_ZOOM_MAX);
 //}
 
-void GpuRender::vLoad(GLfloat **vert, int *num, string filename)
-{
-    ifstream input(filename.c_str());
-    *num = count(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>(), '\n'); // Get line number from the array file
-    input.clear();
-    input.seekg(0, ios::beg); // Returning to the beginning of fstream
-
-    *vert = NULL;
-    *vert = (GLfloat*)malloc((*num) * 5 * sizeof(GLfloat));
-    if (*vert == NULL) 	{
-        cout << "Memory allocation did not complete successfully" << endl;
-    }
-    for (int k = 0; k < (*num) * 5; k++)
-    {
-        input >> (*vert)[k];
-    }
-    input.close();
-}
-
-void GpuRender::bufferObjectInit(GLuint *text_vao, GLuint *text_vbo, GLfloat *vert, int num)
+void GpuRender::bufferObjectInit(GLuint *text_vao, GLuint *text_vbo, const GLfloat *vert, int num)
 {
     makeCurrent();
 
@@ -27,6 +27,7 @@
 
 //Capturing
 #include "common/src_v4l2.hpp"
+#include "common/mesh_file.h"
 #include <sys/ioctl.h>
 #include <linux/videodev2.h>
 #include <sys/mman.h>
@@ -72,9 +73,12 @@ public:
     int addCamera(int index, int width, int height);
     int addMesh(string filename);
     int runCamera(int index);
-    void reloadMesh(int index, string filename);
+    int reloadMesh(int index, string filename);
     int changeMesh(Mat xmap, Mat ymap, int density, Point2f top, int index);
     Mat takeFrame(int index);
+    int takeFrames(int index, int num, int &last, vector<Mat> &frames);
+    unsigned int frameCount();
+    int waitFrame(unsigned int count, int timeout);
 
     int getVerticesNum(uint num) {if (num < v_obj.size()) return (v_obj[num].num); return (-1);}
 
@@ -102,8 +106,7 @@ private:
     std::vector<QOpenGLShaderProgram *> renderPrograms;
     vector<vertices_obj> v_obj;
 
-    void vLoad(GLfloat** vert, int* num, string filename);
-    void bufferObjectInit(GLuint* text_vao, GLuint* text_vbo, GLfloat* vert, int num);
+    void bufferObjectInit(GLuint* text_vao, GLuint* text_vbo, const GLfloat* vert, int num);
     void texture2dInit(GLuint* texture);
 
     typedef void (GL_APIENTRY *PFNGLTEXDIRECTVIVMAP)
@@ -34,6 +34,8 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include "common/mesh_optimizer.h"
+
 const string ModelLoader::CONFIG_FILE = "./Content/model.cfg";
 
 ModelLoader::ModelLoader()
@@ -198,62 +200,63 @@ bool ModelLoader::Initialize(const string &path)
 
 		//Create object from mesh
 
-		 //count faces
-		int indices = mesh->mNumFaces;
-
-				    // Allocate memory for our vertices and normals
-		Vertex *vertices = new Vertex[indices * 3];
-		Vertex *normals = new Vertex[indices * 3];
-		Coord *texcoords = new Coord[indices * 3];
-
-		unsigned int FinishedFaces = 0;
-
-				    // Loop through every face
+		//indexed triangles, vertices are shared (aiProcess_JoinIdenticalVertices is turned on)
+		vector<uint32_t> indices;
+		indices.reserve(mesh->mNumFaces * 3);
 		for (unsigned curr_face = 0; curr_face < mesh->mNumFaces; curr_face++)
 		{
 			aiFace *face = &mesh->mFaces[curr_face];
 
-							//aiProcess_Triangulate is turned on, so looping through 3 vertices
-			for (unsigned i = 0; i < 3; i++)
-			{			
-				Vertex v;
-				v[0] = mesh->mVertices[face->mIndices[i]].x;
-				v[1] = mesh->mVertices[face->mIndices[i]].y;
-				v[2] = mesh->mVertices[face->mIndices[i]].z;
+			//aiProcess_Triangulate is turned on, points and lines are skipped
+			if (face->mNumIndices != 3)
+				continue;
+			indices.insert(indices.end(), face->mIndices, face->mIndices + 3);
+		}
 
-									//vertices
-				memcpy(&vertices[FinishedFaces * 3 + i], &v, sizeof(Vertex));
+		//reorder triangles for the post-transform vertex cache and vertices in the order of the first use
+		float acmr = meshAcmr(indices, mesh->mNumVertices);
+		optimizeVertexCache(indices, mesh->mNumVertices);
+		vector<int> remap;
+		int count = optimizeVertexFetch(indices, mesh->mNumVertices, remap);
 
-									//normals	
-				v[0] = mesh->mNormals[face->mIndices[i]].x;	
-				v[1] = mesh->mNormals[face->mIndices[i]].y;	
-				v[2] = mesh->mNormals[face->mIndices[i]].z;
+				    // Allocate memory for our vertices and normals
+		Vertex *vertices = new Vertex[count];
+		Vertex *normals = new Vertex[count];
+		Coord *texcoords = new Coord[count]();
 
-				memcpy(&normals[FinishedFaces * 3 + i], &v, sizeof(Vertex));
+		for (unsigned v = 0; v < mesh->mNumVertices; v++)
+		{
+			int i = remap[v];
+			if (i < 0)
+				continue;
+
+									//vertices
+			vertices[i][0] = mesh->mVertices[v].x;
+			vertices[i][1] = mesh->mVertices[v].y;
+			vertices[i][2] = mesh->mVertices[v].z;
 
+									//normals
+			normals[i][0] = mesh->mNormals[v].x;
+			normals[i][1] = mesh->mNormals[v].y;
+			normals[i][2] = mesh->mNormals[v].z;
 
 									//texture coordinates (if present)
-				if (mesh->HasTextureCoords(0))
-				{	
-					Coord c;	
-					c[0] = mesh->mTextureCoords[0][face->mIndices[i]].x;	
-					c[1] = mesh->mTextureCoords[0][face->mIndices[i]].y;	
-					memcpy(&texcoords[FinishedFaces * 3 + i], &c, sizeof(Coord));	
-				}
+			if (mesh->HasTextureCoords(0))
+			{
+				texcoords[i][0] = mesh->mTextureCoords[0][v].x;
+				texcoords[i][1] = mesh->mTextureCoords[0][v].y;
 			}
-			FinishedFaces++;
 		}
 
-			
-		int count = indices * 3;
-		objects.push_back(new VBO(vertices, normals, texcoords, count, mesh->mMaterialIndex)); 
+		objects.push_back(new VBO(vertices, normals, texcoords, count, indices.data(), indices.size(), mesh->mMaterialIndex));
 
 				    // Clean up our allocated memory
 		delete[] vertices;
 		delete[] normals;
 		delete[] texcoords;
 
-		cout << "Done(vertices: " << indices * 3 << ", faces: " << indices << ")\n";
+		cout << "Done(vertices: " << count << ", faces: " << indices.size() / 3
+			 << ", ACMR: " << meshAcmr(indices, count) << " instead of " << acmr << ")\n";
 	}	
 	cout << "Scene loaded: " << polygons << " polygons.\n\n";
 	
@@ -285,7 +288,7 @@ void ModelLoader::Draw(GLuint shader)
 		glUniform3f(specularLoc, specular.x, specular.y, specular.z);
 
 		glBindVertexArray(vbo->GetVAO());
-		glDrawArrays(GL_TRIANGLES, 0, vbo->GetCount());
+		glDrawElements(GL_TRIANGLES, vbo->GetCount(), GL_UNSIGNED_INT, (GLvoid*)0);
 		glBindVertexArray( 0 );
 	}
 
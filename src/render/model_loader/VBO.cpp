@@ -24,9 +24,10 @@
 
 #include "VBO.hpp"
 
-VBO::VBO(Vertex *vertices, Vertex *normals, Coord *texcoords, int _count, int _matId)
+VBO::VBO(Vertex *vertices, Vertex *normals, Coord *texcoords, int _count,
+         const GLuint *indices, int indexCount, int _matId)
 {
-	this->count = _count;
+	this->count = indexCount;
 	this->matId = _matId;
 	this->buffer[0] = 0; this->buffer[1] = 0; this->buffer[2] = 0; this->buffer[3] = 0;
 	this->vao = 0;
@@ -35,7 +36,7 @@ VBO::VBO(Vertex *vertices, Vertex *normals, Coord *texcoords, int _count, int _m
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
 
-    //Allocate and assign three VBO to our handle (vertices, normals and texture coordinates)
+    //Allocate and assign four VBO to our handle (vertices, normals, texture coordinates and faces)
     glGenBuffers(4, buffer);
 
     //store vertices into buffer
@@ -60,6 +61,10 @@ VBO::VBO(Vertex *vertices, Vertex *normals, Coord *texcoords, int _count, int _m
     glVertexAttribPointer(GLuint(2), 2, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(2);
 
+    //store faces, the element buffer binding is a part of the vertex array state
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer[P_INDEX]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indexCount, indices, GL_STATIC_DRAW);
+
     glBindVertexArray(0);
 }
 
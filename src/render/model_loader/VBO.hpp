@@ -42,14 +42,13 @@ protected:
     GLuint buffer[4] = {0};
     ///pointer vertex array
     GLuint vao;
-    ///number of indice
-    //GLuint indices;
-
+    ///number of indices
     GLuint count;
     int matId;
 
 public:
-	VBO(Vertex *vertices, Vertex *normals, Coord *texcoords, int count, int matId);
+	VBO(Vertex *vertices, Vertex *normals, Coord *texcoords, int count,
+	    const GLuint *indices, int indexCount, int matId);
 	~VBO();
 
     void CreateRenderableObject(int id, aiMesh* mesh);
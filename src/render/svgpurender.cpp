@@ -1,4 +1,5 @@
 #include "svgpurender.h"
+#include "common/mesh_optimizer.h"
 #include "glm/gtx/string_cast.hpp"
 
 #include <QElapsedTimer>
@@ -43,6 +44,7 @@ glm::vec3 car_scale = glm::vec3(1.0f, 1.0f, 1.0f);
 #define CAM_LIMIT_RY_MAX 0.0f
 #define CAM_LIMIT_ZOOM_MIN -11.5f
 #define CAM_LIMIT_ZOOM_MAX -2.5f
+#define LOD_REFERENCE_SCALE 270.0f  // Window height / camera distance below which the next coarser mesh is drawn
 
 SvGpuRender::SvGpuRender(vector<v4l2Camera> *v4lCams, QWindow *parent) :
     QOpenGLWindow(NoPartialUpdate, parent),
@@ -127,81 +129,90 @@ void SvGpuRender::paintGL()
         glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // Render camera frames
-        int i;
-
-        // Render overlap regions of camera frame with blending
-//        glUseProgram(renderProgram.);
-        renderProgram.bind();
-        for (int camera = 0; camera < CAMERA_NUM; camera++)
+        if (parametric)
         {
-            // Lock the camera frame
-            pthread_mutex_lock(&(*v4l2_cameras)[camera].th_mutex);
-
-            // Get index of the newes camera buffer
-            if ((*v4l2_cameras)[camera].fill_buffer_inx == -1) i = 0;
-            else  i = (*v4l2_cameras)[camera].fill_buffer_inx;
-
-
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, txtMask[camera]);
-            glUniform1i(glGetUniformLocation(renderProgram.programId(), "myMask"), 1);
+            drawBowl(mvp);
+        }
+        else
+        {
+            const MeshLod &lod = lods[selectLod()];
 
-            // Set gain value for the camera
-//            glUniform4f(locGain[0], gain->Gains::gain[camera][0], gain->Gains::gain[camera][1], gain->Gains::gain[camera][2], 1.0);
+            // Render camera frames
+            int i;
 
             // Render overlap regions of camera frame with blending
-            glBindVertexArray(VAO[2 * camera]);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, gTexObj[2 * camera]);
-            glUniform1i(glGetUniformLocation(renderProgram.programId(), "myTexture"), 0);
-            mapFrame(i, camera);
+//            glUseProgram(renderProgram.);
+            renderProgram.bind();
+            for (int camera = 0; camera < CAMERA_NUM; camera++)
+            {
+                // Lock the camera frame
+                pthread_mutex_lock(&(*v4l2_cameras)[camera].th_mutex);
 
-            GLint mvpLoc = glGetUniformLocation(renderProgram.programId(), "mvp");
-            glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, glm::value_ptr(mvp));
+                // Get index of the newes camera buffer
+                if ((*v4l2_cameras)[camera].fill_buffer_inx == -1) i = 0;
+                else  i = (*v4l2_cameras)[camera].fill_buffer_inx;
 
-            glDrawArrays(GL_TRIANGLES, 0, vertices[2 * camera]);
-            glBindVertexArray(0);
-
-            // Release camera frame
-            pthread_mutex_unlock(&(*v4l2_cameras)[camera].th_mutex);
-        }
 
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_2D, txtMask[camera]);
+                glUniform1i(glGetUniformLocation(renderProgram.programId(), "myMask"), 1);
 
+                // Set gain value for the camera
+//                glUniform4f(locGain[0], gain->Gains::gain[camera][0], gain->Gains::gain[camera][1], gain->Gains::gain[camera][2], 1.0);
 
+                // Render overlap regions of camera frame with blending
+                glBindVertexArray(lod.vao[2 * camera]);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, gTexObj[2 * camera]);
+                glUniform1i(glGetUniformLocation(renderProgram.programId(), "myTexture"), 0);
+                mapFrame(i, camera);
 
+                GLint mvpLoc = glGetUniformLocation(renderProgram.programId(), "mvp");
+                glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, glm::value_ptr(mvp));
 
-        // Render non-overlap region of camera frame without blending
-//        glUseProgram(renderProgramWB.getHandle()); 	// Use fragment shader without blending
-        renderProgramWB.bind();
-        glDisable(GL_BLEND);
-        for (int camera = 0; camera < CAMERA_NUM; camera++)
-        {
-            // Lock the camera frame
-            pthread_mutex_lock(&(*v4l2_cameras)[camera].th_mutex);
+                drawMesh(lod, 2 * camera);
+                glBindVertexArray(0);
 
-            // Get index of the newes camera buffer
-            if ((*v4l2_cameras)[camera].fill_buffer_inx == -1) i = 0;
-            else  i = (*v4l2_cameras)[camera].fill_buffer_inx;
+                // Release camera frame
+                pthread_mutex_unlock(&(*v4l2_cameras)[camera].th_mutex);
+            }
 
-            // Set gain value for the camera
-//            glUniform4f(locGain[1], gain->Gains::gain[camera][0], gain->Gains::gain[camera][1], gain->Gains::gain[camera][2], 1.0); // Set gain value for the camera
 
-            // Render non-overlap region of camera frame without blending
-            glBindVertexArray(VAO[2 * camera + 1]);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, gTexObj[2 * camera+ 1]);
-            glUniform1i(glGetUniformLocation(renderProgramWB.programId(), "myTexture"), 0);
-            mapFrame(i, camera);
 
-            GLint mvpLoc = glGetUniformLocation(renderProgramWB.programId(), "mvp");
-            glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, glm::value_ptr(mvp));
 
-            glDrawArrays(GL_TRIANGLES, 0, vertices[2 * camera+ 1]);	// Draw texture
-            glBindVertexArray(0);
 
-            // Release camera frame
-            pthread_mutex_unlock(&(*v4l2_cameras)[camera].th_mutex);
+            // Render non-overlap region of camera frame without blending
+//            glUseProgram(renderProgramWB.getHandle()); 	// Use fragment shader without blending
+            renderProgramWB.bind();
+            glDisable(GL_BLEND);
+            for (int camera = 0; camera < CAMERA_NUM; camera++)
+            {
+                // Lock the camera frame
+                pthread_mutex_lock(&(*v4l2_cameras)[camera].th_mutex);
+
+                // Get index of the newes camera buffer
+                if ((*v4l2_cameras)[camera].fill_buffer_inx == -1) i = 0;
+                else  i = (*v4l2_cameras)[camera].fill_buffer_inx;
+
+                // Set gain value for the camera
+//                glUniform4f(locGain[1], gain->Gains::gain[camera][0], gain->Gains::gain[camera][1], gain->Gains::gain[camera][2], 1.0); // Set gain value for the camera
+
+                // Render non-overlap region of camera frame without blending
+                glBindVertexArray(lod.vao[2 * camera + 1]);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, gTexObj[2 * camera+ 1]);
+                glUniform1i(glGetUniformLocation(renderProgramWB.programId(), "myTexture"), 0);
+                mapFrame(i, camera);
+
+                GLint mvpLoc = glGetUniformLocation(renderProgramWB.programId(), "mvp");
+                glUniformMatrix4fv(mvpLoc, 1, GL_FALSE, glm::value_ptr(mvp));
+
+                drawMesh(lod, 2 * camera + 1);	// Draw texture
+                glBindVertexArray(0);
+
+                // Release camera frame
+                pthread_mutex_unlock(&(*v4l2_cameras)[camera].th_mutex);
+            }
         }
 
         // Render car model
@@ -421,6 +432,28 @@ int SvGpuRender::programsInit()
     showTexProgram.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shaders/render/shader/tex.fsh");
     showTexProgram.link();
 
+    bowlProgram.addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shaders/render/shader/bowl.vsh");
+    bowlProgram.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shaders/render/shader/bowl.fsh");
+    bowlProgram.link();
+
+    // The bowl uniforms are set for each camera in every frame, so their locations are queried once
+    GLuint bowlId = bowlProgram.programId();
+    bowlUniforms.mvp = glGetUniformLocation(bowlId, "mvp");
+    bowlUniforms.bowl = glGetUniformLocation(bowlId, "bowl");
+    bowlUniforms.rotation = glGetUniformLocation(bowlId, "rotation");
+    bowlUniforms.R = glGetUniformLocation(bowlId, "R");
+    bowlUniforms.T = glGetUniformLocation(bowlId, "T");
+    bowlUniforms.K = glGetUniformLocation(bowlId, "K");
+    bowlUniforms.dist = glGetUniformLocation(bowlId, "dist");
+    bowlUniforms.invpol = glGetUniformLocation(bowlId, "invpol");
+    bowlUniforms.invpolNum = glGetUniformLocation(bowlId, "invpolNum");
+    bowlUniforms.center = glGetUniformLocation(bowlId, "center");
+    bowlUniforms.affine = glGetUniformLocation(bowlId, "affine");
+    bowlUniforms.frameSize = glGetUniformLocation(bowlId, "frameSize");
+    bowlUniforms.planeZ = glGetUniformLocation(bowlId, "planeZ");
+    bowlUniforms.texture = glGetUniformLocation(bowlId, "myTexture");
+    bowlUniforms.mask = glGetUniformLocation(bowlId, "myMask");
+
     return (0);
 }
 
@@ -444,77 +477,275 @@ bool SvGpuRender::RenderInit()
 
 void SvGpuRender::camTexInit()
 {
-    ///////////////////////////////// Load vertices arrays ///////////////////////////////
-    GLfloat* vVertices[VAO_NUM];
-    for (int j = 0; j < VAO_NUM; j++)
+    // The parametric bowl replaces the meshes of all levels
+    lods.clear();
+    if (parametric)
+        latticeInit();
+
+    // Coarse levels are loaded while their files exist, level 0 is always loaded
+    for (int level = 0; !parametric && (level < std::max(lodLevels, 1)); level++)
     {
-        int vrt;
-        string array = path + "/array" + to_string((int)(j / 2) + 1) + to_string(j % 2 + 1);
-        vLoad(&vVertices[j], &vrt, array);
-        vertices.push_back(vrt);
+        string lod_name = (level == 0) ? "" : "_lod" + to_string(level);
+        if ((level > 0) && !QFile::exists(QString::fromStdString(path + "/array11" + lod_name)))
+            break;
+
+        MeshLod lod = MeshLod();    // Meshes which are not loaded are not drawn
+        glGenVertexArrays(VAO_NUM, lod.vao);
+        glGenBuffers(VAO_NUM, lod.vbo);
+        glGenBuffers(VAO_NUM, lod.ibo);
+
+        for (int j = 0; j < VAO_NUM; j++)
+            loadMesh(lod, j, lod_name);
+        lods.push_back(lod);
     }
 
     //////////////////////// Camera textures initialization /////////////////////////////
-
-    GLuint VBO[VAO_NUM];
-    glGenVertexArrays(VAO_NUM, VAO);
-    glGenBuffers(VAO_NUM, VBO);
-
     for (int j = 0; j < VAO_NUM; j++)
-    {
-        bufferObjectInit(&VAO[j], &VBO[j], vVertices[j], vertices[j]);
         texture2dInit(&gTexObj[j]);
-    }
 
+    mask.resize(camera_num);
     for (int j = 0; j < camera_num; j++)
     {
         // j camera mask init
         texture2dInit(&txtMask[j]);
-        string mask_name = path + "/mask" + to_string(j) + ".jpg";
-        Mat camera_mask = imread(mask_name, CV_LOAD_IMAGE_GRAYSCALE);
-        mask.push_back(camera_mask);
+        loadMask(j);
+    }
+}
+
+void SvGpuRender::reloadCamera(int camera)
+{
+    if (mask.empty() || (camera < 0) || (camera >= camera_num))
+        return; // The render has not been initialized yet, all meshes will be loaded by initializeGL
 
-        glBindTexture(GL_TEXTURE_2D, txtMask[j]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, mask[j].cols, mask[j].rows, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, (uchar*)mask[j].data);
-        glBindTexture(GL_TEXTURE_2D, 0);
+    // Buffers of the other cameras are not touched, the next frame uses the new data.
+    // The parametric bowl has no meshes, its camera parameters are updated by setBowlCamera()
+    makeCurrent();
+    for (uint level = 0; level < lods.size(); level++)
+    {
+        string lod_name = (level == 0) ? "" : "_lod" + to_string(level);
+        loadMesh(lods[level], 2 * camera, lod_name);
+        loadMesh(lods[level], 2 * camera + 1, lod_name);
     }
+    loadMask(camera);
+    doneCurrent();
 }
 
-void SvGpuRender::vLoad(GLfloat **vert, int *num, string filename)
+void SvGpuRender::setBowlCamera(int camera, const BowlCamera &param)
 {
-    ifstream input(filename.c_str());
-    *num = count(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>(), '\n'); // Get line number from the array file
-    input.clear();
-    input.seekg(0, ios::beg); // Returning to the beginning of fstream
-
-    *vert = NULL;
-    *vert = (GLfloat*)malloc((*num) * 5 * sizeof(GLfloat));
-    if (*vert == NULL) 	{
-        cout << "Memory allocation did not complete successfully" << endl;
+    if ((camera < 0) || (camera >= CAMERA_NUM))
+        return;
+
+    bowlCameras[camera] = param;
+    if (bowlCameras[camera].invpol.size() > INVPOL_MAX)
+    {
+        cout << "Camera " << camera << ": inverse polynomial is truncated to " << INVPOL_MAX << " coefficients" << endl;
+        bowlCameras[camera].invpol.resize(INVPOL_MAX);
     }
-    for (int k = 0; k < (*num) * 5; k++)
+}
+
+void SvGpuRender::loadMesh(MeshLod &lod, int j, const string &lod_name)
+{
+    ///////////////////////////////// Load vertices arrays ///////////////////////////////
+    // The mesh file is mapped, the data is uploaded without a copy
+    MeshFile mesh;
+    string array = path + "/array" + to_string((int)(j / 2) + 1) + to_string(j % 2 + 1) + lod_name;
+    if (mesh.open(array) != 0)
     {
-        input >> (*vert)[k];
+        cout << "Mesh " << array << " was not loaded, the previous mesh is kept" << endl;
+        return;
     }
-    input.close();
+    lod.vertices[j] = mesh.getVertexNum();
+    lod.indices[j] = mesh.getIndexNum();
+    lod.indexTypes[j] = (mesh.getIndexType() == MESH_UINT16) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+    bufferObjectInit(&lod.vao[j], &lod.vbo[j], mesh);
+    indexBufferInit(&lod.vao[j], &lod.ibo[j], mesh);
+}
+
+void SvGpuRender::loadMask(int camera)
+{
+    string mask_name = path + "/mask" + to_string(camera) + ".jpg";
+    mask[camera] = imread(mask_name, CV_LOAD_IMAGE_GRAYSCALE);
+
+    glBindTexture(GL_TEXTURE_2D, txtMask[camera]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, mask[camera].cols, mask[camera].rows, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, (uchar*)mask[camera].data);
+    glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-void SvGpuRender::bufferObjectInit(GLuint *text_vao, GLuint *text_vbo, GLfloat *vert, int num)
+void SvGpuRender::bufferObjectInit(GLuint *text_vao, GLuint *text_vbo, const MeshFile &mesh)
 {
     // rectangle
     glBindBuffer(GL_ARRAY_BUFFER, *text_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 5 * num, &vert[0], GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, mesh.getDataSize(), mesh.getData(), GL_STATIC_DRAW);
     glBindVertexArray(*text_vao);
     glBindBuffer(GL_ARRAY_BUFFER, *text_vbo);
-    // Position attribute
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)0);
-    // TexCoord attribute
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
     glEnableVertexAttribArray(1);
+    if (mesh.isQuantized())
+    {
+        // Half float position and normalized 16 bit texcoord are converted to float by the vertex fetch
+        glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, mesh.getStride(), (GLvoid*)0);
+        glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_TRUE, mesh.getStride(), (GLvoid*)(4 * sizeof(GLushort)));
+    }
+    else
+    {
+        // Position attribute
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, mesh.getStride(), (GLvoid*)0);
+        // TexCoord attribute
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, mesh.getStride(), (GLvoid*)(3 * sizeof(GLfloat)));
+    }
+    glBindVertexArray(0);
+}
+
+void SvGpuRender::indexBufferInit(GLuint *text_vao, GLuint *text_ibo, const MeshFile &mesh)
+{
+    if (mesh.getIndexNum() == 0) return;
+
+    // The element buffer binding is a part of the vertex array state
+    glBindVertexArray(*text_vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *text_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.getIndexSize(), mesh.getIndices(), GL_STATIC_DRAW);
     glBindVertexArray(0);
 }
 
+void SvGpuRender::drawMesh(const MeshLod &lod, int index)
+{
+    if (lod.indices[index] > 0)
+        glDrawElements(GL_TRIANGLES, lod.indices[index], lod.indexTypes[index], (GLvoid*)0);
+    else
+        glDrawArrays(GL_TRIANGLES, 0, lod.vertices[index]);
+}
+
+// The lattice is the (angle, ring) grid of one camera sector, bowl.vsh expands it with the bowl parameters
+// of each camera. Triangles have the orientation of the CurvilinearGrid cells.
+void SvGpuRender::latticeInit()
+{
+    int sectors = bowlShape.angles - 2 * bowlShape.startAngle;
+    int flat = std::max(bowlShape.flatRings, 1);
+    int rings = flat + bowlShape.sideRings + 1;
+    if (sectors <= 0)
+    {
+        cout << "Bowl lattice was not generated" << endl;
+        latticeIndices = 0;
+        return;
+    }
+
+    std::vector<GLfloat> lattice;
+    for (int a = 0; a <= sectors; a++)
+    {
+        float angle = (bowlShape.startAngle + a) * M_PI / bowlShape.angles;
+        for (int r = 0; r < rings; r++)
+        {
+            lattice.push_back(angle);
+            lattice.push_back((r <= flat) ? (float)r / flat : 1.0f + (float)(r - flat) / bowlShape.sideRings);
+        }
+    }
+
+    std::vector<uint32_t> indices;
+    for (int a = 0; a < sectors; a++)
+    {
+        for (int r = 0; r < rings - 1; r++)
+        {
+            uint32_t p = (a + 1) * rings + r;   // End angle of the sector
+            uint32_t p1 = a * rings + r;        // Start angle of the sector
+            uint32_t p2 = p + 1, p3 = p1 + 1;   // Next ring
+            uint32_t tris[6] = {p, p1, p2, p1, p3, p2};
+            indices.insert(indices.end(), tris, tris + 6);
+        }
+    }
+
+    int vertexNum = lattice.size() / 2;
+    std::vector<int> remap;
+    optimizeVertexCache(indices, vertexNum);
+    optimizeVertexFetch(indices, vertexNum, remap);
+    std::vector<GLfloat> vertices(lattice.size());
+    for (int v = 0; v < vertexNum; v++)
+    {
+        vertices[2 * remap[v]] = lattice[2 * v];
+        vertices[2 * remap[v] + 1] = lattice[2 * v + 1];
+    }
+
+    glGenVertexArrays(1, &latticeVao);
+    glGenBuffers(1, &latticeVbo);
+    glGenBuffers(1, &latticeIbo);
+    glBindVertexArray(latticeVao);
+    glBindBuffer(GL_ARRAY_BUFFER, latticeVbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (GLvoid*)0);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, latticeIbo);
+    latticeIndices = indices.size();
+    if (vertexNum <= 0xffff)
+    {
+        std::vector<GLushort> short_indices(indices.begin(), indices.end());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, short_indices.size() * sizeof(GLushort), short_indices.data(), GL_STATIC_DRAW);
+        latticeIndexType = GL_UNSIGNED_SHORT;
+    }
+    else
+    {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+        latticeIndexType = GL_UNSIGNED_INT;
+    }
+    glBindVertexArray(0);
+}
+
+// The whole sector of each camera is drawn with blending, the masks select the camera of each bowl point
+void SvGpuRender::drawBowl(const glm::mat4 &mvp)
+{
+    bowlProgram.bind();
+    glUniformMatrix4fv(bowlUniforms.mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+    glUniform1i(bowlUniforms.texture, 0);
+    glUniform1i(bowlUniforms.mask, 1);
+    glBindVertexArray(latticeVao);
+
+    for (int camera = 0; camera < camera_num; camera++)
+    {
+        const BowlCamera &cam = bowlCameras[camera];
+        if (cam.invpol.empty())
+            continue;   // The camera is not calibrated
+
+        glUniform3f(bowlUniforms.bowl, cam.innerRadius, cam.radius, bowlShape.height);
+        glUniformMatrix3fv(bowlUniforms.rotation, 1, GL_FALSE, glm::value_ptr(cam.rotation));
+        glUniformMatrix3fv(bowlUniforms.R, 1, GL_FALSE, glm::value_ptr(cam.R));
+        glUniform3fv(bowlUniforms.T, 1, glm::value_ptr(cam.T));
+        glUniform4fv(bowlUniforms.K, 1, glm::value_ptr(cam.K));
+        glUniform4fv(bowlUniforms.dist, 1, glm::value_ptr(cam.dist));
+        glUniform1fv(bowlUniforms.invpol, cam.invpol.size(), cam.invpol.data());
+        glUniform1i(bowlUniforms.invpolNum, cam.invpol.size());
+        glUniform2fv(bowlUniforms.center, 1, glm::value_ptr(cam.center));
+        glUniform3fv(bowlUniforms.affine, 1, glm::value_ptr(cam.affine));
+        glUniform2fv(bowlUniforms.frameSize, 1, glm::value_ptr(cam.frameSize));
+        glUniform1f(bowlUniforms.planeZ, cam.planeZ);
+
+        // Lock the camera frame
+        pthread_mutex_lock(&(*v4l2_cameras)[camera].th_mutex);
+
+        // Get index of the newes camera buffer
+        int i = ((*v4l2_cameras)[camera].fill_buffer_inx == -1) ? 0 : (*v4l2_cameras)[camera].fill_buffer_inx;
+
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, txtMask[camera]);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, gTexObj[2 * camera]);
+        mapFrame(i, camera);
+
+        glDrawElements(GL_TRIANGLES, latticeIndices, latticeIndexType, (GLvoid*)0);
+
+        // Release camera frame
+        pthread_mutex_unlock(&(*v4l2_cameras)[camera].th_mutex);
+    }
+    glBindVertexArray(0);
+}
+
+// Each coarser level has half of the grid resolution, so it is used when the bowl is drawn twice smaller
+int SvGpuRender::selectLod() const
+{
+    float scale = (float)height() / std::max(std::fabs(pz), 1.0f);
+    int level = (int)std::floor(std::log2(LOD_REFERENCE_SCALE / scale));
+    return glm::clamp(level, 0, (int)lods.size() - 1);
+}
+
 void SvGpuRender::texture2dInit(GLuint *texture)
 {
     glGenTextures(1, texture);
@@ -18,6 +18,7 @@
 #include "render/model_loader/ModelLoader.hpp"
 #include "MRT.hpp"
 #include "common/src_v4l2.hpp"
+#include "common/mesh_file.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -29,6 +30,7 @@ QT_END_NAMESPACE
 
 #define CAMERA_NUM  4
 #define VAO_NUM 8 // 2 * CAMERA_NUM
+#define INVPOL_MAX  16  // Size of the invpol uniform array of bowl.vsh
 
 extern "C"
 {
@@ -40,10 +42,37 @@ class SvGpuRender : public QOpenGLWindow, protected QOpenGLExtraFunctions
     Q_OBJECT
 
 public:
+    struct BowlShape {                  // Lattice of the parametric bowl, common for all cameras
+        int angles = 0;                 // Number of sectors of the half circle
+        int startAngle = 0;             // Sectors skipped on both sides of the half circle
+        int flatRings = 0;              // Number of rings of the flat bottom
+        int sideRings = 0;              // Number of rings of the bowl side
+        float height = 0;               // Radial extent of the bowl side, its depth is height^2
+    };
+
+    struct BowlCamera {                 // Bowl and fisheye projection of one camera
+        glm::mat3 rotation;             // Grid rotation of the camera (rotatePoint)
+        glm::mat3 R;                    // Camera rotation
+        glm::vec3 T;                    // Camera translation
+        glm::vec4 K;                    // fx, fy, cx, cy
+        glm::vec4 dist = glm::vec4(0);  // k1, k2, p1, p2
+        std::vector<float> invpol;      // Inverse polynomial of the fisheye model
+        glm::vec2 center;               // Fisheye center
+        glm::vec3 affine;               // sx, shy, shx
+        glm::vec2 frameSize;
+        float planeZ = 0;               // Z of the undistorted image plane (-width / sf)
+        float innerRadius = 0;          // Radius of the first ring
+        float radius = 0;               // Radius of the flat bottom
+    };
+
    explicit SvGpuRender(vector<v4l2Camera> *v4lCams, QWindow *parent = 0);
     ~SvGpuRender();
     int setParam(int camNum, int camWidth, int camHeight, float modelScale[]);
     void setPath(const std::string &p) {path = p;}
+    void setLodLevels(int levels) {lodLevels = levels;}
+    void setBowlShape(const BowlShape &shape) {bowlShape = shape; parametric = true;}
+    void setBowlCamera(int camera, const BowlCamera &param);
+    void reloadCamera(int camera);
 
 public slots:
 
@@ -80,10 +109,31 @@ private:
     QOpenGLShaderProgram renderProgramWB;
     QOpenGLShaderProgram carModelProgram;
     QOpenGLShaderProgram showTexProgram;
+    QOpenGLShaderProgram bowlProgram;
     GLuint mvpUniform, mvUniform, mnUniform;
     vector<v4l2Camera> *v4l2_cameras;	// Camera buffers
-    GLuint VAO[VAO_NUM];
-    vector<int> vertices;
+    struct MeshLod {                    // Meshes of one level of detail
+        GLuint vao[VAO_NUM];
+        GLuint vbo[VAO_NUM];
+        GLuint ibo[VAO_NUM];
+        int vertices[VAO_NUM];
+        int indices[VAO_NUM];           // Number of indices, 0 - the mesh is drawn as triangle list
+        GLenum indexTypes[VAO_NUM];
+    };
+    vector<MeshLod> lods;               // Level 0 is the full resolution grid
+    int lodLevels = 1;
+
+    // Parametric bowl, the lattice is expanded and projected by bowl.vsh instead of the mesh files
+    BowlShape bowlShape;
+    BowlCamera bowlCameras[CAMERA_NUM];
+    bool parametric = false;            // The bowl shape is set, the mesh files are not loaded
+    GLuint latticeVao = 0, latticeVbo = 0, latticeIbo = 0;
+    int latticeIndices = 0;
+    GLenum latticeIndexType = GL_UNSIGNED_SHORT;
+    struct {
+        GLint mvp, bowl, rotation, R, T, K, dist, invpol, invpolNum, center, affine, frameSize, planeZ;
+        GLint texture, mask;
+    } bowlUniforms;
 
     // Cameras mapping
     GLuint gTexObj[VAO_NUM] = {0};		// Camera textures
@@ -98,8 +148,14 @@ private:
     int programsInit();
     bool RenderInit();
     void camTexInit();
-    void vLoad(GLfloat** vert, int* num, string filename);
-    void bufferObjectInit(GLuint* text_vao, GLuint* text_vbo, GLfloat* vert, int num);
+    void loadMesh(MeshLod &lod, int j, const string &lod_name);
+    void loadMask(int camera);
+    void bufferObjectInit(GLuint* text_vao, GLuint* text_vbo, const MeshFile &mesh);
+    void indexBufferInit(GLuint* text_vao, GLuint* text_ibo, const MeshFile &mesh);
+    void drawMesh(const MeshLod &lod, int index);
+    void latticeInit();
+    void drawBowl(const glm::mat4 &mvp);
+    int selectLod() const;
     void texture2dInit(GLuint* texture);
     void ecTexInit();
     void mapFrame(int buf_index, int camera);